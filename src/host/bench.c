@@ -0,0 +1,59 @@
+// Microbenchmarks of the input path as JSON, see pg9021_bench.h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "pg9021_bench.h"
+
+static void usage(const char *name) {
+  fprintf(stderr,
+          "usage: %s [-f] [-n passes]\n"
+          "Times decode, filter, fields and dispatch over the synthetic\n"
+          "idle, mash, sweep and keyboard corpus, 1..%d passes (default\n"
+          "%d). Prints ns per report as one JSON object.\n"
+          "  -f  latency of each report decoded and dispatched, the flash\n"
+          "      writer of the ESP32 run is left out on the host\n",
+          name, PG9021_BENCH_MAX_PASSES, PG9021_BENCH_PASSES);
+}
+
+int main(int argc, char *argv[]) {
+  int passes = PG9021_BENCH_PASSES;
+  int flash = 0;
+  pg9021_bench_t bench;
+  pg9021_bench_flash_t flash_bench;
+  int option;
+
+  while ((option = getopt(argc, argv, "fn:h")) != -1) {
+    switch (option) {
+      case 'f':
+        flash = 1;
+        break;
+      case 'n':
+        passes = atoi(optarg);
+        break;
+      default:
+        usage(argv[0]);
+        return 2;
+    }
+  }
+  if (passes < 1 || passes > PG9021_BENCH_MAX_PASSES || optind < argc) {
+    usage(argv[0]);
+    return 2;
+  }
+
+  if (flash) {
+    if (pg9021_bench_run_flash(&flash_bench, passes) != 0) {
+      fprintf(stderr, "Benchmark not run\n");
+      return 1;
+    }
+    pg9021_bench_flash_print_json(&flash_bench);
+    return 0;
+  }
+  if (pg9021_bench_run(&bench, passes) != 0) {
+    fprintf(stderr, "Benchmark not run\n");
+    return 1;
+  }
+  pg9021_bench_print_json(&bench);
+  return 0;
+}
@@ -0,0 +1,27 @@
+// BTstack configuration for the host build, see btstack_shim.h
+
+#ifndef BTSTACK_CONFIG_H
+#define BTSTACK_CONFIG_H
+
+// Port related features
+#define HAVE_ASSERT
+#define HAVE_MALLOC
+#define HAVE_POSIX_TIME
+
+// BTstack features that can be enabled
+#define ENABLE_CLASSIC
+#define ENABLE_PRINTF_HEXDUMP
+
+// BTstack configuration. buffers, sizes, ...
+#define HCI_ACL_PAYLOAD_SIZE (1691 + 4)
+#define HCI_INCOMING_PRE_BUFFER_SIZE 14  // sizeof BNEP header, avoid memcpy
+#define HCI_OUTGOING_PRE_BUFFER_SIZE 4
+
+#define MAX_NR_HCI_CONNECTIONS 1
+#define MAX_NR_L2CAP_CHANNELS 4
+#define MAX_NR_L2CAP_SERVICES 2
+#define MAX_NR_SERVICE_RECORD_ITEMS 1
+
+#define NVM_NUM_LINK_KEYS 1
+
+#endif  // BTSTACK_CONFIG_H
@@ -0,0 +1,368 @@
+#include "btstack_shim.h"
+
+#include <stdarg.h>
+#include <string.h>
+
+#include "bluetooth_sdp.h"
+#include "btstack.h"
+
+#define MAX_HCI_HANDLERS 4
+#define MAX_CHANNELS 8  // control and interrupt of PG9021_MAX_PLAYERS
+#define MAX_TIMERS 12  // coalesce, reconnect and power of PG9021_MAX_PLAYERS
+#define FIRST_LOCAL_CID 0x0040
+#define CON_HANDLE 0x000b
+#define CHANNEL_MTU 48
+
+#define SDP_ATTRIBUTE_VALUE_MAX 1024  // more than pg9021 keeps
+
+typedef struct {
+  btstack_packet_handler_t handler;
+  bd_addr_t address;
+  uint16_t psm;
+  uint16_t local_cid;
+  uint8_t open;
+} shim_channel_t;
+
+static btstack_packet_callback_registration_t *hci_handlers[MAX_HCI_HANDLERS];
+static int hci_handler_count;
+
+static shim_channel_t channels[MAX_CHANNELS];
+static int channel_count;
+
+// hci_cmd.c is not linked, opcodes as in the HCI specification
+const hci_cmd_t hci_write_page_timeout = {0x0c18, "2"};
+const hci_cmd_t hci_write_page_scan_activity = {0x0c1c, "22"};
+const hci_cmd_t hci_write_page_scan_type = {0x0c47, "1"};
+const hci_cmd_t hci_sniff_mode = {0x0803, "H2222"};
+const hci_cmd_t hci_exit_sniff_mode = {0x0804, "H"};
+
+static btstack_packet_handler_t sdp_callback;
+static int sdp_queries;
+
+// Run loop time only moves with btstack_shim_set_time_ms()
+static btstack_timer_source_t *timers[MAX_TIMERS];
+static int timer_count;
+static uint32_t time_ms;
+
+/*
+ * BTstack API
+ */
+
+void hci_add_event_handler(
+    btstack_packet_callback_registration_t *callback_handler) {
+  if (hci_handler_count < MAX_HCI_HANDLERS) {
+    hci_handlers[hci_handler_count++] = callback_handler;
+  }
+}
+
+int hci_power_control(HCI_POWER_MODE power_mode) {
+  UNUSED(power_mode);
+  return 0;
+}
+
+void hci_set_master_slave_policy(uint8_t policy) { UNUSED(policy); }
+
+int hci_can_send_command_packet_now(void) { return 1; }
+
+static void hci_event(uint8_t *event, uint16_t size) {
+  for (int i = 0; i < hci_handler_count; ++i) {
+    (*hci_handlers[i]->callback)(HCI_EVENT_PACKET, 0, event, size);
+  }
+}
+
+// Completes at once, sniff commands change the mode of the link
+int hci_send_cmd(const hci_cmd_t *cmd, ...) {
+  uint8_t event[8];
+
+  if (cmd != &hci_sniff_mode && cmd != &hci_exit_sniff_mode) {
+    event[0] = HCI_EVENT_COMMAND_COMPLETE;
+    event[1] = 4;
+    event[2] = 1;
+    little_endian_store_16(event, 3, cmd->opcode);
+    event[5] = ERROR_CODE_SUCCESS;
+    hci_event(event, 6);
+    return 0;
+  }
+
+  va_list args;
+  va_start(args, cmd);
+  hci_con_handle_t handle = va_arg(args, int);
+  uint16_t interval = cmd == &hci_sniff_mode ? va_arg(args, int) : 0;
+  va_end(args);
+
+  event[0] = HCI_EVENT_COMMAND_STATUS;
+  event[1] = 4;
+  event[2] = ERROR_CODE_SUCCESS;
+  event[3] = 1;
+  little_endian_store_16(event, 4, cmd->opcode);
+  hci_event(event, 6);
+
+  event[0] = HCI_EVENT_MODE_CHANGE;
+  event[1] = 6;
+  event[2] = ERROR_CODE_SUCCESS;
+  little_endian_store_16(event, 3, handle);
+  event[5] = interval ? 2 : 0;  // sniff or active
+  little_endian_store_16(event, 6, interval);
+  hci_event(event, 8);
+  return 0;
+}
+
+void gap_connectable_control(uint8_t enable) { UNUSED(enable); }
+
+gap_security_level_t gap_get_security_level(void) { return LEVEL_2; }
+
+void gap_set_default_link_policy_settings(
+    uint16_t default_link_policy_settings) {
+  UNUSED(default_link_policy_settings);
+}
+
+int gap_pin_code_response(bd_addr_t addr, const char *pin) {
+  UNUSED(addr);
+  UNUSED(pin);
+  return 0;
+}
+
+void btstack_run_loop_set_timer(btstack_timer_source_t *ts,
+                                uint32_t timeout_in_ms) {
+  ts->timeout = time_ms + timeout_in_ms;
+}
+
+void btstack_run_loop_set_timer_handler(
+    btstack_timer_source_t *ts, void (*process)(btstack_timer_source_t *_ts)) {
+  ts->process = process;
+}
+
+void btstack_run_loop_set_timer_context(btstack_timer_source_t *ts,
+                                        void *context) {
+  ts->context = context;
+}
+
+void *btstack_run_loop_get_timer_context(btstack_timer_source_t *ts) {
+  return ts->context;
+}
+
+int btstack_run_loop_remove_timer(btstack_timer_source_t *timer) {
+  for (int i = 0; i < timer_count; ++i) {
+    if (timers[i] == timer) {
+      timers[i] = timers[--timer_count];
+      return 1;
+    }
+  }
+  return 0;
+}
+
+void btstack_run_loop_add_timer(btstack_timer_source_t *timer) {
+  btstack_run_loop_remove_timer(timer);
+  if (timer_count < MAX_TIMERS) timers[timer_count++] = timer;
+}
+
+uint32_t btstack_run_loop_get_time_ms(void) { return time_ms; }
+
+void l2cap_init(void) {}
+
+uint8_t l2cap_register_service(btstack_packet_handler_t packet_handler,
+                               uint16_t psm, uint16_t mtu,
+                               gap_security_level_t security_level) {
+  UNUSED(packet_handler);
+  UNUSED(psm);
+  UNUSED(mtu);
+  UNUSED(security_level);
+  return ERROR_CODE_SUCCESS;
+}
+
+uint8_t l2cap_create_channel(btstack_packet_handler_t packet_handler,
+                             bd_addr_t address, uint16_t psm, uint16_t mtu,
+                             uint16_t *out_local_cid) {
+  UNUSED(mtu);
+  if (channel_count == MAX_CHANNELS) return BTSTACK_MEMORY_ALLOC_FAILED;
+
+  shim_channel_t *channel = &channels[channel_count];
+  channel->handler = packet_handler;
+  channel->psm = psm;
+  channel->local_cid = FIRST_LOCAL_CID + channel_count;
+  channel->open = 0;
+  bd_addr_copy(channel->address, address);
+  channel_count++;
+
+  *out_local_cid = channel->local_cid;
+  return ERROR_CODE_SUCCESS;
+}
+
+static void channel_closed(shim_channel_t *channel) {
+  uint8_t event[4];
+
+  channel->open = 0;
+  event[0] = L2CAP_EVENT_CHANNEL_CLOSED;
+  event[1] = sizeof(event) - 2;
+  little_endian_store_16(event, 2, channel->local_cid);
+  (*channel->handler)(HCI_EVENT_PACKET, 0, event, sizeof(event));
+}
+
+// A channel that was never opened is dropped without an event
+void l2cap_disconnect(uint16_t local_cid, uint8_t reason) {
+  UNUSED(reason);
+  for (int i = 0; i < channel_count; ++i) {
+    if (channels[i].local_cid != local_cid) continue;
+    if (channels[i].open) {
+      channel_closed(&channels[i]);
+    } else {
+      channels[i].local_cid = 0;
+    }
+  }
+}
+
+void l2cap_accept_connection(uint16_t local_cid) { UNUSED(local_cid); }
+
+void l2cap_decline_connection(uint16_t local_cid) { UNUSED(local_cid); }
+
+uint8_t sdp_client_query_uuid16(btstack_packet_handler_t callback,
+                                bd_addr_t remote, const uint16_t uuid16) {
+  UNUSED(remote);
+  UNUSED(uuid16);
+  sdp_callback = callback;
+  sdp_queries++;
+  return ERROR_CODE_SUCCESS;
+}
+
+/*
+ * Events
+ */
+
+void btstack_shim_power_on(void) {
+  uint8_t event[3] = {BTSTACK_EVENT_STATE, 1, HCI_STATE_WORKING};
+  hci_event(event, sizeof(event));
+}
+
+// L2CAP protocol descriptor: DES {DES {L2CAP, psm}, DES {HIDP}}
+static uint16_t store_protocol_descriptor(uint8_t *buffer, uint16_t psm) {
+  const uint8_t descriptor[] = {0x35, 0x0d, 0x35, 0x06, 0x19, 0x01, 0x00,
+                                0x09, 0x00, 0x00, 0x35, 0x03, 0x19, 0x00,
+                                0x11};
+  memcpy(buffer, descriptor, sizeof(descriptor));
+  big_endian_store_16(buffer, 8, psm);
+  return sizeof(descriptor);
+}
+
+static void sdp_attribute(uint16_t attribute_id, const uint8_t *value,
+                          uint16_t len) {
+  uint8_t event[11];
+
+  event[0] = SDP_EVENT_QUERY_ATTRIBUTE_VALUE;
+  event[1] = sizeof(event) - 2;
+  little_endian_store_16(event, 2, 0);
+  little_endian_store_16(event, 4, attribute_id);
+  little_endian_store_16(event, 6, len);
+  for (uint16_t offset = 0; offset < len; ++offset) {
+    little_endian_store_16(event, 8, offset);
+    event[10] = value[offset];
+    (*sdp_callback)(HCI_EVENT_PACKET, 0, event, sizeof(event));
+  }
+}
+
+int btstack_shim_sdp_hid_record(const uint8_t *descriptor, uint16_t len) {
+  uint8_t value[SDP_ATTRIBUTE_VALUE_MAX];
+  uint16_t pos;
+
+  if (!sdp_callback || len > SDP_ATTRIBUTE_VALUE_MAX - 11) return -1;
+
+  pos = store_protocol_descriptor(value, BTSTACK_SHIM_CONTROL_PSM);
+  sdp_attribute(BLUETOOTH_ATTRIBUTE_PROTOCOL_DESCRIPTOR_LIST, value, pos);
+
+  value[0] = 0x35;
+  value[1] = 0x0f;
+  pos = 2 + store_protocol_descriptor(&value[2], BTSTACK_SHIM_INTERRUPT_PSM);
+  sdp_attribute(BLUETOOTH_ATTRIBUTE_ADDITIONAL_PROTOCOL_DESCRIPTOR_LISTS,
+                value, pos);
+
+  // DES {DES {report descriptor type, descriptor}}
+  value[0] = 0x36;
+  big_endian_store_16(value, 1, len + 8);
+  value[3] = 0x36;
+  big_endian_store_16(value, 4, len + 5);
+  value[6] = 0x08;
+  value[7] = 0x22;
+  value[8] = 0x26;
+  big_endian_store_16(value, 9, len);
+  memcpy(&value[11], descriptor, len);
+  sdp_attribute(BLUETOOTH_ATTRIBUTE_HID_DESCRIPTOR_LIST, value, len + 11);
+
+  uint8_t event[3] = {SDP_EVENT_QUERY_COMPLETE, 1, ERROR_CODE_SUCCESS};
+  btstack_packet_handler_t callback = sdp_callback;
+  sdp_callback = NULL;
+  (*callback)(HCI_EVENT_PACKET, 0, event, sizeof(event));
+  return 0;
+}
+
+void btstack_shim_open_channels(void) {
+  uint8_t event[24];
+
+  // Handlers may create more channels while this runs
+  for (int i = 0; i < channel_count; ++i) {
+    shim_channel_t *channel = &channels[i];
+    if (channel->open || !channel->local_cid) continue;
+    channel->open = 1;
+
+    memset(event, 0, sizeof(event));
+    event[0] = L2CAP_EVENT_CHANNEL_OPENED;
+    event[1] = sizeof(event) - 2;
+    event[2] = ERROR_CODE_SUCCESS;
+    reverse_bd_addr(channel->address, &event[3]);
+    // One ACL link per address
+    little_endian_store_16(event, 9, CON_HANDLE + channel->address[5]);
+    little_endian_store_16(event, 11, channel->psm);
+    little_endian_store_16(event, 13, channel->local_cid);
+    little_endian_store_16(event, 15, channel->local_cid);
+    little_endian_store_16(event, 17, CHANNEL_MTU);
+    little_endian_store_16(event, 19, CHANNEL_MTU);
+    little_endian_store_16(event, 21, 0xffff);
+    event[23] = 0;  // outgoing
+    (*channel->handler)(HCI_EVENT_PACKET, 0, event, sizeof(event));
+  }
+}
+
+int btstack_shim_sdp_queries(void) { return sdp_queries; }
+
+uint16_t btstack_shim_channel_cid(uint16_t psm, int index) {
+  for (int i = 0; i < channel_count; ++i) {
+    if (channels[i].open && channels[i].psm == psm && index-- == 0) {
+      return channels[i].local_cid;
+    }
+  }
+  return 0;
+}
+
+int btstack_shim_l2cap_data(uint16_t local_cid, uint8_t *packet,
+                            uint16_t len) {
+  shim_channel_t *channel = NULL;
+  if (local_cid >= FIRST_LOCAL_CID &&
+      local_cid < FIRST_LOCAL_CID + channel_count) {
+    channel = &channels[local_cid - FIRST_LOCAL_CID];
+  }
+  if (!channel || !channel->open) return -1;
+  (*channel->handler)(L2CAP_DATA_PACKET, local_cid, packet, len);
+  return 0;
+}
+
+void btstack_shim_set_time_ms(uint32_t now) {
+  time_ms = now;
+  for (;;) {
+    btstack_timer_source_t *due = NULL;
+    for (int i = 0; i < timer_count; ++i) {
+      if ((int32_t)(timers[i]->timeout - now) <= 0 &&
+          (!due || (int32_t)(timers[i]->timeout - due->timeout) < 0)) {
+        due = timers[i];
+      }
+    }
+    if (!due) return;
+    btstack_run_loop_remove_timer(due);
+    (*due->process)(due);
+  }
+}
+
+void btstack_shim_close_channels(void) {
+  // Handlers may disconnect the other channels while this runs
+  for (int i = 0; i < channel_count; ++i) {
+    if (channels[i].open) channel_closed(&channels[i]);
+  }
+  channel_count = 0;
+}
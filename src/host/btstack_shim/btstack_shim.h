@@ -0,0 +1,44 @@
+#ifndef BTSTACK_SHIM_H
+#define BTSTACK_SHIM_H
+
+#include <stdint.h>
+
+/*
+ * Host stand-in for the BTstack HCI, GAP, L2CAP and SDP client APIs used by
+ * pg9021.c. Nothing goes over the air: calls are recorded, and the
+ * functions below feed the events a real controller would produce into the
+ * registered packet handlers.
+ */
+
+#define BTSTACK_SHIM_CONTROL_PSM 0x0011
+#define BTSTACK_SHIM_INTERRUPT_PSM 0x0013
+
+// BTSTACK_EVENT_STATE with HCI_STATE_WORKING to every HCI event handler
+void btstack_shim_power_on(void);
+
+// Answer the pending SDP query with a HID record holding descriptor. Queries
+// come one at a time, the next one may start from the answer.
+int btstack_shim_sdp_hid_record(const uint8_t *descriptor, uint16_t len);
+
+// SDP queries started since power on
+int btstack_shim_sdp_queries(void);
+
+// L2CAP_EVENT_CHANNEL_OPENED for every channel created and not disconnected
+// until now
+void btstack_shim_open_channels(void);
+
+// Local CID of the index-th open channel to psm in creation order, 0 if
+// there is none
+uint16_t btstack_shim_channel_cid(uint16_t psm, int index);
+
+// L2CAP_DATA_PACKET on an open channel, packet includes the 0xa1 header
+int btstack_shim_l2cap_data(uint16_t local_cid, uint8_t *packet,
+                            uint16_t len);
+
+// Advance the run loop clock and fire the timers due until now
+void btstack_shim_set_time_ms(uint32_t now);
+
+// L2CAP_EVENT_CHANNEL_CLOSED for every open channel
+void btstack_shim_close_channels(void);
+
+#endif  // BTSTACK_SHIM_H
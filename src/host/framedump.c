@@ -0,0 +1,55 @@
+// Decodes state frames (pg9021_frame.h) from a file or stdin
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "pg9021_frame.h"
+
+static void print_state(int player, const pg9021_state_t *state) {
+  printf("[%d] buttons %08" PRIx32 " hat %u axes", player + 1, state->buttons,
+         state->hat);
+  for (int i = 0; i < PG9021_STATE_AXES; ++i) printf(" %3u", state->axes[i]);
+  printf(" keys");
+  for (int usage = 0; usage < 256; ++usage) {
+    if (pg9021_state_key(state, (uint8_t)usage)) printf(" %02x", usage);
+  }
+  printf("\n");
+}
+
+int main(int argc, char *argv[]) {
+  static pg9021_frame_decoder_t decoder;
+  uint8_t buffer[256];
+  size_t len;
+  FILE *file = stdin;
+
+  if (argc > 2 || (argc == 2 && strcmp(argv[1], "-h") == 0)) {
+    fprintf(stderr, "usage: %s [stream]\n", argv[0]);
+    return 2;
+  }
+  if (argc == 2) {
+    file = fopen(argv[1], "rb");
+    if (!file) {
+      perror(argv[1]);
+      return 1;
+    }
+  }
+
+  pg9021_frame_decoder_init(&decoder);
+  while ((len = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+    for (size_t i = 0; i < len; ++i) {
+      int player = pg9021_frame_decode(&decoder, buffer[i]);
+      if (player >= 0) print_state(player, &decoder.states[player]);
+    }
+    fflush(stdout);
+  }
+  if (file != stdin) fclose(file);
+
+  const pg9021_frame_stats_t *stats = &decoder.stats;
+  fprintf(stderr,
+          "frames %" PRIu32 ", lost %" PRIu32 ", crc errors %" PRIu32
+          ", skipped %" PRIu32 ", sync bytes %" PRIu32 "\n",
+          stats->frames, stats->lost, stats->crc_errors, stats->skipped,
+          stats->sync_bytes);
+  return 0;
+}
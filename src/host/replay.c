@@ -0,0 +1,683 @@
+// Replays HID interrupt reports through pg9021.c and measures the decoder
+
+#include <arpa/inet.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "btstack_shim.h"
+#include "pg9021.h"
+#include "pg9021_bench.h"
+#include "pg9021_capture.h"
+#include "pg9021_console.h"
+#include "pg9021_frame_out.h"
+#include "pg9021_report.h"
+#include "pg9021_ring.h"
+#include "pg9021_trace.h"
+#include "pg9021_udp.h"
+
+#define MAX_PACKET_SIZE 64
+#define MAX_PACKETS 65536
+#define SYNTHETIC_PACKETS 1024
+#define MAX_TRACE_SIZE (16 * 1024 * 1024)
+#define REPORT_INTERVAL_MS 10  // synthetic and text captures
+
+typedef struct {
+  uint32_t time_ms;  // since the first report
+  uint16_t len;
+  uint8_t data[MAX_PACKET_SIZE];  // data[0] is the 0xa1 header
+} packet_t;
+
+static uint8_t descriptor[PG9021_REPORT_MAX_DESCRIPTOR];
+static uint16_t descriptor_len;
+static packet_t *packets;
+static int packet_count;
+
+// Every report goes to each player's interrupt channel in turn
+static int player_count = 1;
+static uint16_t interrupt_cids[PG9021_MAX_PLAYERS];
+
+static uint32_t replay_time_ms;
+static uint64_t event_count;
+static FILE *capture_file;
+static int framing;
+static pg9021_frame_decoder_t frame_decoder;
+static int udp_receiver = -1;
+static uint32_t udp_next_ms;
+static uint32_t udp_received;
+static pg9021_frame_decoder_t udp_decoder;
+
+#ifdef REPLAY_COUNT_ALLOCATIONS
+// Linked with -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+static int counting;
+static uint64_t allocation_count;
+
+void *__wrap_malloc(size_t size) {
+  allocation_count += counting;
+  return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size) {
+  allocation_count += counting;
+  return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+  allocation_count += counting;
+  return __real_realloc(ptr, size);
+}
+#endif
+
+extern int btstack_main(int argc, const char *argv[]);
+
+// Idle, stick sweeps, d-pad and button presses, like a short play session
+static void make_synthetic_capture(void) {
+  // PG-9021 in gamepad mode, the descriptor of the benchmark corpus
+  const uint8_t *synthetic_descriptor =
+      pg9021_bench_descriptor(PG9021_BENCH_MASH, &descriptor_len);
+  memcpy(descriptor, synthetic_descriptor, descriptor_len);
+
+  for (int i = 0; i < SYNTHETIC_PACKETS; ++i) {
+    packet_t *packet = &packets[packet_count++];
+    uint8_t *data = packet->data;
+    int phase = i / 256;
+    int step = i % 256;
+
+    memset(data, 0, 10);
+    packet->time_ms = i * REPORT_INTERVAL_MS;
+    packet->len = 10;
+    data[0] = 0xa1;
+    data[1] = 0x03;
+    data[2] = data[3] = data[4] = data[5] = 0x7f;
+    data[6] = 0x08;
+
+    switch (phase) {
+      case 0:  // idle
+        break;
+      case 1:  // left stick circle
+        data[2] = (uint8_t)step;
+        data[3] = (uint8_t)(255 - step);
+        break;
+      case 2:  // right stick with buttons held
+        data[4] = (uint8_t)step;
+        data[5] = (uint8_t)step;
+        data[7] = (uint8_t)(step >> 4);
+        break;
+      default:  // d-pad and button mashing
+        data[6] = (step >> 3) & 7;
+        data[7] = (step & 1) ? 0x01 : 0x00;
+        data[9] = (step & 4) ? 0x20 : 0x00;
+        break;
+    }
+  }
+}
+
+static int parse_hex(char *text, uint8_t *data, int max) {
+  int len = 0;
+  char *end;
+
+  for (;;) {
+    unsigned long value = strtoul(text, &end, 16);
+    if (end == text) return len;
+    if (len == max || value > 0xff) return -1;
+    data[len++] = (uint8_t)value;
+    text = end;
+  }
+}
+
+static int add_packet(const uint8_t *data, uint16_t len, uint32_t time_ms) {
+  if (len == 0 || len > MAX_PACKET_SIZE || packet_count == MAX_PACKETS) {
+    return -1;
+  }
+  packets[packet_count].time_ms = time_ms;
+  packets[packet_count].len = len;
+  memcpy(packets[packet_count].data, data, len);
+  packet_count++;
+  return 0;
+}
+
+// Binary trace written by pg9021_capture.c, see pg9021_trace.h
+static int load_trace(const char *path, const uint8_t *data, size_t len) {
+  pg9021_trace_reader_t reader;
+  pg9021_trace_record_t record;
+  int descriptors = 0;
+  int status;
+
+  if (pg9021_trace_reader_init(&reader, data, len) != 0) return -1;
+  uint32_t start = reader.timestamp;
+
+  while ((status = pg9021_trace_read(&reader, &record)) == 1) {
+    if (record.type == PG9021_TRACE_RECORD_DESCRIPTOR) {
+      // Reports after a reconnect may use another descriptor
+      if (descriptors++ > 0) break;
+      if (record.len > sizeof(descriptor)) return -1;
+      memcpy(descriptor, record.data, record.len);
+      descriptor_len = record.len;
+    } else if (descriptors &&
+               add_packet(record.data, record.len,
+                          (record.timestamp - start) / 1000) != 0) {
+      fprintf(stderr, "%s: report too long or too many reports\n", path);
+      return -1;
+    }
+  }
+  if (status < 0) {
+    fprintf(stderr, "%s: truncated after %d reports\n", path, packet_count);
+  }
+  return 0;
+}
+
+/*
+ * Text capture, one record per line:
+ *   descriptor 05 01 09 05 ...
+ *   report a1 03 7f 7f ...
+ * Empty lines and lines starting with # are ignored.
+ */
+static int load_text(const char *path, char *text) {
+  uint8_t data[MAX_PACKET_SIZE];
+  int line_number = 0;
+
+  for (char *line = strtok(text, "\n"); line; line = strtok(NULL, "\n")) {
+    line_number++;
+    if (line[0] == '#' || line[0] == '\r') continue;
+
+    int len = -1;
+    if (strncmp(line, "descriptor ", 11) == 0) {
+      len = parse_hex(&line[11], descriptor, sizeof(descriptor));
+      if (len > 0) descriptor_len = (uint16_t)len;
+    } else if (strncmp(line, "report ", 7) == 0) {
+      len = parse_hex(&line[7], data, MAX_PACKET_SIZE);
+      if (len > 0 &&
+          add_packet(data, (uint16_t)len,
+                     packet_count * REPORT_INTERVAL_MS) != 0) {
+        len = -1;
+      }
+    }
+
+    if (len <= 0) {
+      fprintf(stderr, "%s:%d: invalid record\n", path, line_number);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+static int load_capture(const char *path) {
+  FILE *file = fopen(path, "rb");
+  if (!file) {
+    perror(path);
+    return -1;
+  }
+
+  uint8_t *data = malloc(MAX_TRACE_SIZE + 1);
+  size_t len = data ? fread(data, 1, MAX_TRACE_SIZE, file) : 0;
+  fclose(file);
+  if (!data) return -1;
+  data[len] = 0;
+
+  int status;
+  if (len >= 4 && memcmp(data, "PG9T", 4) == 0) {
+    status = load_trace(path, data, len);
+  } else {
+    status = load_text(path, (char *)data);
+  }
+  free(data);
+
+  if (status == 0 && (descriptor_len == 0 || packet_count == 0)) {
+    fprintf(stderr, "%s: descriptor or reports missing\n", path);
+    status = -1;
+  }
+  return status;
+}
+
+// Text capture of what was loaded, converts binary traces
+static void dump_capture(void) {
+  printf("descriptor");
+  for (int i = 0; i < descriptor_len; ++i) printf(" %02x", descriptor[i]);
+  printf("\n");
+  for (int p = 0; p < packet_count; ++p) {
+    printf("report");
+    for (int i = 0; i < packets[p].len; ++i) {
+      printf(" %02x", packets[p].data[i]);
+    }
+    printf("\n");
+  }
+}
+
+static void on_event(uint8_t player, uint16_t page, uint16_t usage,
+                     int32_t value) {
+  (void)player;
+  (void)page;
+  (void)usage;
+  (void)value;
+  event_count++;
+}
+
+static void on_report(uint8_t player, const pg9021_state_t *state,
+                      const pg9021_state_t *prev, uint32_t changed) {
+  pg9021_report_to_fields(player, state, prev, changed, &on_event);
+  pg9021_udp_report(player, state);
+  if (framing) {
+    // The output task of the ESP32, without the UART
+    pg9021_frame_out_report(player, state, changed);
+    pg9021_frame_out_flush();
+  }
+}
+
+static int connect_controllers(void) {
+  char mac[18];
+
+  for (int i = 0; i < player_count; ++i) {
+    snprintf(mac, sizeof(mac), "00:90:E1:00:00:%02X", (uint8_t)(i + 1));
+    if (pg9021_add_gamepad(mac) != i) return -1;
+  }
+  btstack_main(0, NULL);
+  btstack_shim_power_on();
+  for (int i = 0; i < player_count; ++i) {
+    if (btstack_shim_sdp_hid_record(descriptor, descriptor_len) != 0) {
+      return -1;
+    }
+  }
+  btstack_shim_open_channels();
+  for (int i = 0; i < player_count; ++i) {
+    interrupt_cids[i] =
+        btstack_shim_channel_cid(BTSTACK_SHIM_INTERRUPT_PSM, i);
+    if (!interrupt_cids[i]) return -1;
+  }
+  return 0;
+}
+
+// The HID record is known by now, so no SDP query should come first
+static int reconnect_controllers(void) {
+  int queries = btstack_shim_sdp_queries();
+  pg9021_link_info_t info;
+
+  // Channels were closed, the reconnect timer pages them again
+  replay_time_ms += PG9021_RECONNECT_MIN_MS;
+  btstack_shim_set_time_ms(replay_time_ms);
+  btstack_shim_open_channels();
+  int reconnect_queries = btstack_shim_sdp_queries() - queries;
+  for (int i = 0; i < player_count; ++i) {
+    uint16_t cid = btstack_shim_channel_cid(BTSTACK_SHIM_INTERRUPT_PSM, i);
+    if (!cid || btstack_shim_l2cap_data(cid, packets[0].data,
+                                        packets[0].len) != 0) {
+      return -1;
+    }
+    if (pg9021_get_link_info((uint8_t)i, &info) != 0 ||
+        info.state != PG9021_LINK_CONNECTED || info.reconnects != 1) {
+      return -1;
+    }
+  }
+  printf("reconnect: %d SDP queries before the first report (connect: %d)\n",
+         reconnect_queries, queries);
+  printf("reconnect: reacquired after %" PRIu32 " ms\n", info.reacquire_ms);
+  return 0;
+}
+
+static int capture_sink(const uint8_t *data, size_t len) {
+  return fwrite(data, 1, len, capture_file) == len ? 0 : -1;
+}
+
+// Receiver side of the frame output
+static int frame_sink(const uint8_t *data, size_t len) {
+  for (size_t i = 0; i < len; ++i) pg9021_frame_decode(&frame_decoder, data[i]);
+  return 0;
+}
+
+// Decoded states must match the gamepads after the last frame
+static int decoded_states_match(const pg9021_frame_decoder_t *decoder) {
+  pg9021_state_t state;
+
+  for (int i = 0; i < player_count; ++i) {
+    if (pg9021_get_state((uint8_t)i, &state) != 0 ||
+        !pg9021_state_equal(&state, &decoder->states[i])) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+static int check_frames(uint32_t session_ms) {
+  pg9021_frame_out_stats_t out;
+  const pg9021_frame_stats_t *in = &frame_decoder.stats;
+
+  pg9021_frame_out_get_stats(&out);
+  uint32_t frames = out.full + out.delta;
+  printf("frames: %" PRIu32 " (full %" PRIu32 ", delta %" PRIu32
+         "), %.1f bytes/frame\n",
+         frames, out.full, out.delta, frames ? (double)out.bytes / frames : 0);
+  // 8N1, ten bits a byte on the wire
+  printf("frame link: %.0f bit/s at the capture rate\n",
+         session_ms ? out.bytes * 10.0 * 1000 / session_ms : 0);
+  printf("frames decoded: %" PRIu32 ", lost %" PRIu32 ", crc %" PRIu32
+         ", skipped %" PRIu32 "\n",
+         in->frames, in->lost, in->crc_errors, in->skipped);
+
+  if (out.dropped || in->frames != frames || in->lost || in->crc_errors ||
+      in->skipped || in->sync_bytes || !decoded_states_match(&frame_decoder)) {
+    return -1;
+  }
+  return 0;
+}
+
+// Game server side of the UDP sink, over loopback
+static int open_udp_receiver(void) {
+  struct sockaddr_in address = {0};
+  socklen_t len = sizeof(address);
+
+  udp_receiver = socket(AF_INET, SOCK_DGRAM, 0);
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (udp_receiver < 0 ||
+      bind(udp_receiver, (struct sockaddr *)&address, sizeof(address)) != 0 ||
+      getsockname(udp_receiver, (struct sockaddr *)&address, &len) != 0) {
+    perror("udp");
+    return -1;
+  }
+  pg9021_frame_decoder_init(&udp_decoder);
+  return pg9021_udp_start_socket("127.0.0.1", ntohs(address.sin_port));
+}
+
+static void receive_udp(void) {
+  uint8_t datagram[PG9021_UDP_DATAGRAM_SIZE];
+  ssize_t len;
+
+  while ((len = recv(udp_receiver, datagram, sizeof(datagram),
+                     MSG_DONTWAIT)) > 0) {
+    udp_received++;
+    for (ssize_t i = 0; i < len; ++i) {
+      pg9021_frame_decode(&udp_decoder, datagram[i]);
+    }
+  }
+}
+
+// The UDP task of the ESP32, on replay time
+static void poll_udp(uint32_t now_ms) {
+  uint16_t interval_ms, keyframe_ms;
+
+  if (udp_receiver < 0 || (int32_t)(now_ms - udp_next_ms) < 0) return;
+  pg9021_udp_get_rate(&interval_ms, &keyframe_ms);
+  pg9021_udp_poll(now_ms);
+  udp_next_ms = now_ms + interval_ms;
+  receive_udp();
+}
+
+static int check_udp(uint32_t session_ms) {
+  pg9021_udp_stats_t out;
+  const pg9021_frame_stats_t *in = &udp_decoder.stats;
+
+  pg9021_udp_get_stats(&out);
+  printf("udp: %" PRIu32 " datagrams (%" PRIu32 " received), full %" PRIu32
+         ", delta %" PRIu32 ", %.1f bytes/datagram\n",
+         out.datagrams, udp_received, out.full, out.delta,
+         out.datagrams ? (double)out.bytes / out.datagrams : 0);
+  printf("udp: %.0f bit/s payload at the capture rate\n",
+         session_ms ? out.bytes * 8.0 * 1000 / session_ms : 0);
+  printf("udp decoded: %" PRIu32 ", lost %" PRIu32 ", crc %" PRIu32
+         ", skipped %" PRIu32 "\n",
+         in->frames, in->lost, in->crc_errors, in->skipped);
+
+  if (out.errors || udp_received != out.datagrams ||
+      in->frames != out.full + out.delta || in->lost || in->crc_errors ||
+      !decoded_states_match(&udp_decoder)) {
+    return -1;
+  }
+  return 0;
+}
+
+// A full coalescing ring, drained while the producer queues a newer value
+// of an axis that was coalesced before. The older value must not follow.
+static int check_ring(void) {
+  static pg9021_ring_t ring;
+  pg9021_event_t button = {0, PAGE_GAMEPAD_BUTTONS, 1, 1};
+  pg9021_event_t x = {0, PAGE_GAMEPAD_DPAD_THUMB, pg9021_state_axis_usage(0),
+                      1};
+  pg9021_event_t y = {0, PAGE_GAMEPAD_DPAD_THUMB, pg9021_state_axis_usage(1),
+                      2};
+  pg9021_event_t event;
+  int32_t y_value = -1;
+
+  pg9021_ring_init(&ring, PG9021_RING_COALESCE);
+  for (int i = 0; i < PG9021_RING_SIZE; ++i) pg9021_ring_push(&ring, &button);
+  pg9021_ring_push(&ring, &x);
+  pg9021_ring_push(&ring, &y);
+  for (int i = 0; i < PG9021_RING_SIZE; ++i) {
+    if (!pg9021_ring_pop(&ring, &event) || event.usage != button.usage) {
+      return -1;
+    }
+  }
+
+  // Takes both coalesced axes and delivers x, y is still draining
+  if (!pg9021_ring_pop(&ring, &event) || event.usage != x.usage) return -1;
+  y.value = 3;
+  pg9021_ring_push(&ring, &y);
+  while (pg9021_ring_pop(&ring, &event)) {
+    if (event.usage == y.usage) y_value = event.value;
+  }
+  printf("ring: last y %" PRId32 " (queued %" PRId32 ")\n", y_value, y.value);
+  return y_value == y.value ? 0 : -1;
+}
+
+// Run loop time follows the capture, so held axis events go out on time
+static void replay(void) {
+  for (int i = 0; i < packet_count; ++i) {
+    btstack_shim_set_time_ms(replay_time_ms + packets[i].time_ms);
+    for (int player = 0; player < player_count; ++player) {
+      btstack_shim_l2cap_data(interrupt_cids[player], packets[i].data,
+                              packets[i].len);
+    }
+    poll_udp(replay_time_ms + packets[i].time_ms);
+  }
+  replay_time_ms += packets[packet_count - 1].time_ms + REPORT_INTERVAL_MS;
+  btstack_shim_set_time_ms(replay_time_ms);
+}
+
+static uint64_t now_ns(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+static void usage(const char *name) {
+  fprintf(stderr,
+          "usage: %s [-n iterations] [-m max_ns_per_report] [-p players]\n"
+          "       [-d] [-c trace] [-f full|delta] [-u] [capture]\n"
+          "Without a capture a synthetic gamepad session is replayed.\n"
+          "Captures are binary traces (pg9021_trace.h) or text, -d prints\n"
+          "the capture as text instead of replaying it. -c records the\n"
+          "first pass through pg9021_capture.c into a binary trace.\n"
+          "-p connects 1..%d controllers and sends every report to each.\n"
+          "-f encodes the timed passes as state frames (pg9021_frame.h)\n"
+          "and decodes them again. -u streams them as UDP datagrams over\n"
+          "loopback.\n",
+          name, PG9021_MAX_PLAYERS);
+}
+
+int main(int argc, char *argv[]) {
+  int iterations = 1000;
+  double max_ns = 0;
+  int dump = 0;
+  const char *capture_path = NULL;
+  const char *frame_mode = NULL;
+  int udp = 0;
+  int option;
+
+  while ((option = getopt(argc, argv, "n:m:p:dc:f:uh")) != -1) {
+    switch (option) {
+      case 'n':
+        iterations = atoi(optarg);
+        break;
+      case 'm':
+        max_ns = atof(optarg);
+        break;
+      case 'p':
+        player_count = atoi(optarg);
+        break;
+      case 'd':
+        dump = 1;
+        break;
+      case 'c':
+        capture_path = optarg;
+        break;
+      case 'f':
+        frame_mode = optarg;
+        break;
+      case 'u':
+        udp = 1;
+        break;
+      default:
+        usage(argv[0]);
+        return 2;
+    }
+  }
+  if (iterations < 1 || player_count < 1 ||
+      player_count > PG9021_MAX_PLAYERS || optind < argc - 1 ||
+      (frame_mode && strcmp(frame_mode, "full") != 0 &&
+       strcmp(frame_mode, "delta") != 0)) {
+    usage(argv[0]);
+    return 2;
+  }
+
+  packets = calloc(MAX_PACKETS, sizeof(packet_t));
+  if (!packets) return 1;
+  if (optind < argc) {
+    if (load_capture(argv[optind]) != 0) return 1;
+  } else {
+    make_synthetic_capture();
+  }
+  if (dump) {
+    dump_capture();
+    return 0;
+  }
+
+  set_gamepad_report_callback(&on_report);
+  if (connect_controllers() != 0) {
+    fprintf(stderr, "HID connection not established\n");
+    return 1;
+  }
+
+  if (capture_path) {
+    capture_file = fopen(capture_path, "wb");
+    if (!capture_file) {
+      perror(capture_path);
+      return 1;
+    }
+    pg9021_capture_start(&capture_sink);
+  }
+
+  // Warm up caches and the previous report state
+  replay();
+
+  if (capture_file) {
+    pg9021_capture_stats_t capture_stats;
+    pg9021_capture_stop();
+    pg9021_capture_flush();
+    pg9021_capture_get_stats(&capture_stats);
+    fclose(capture_file);
+    printf("captured: %" PRIu32 " records, %" PRIu32 " bytes, %" PRIu32
+           " dropped\n",
+           capture_stats.records, capture_stats.bytes, capture_stats.dropped);
+  }
+  event_count = 0;
+  pg9021_reset_decode_stats();
+  pg9021_console_execute("latency reset");
+  if (frame_mode) {
+    pg9021_frame_decoder_init(&frame_decoder);
+    pg9021_frame_out_start(&frame_sink, strcmp(frame_mode, "full") == 0
+                                            ? PG9021_FRAME_OUT_FULL
+                                            : PG9021_FRAME_OUT_DELTA);
+    framing = 1;
+  }
+  if (udp && open_udp_receiver() != 0) {
+    fprintf(stderr, "UDP sink not started\n");
+    return 1;
+  }
+  uint32_t session_start_ms = replay_time_ms;
+
+#ifdef REPLAY_COUNT_ALLOCATIONS
+  counting = 1;
+#endif
+  uint64_t start = now_ns();
+  for (int i = 0; i < iterations; ++i) {
+    replay();
+  }
+  uint64_t elapsed = now_ns() - start;
+#ifdef REPLAY_COUNT_ALLOCATIONS
+  counting = 0;
+#endif
+  if (framing) {
+    pg9021_frame_out_stop();
+    framing = 0;
+  }
+  if (udp) {
+    // The changes since the last interval
+    udp_next_ms = replay_time_ms;
+    poll_udp(replay_time_ms);
+    pg9021_udp_stop();
+  }
+
+  uint64_t reports = (uint64_t)packet_count * player_count * iterations;
+  double ns_per_report = (double)elapsed / reports;
+  double events_per_second = event_count * 1e9 / elapsed;
+  pg9021_decode_stats_t stats;
+  pg9021_coalesce_stats_t coalesce_stats;
+  pg9021_get_decode_stats(&stats);
+  pg9021_get_coalesce_stats(&coalesce_stats);
+
+  printf("reports: %" PRIu64 " (%d x %d x %d players)\n", reports,
+         packet_count, iterations, player_count);
+  printf("ns/report: %.1f\n", ns_per_report);
+  printf("events/s: %.0f (%" PRIu64 " events)\n", events_per_second,
+         event_count);
+  printf("decoded: skipped %" PRIu32 ", partial %" PRIu32 ", full %" PRIu32
+         "\n",
+         stats.skipped, stats.partial, stats.full);
+  printf("axis events: emitted %" PRIu32 ", coalesced %" PRIu32 "\n",
+         coalesce_stats.emitted, coalesce_stats.coalesced);
+  pg9021_console_execute("latency");
+
+  int status = 0;
+  if (frame_mode && check_frames(replay_time_ms - session_start_ms) != 0) {
+    fprintf(stderr, "FAIL: decoded frames differ from the gamepad state\n");
+    status = 1;
+  }
+  if (udp && check_udp(replay_time_ms - session_start_ms) != 0) {
+    fprintf(stderr, "FAIL: UDP stream differs from the gamepad state\n");
+    status = 1;
+  }
+#ifdef REPLAY_COUNT_ALLOCATIONS
+  printf("allocations: %" PRIu64 "\n", allocation_count);
+  if (allocation_count) {
+    fprintf(stderr, "FAIL: allocations on the input path\n");
+    status = 1;
+  }
+#else
+  printf("allocations: not counted\n");
+#endif
+  if (max_ns > 0 && ns_per_report > max_ns) {
+    fprintf(stderr, "FAIL: %.1f ns/report, limit %.1f\n", ns_per_report,
+            max_ns);
+    status = 1;
+  }
+
+  if (check_ring() != 0) {
+    fprintf(stderr, "FAIL: coalesced axis delivered after a newer event\n");
+    status = 1;
+  }
+
+  btstack_shim_close_channels();
+  if (reconnect_controllers() != 0) {
+    fprintf(stderr, "FAIL: reconnect without the first report\n");
+    status = 1;
+  }
+  btstack_shim_close_channels();
+  free(packets);
+  return status;
+}
@@ -1 +1,3 @@
-CFLAGS += -Wno-format -Wall -Werror
\ No newline at end of file
+CFLAGS += -Wno-format -Wall -Werror
+# Switch tables of PG9021_HOT functions would be read from flash
+CFLAGS += -fno-jump-tables -fno-tree-switch-conversion
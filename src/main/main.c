@@ -4,247 +4,122 @@
 #include "btstack_port_esp32.h"
 #include "btstack_run_loop.h"
 #include "driver/gpio.h"
+#include "driver/uart.h"
+#include "esp_bt.h"
+#include "esp_event.h"
+#include "esp_netif.h"
+#include "esp_wifi.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/queue.h"
 #include "freertos/task.h"
-#include "pg9021_mapping.h"
+#include "pg9021.h"
+#include "pg9021_capture.h"
+#include "pg9021_console.h"
+#include "pg9021_frame_out.h"
+#include "pg9021_log.h"
+#include "pg9021_pipeline.h"
+#include "pg9021_port.h"
+#include "pg9021_ring.h"
+#include "pg9021_udp.h"
 
 #define BUTTON_CONNECT_PIN 17
 
+// Define to record raw reports on UART1, see pg9021_trace.h
+// #define CAPTURE_UART_TX_PIN 4
+#define CAPTURE_UART_BAUD_RATE 921600
+
+// Define to send state frames on UART2, see pg9021_frame.h
+// #define FRAME_UART_TX_PIN 5
+#define FRAME_UART_BAUD_RATE 2000000
+#define FRAME_UART_MODE PG9021_FRAME_OUT_DELTA
+
+// Define to stream the gamepad state to a game server, see pg9021_udp.h
+// #define UDP_SERVER_ADDRESS "192.168.1.2"
+#define UDP_SERVER_PORT PG9021_UDP_PORT
+#define WIFI_SSID "ssid"
+#define WIFI_PASSWORD "password"
+
+// Up to PG9021_MAX_PLAYERS
+static const char* const gamepad_macs[] = {
+    "00:90:E1:D1:9D:96",
+};
+
 static int64_t button_pressed_last_time = 0;
 
 static xQueueHandle button_evt_queue = NULL;
 
+static pg9021_ring_t event_ring;
+static TaskHandle_t event_task_handle = NULL;
+
 extern int btstack_main(int argc, const char* argv[]);
 
-extern void connect_gamepad();
-extern void set_gamepad_mac(const char* mac);
-extern void set_gamepad_action_callback(gamepad_handler_t callback);
 extern void btstack_run_loop_freertos_execute_code_on_main_thread(
     void (*fn)(void* arg), void* arg);
 
-static void print_action(char* event, int32_t value, bool analog);
-static void on_gamepad_action(uint16_t page, uint16_t event, int32_t value);
-
-static void print_action(char* event, int32_t value, bool analog) {
-  if (analog) {
-    printf("%s %d\n", event, value);
-  } else {
-    if (value == 0) {
-      printf("%s released\n\n", event);
-    } else if (value == 1) {
-      printf("%s pressed\n", event);
-    }
-  }
+static void print_action(uint8_t player, uint16_t page, uint16_t usage,
+                         const char* name, int32_t value, bool analog);
+static void on_gamepad_action(uint8_t player, uint16_t page, uint16_t event,
+                              int32_t value);
+
+// Formatted later by the log task
+static void PG9021_HOT print_action(uint8_t player, uint16_t page,
+                                    uint16_t usage, const char* name,
+                                    int32_t value, bool analog) {
+  PG9021_LOGI(analog ? PG9021_LOG_VALUE : PG9021_LOG_BUTTON, player, name,
+              page, usage, value);
 }
 
-static void on_gamepad_action(uint16_t page, uint16_t event, int32_t value) {
-  switch (page) {
-    case PAGE_KEYBOARD_BUTTONS:
-      switch (event) {
-          // D-pad
-        case KB_DPAD_UP:
-          print_action("KB_DPAD_UP", value, false);
-          break;
-        case KB_DPAD_DOWN:
-          print_action("KB_DPAD_DOWN", value, false);
-          break;
-        case KB_DPAD_RIGHT:
-          print_action("KB_DPAD_RIGHT", value, false);
-          break;
-        case KB_DPAD_LEFT:
-          print_action("KB_DPAD_LEFT", value, false);
-          break;
-          // Buttons are the main gamepad buttons
-        case KB_BUTTON_A:
-          print_action("KB_BUTTON_A", value, false);
-          break;
-        case KB_BUTTON_B:
-          print_action("KB_BUTTON_B", value, false);
-          break;
-        case KB_BUTTON_X:
-          print_action("KB_BUTTON_X", value, false);
-          break;
-        case KB_BUTTON_Y:
-          print_action("KB_BUTTON_Y", value, false);
-          break;
-        case KB_BUTTON_SHOULDER_L:
-          print_action("KB_BUTTON_SHOULDER_L", value, false);
-          break;
-        case KB_BUTTON_SHOULDER_R:
-          print_action("KB_BUTTON_SHOULDER_R", value, false);
-          break;
-        case KB_BUTTON_TRIGGER_L:
-          print_action("KB_BUTTON_TRIGGER_L", value, false);
-          break;
-        case KB_BUTTON_TRIGGER_R:
-          print_action("KB_BUTTON_TRIGGER_R", value, false);
-          break;
-        case KB_BUTTON_THUMB_L:
-          print_action("KB_BUTTON_THUMB_L", value, false);
-          break;
-        case KB_BUTTON_THUMB_R:
-          print_action("KB_BUTTON_THUMB_R", value, false);
-          break;
-          // Misc main buttons
-        case KB_MISC_BUTTON_START:
-          print_action("KB_MISC_BUTTON_START", value, false);
-          break;
-        case KB_MISC_BUTTON_SELECT:
-          print_action("KB_MISC_BUTTON_SELECT", value, false);
-          break;
-          // Thumb
-        case KB_THUMB_L_UP:
-          print_action("KB_THUMB_L_UP", value, false);
-          break;
-        case KB_THUMB_L_DOWN:
-          print_action("KB_THUMB_L_DOWN", value, false);
-          break;
-        case KB_THUMB_L_RIGHT:
-          print_action("KB_THUMB_L_RIGHT", value, false);
-          break;
-        case KB_THUMB_L_LEFT:
-          print_action("KB_THUMB_L_LEFT", value, false);
-          break;
-        case KB_THUMB_R_UP:
-          print_action("KB_THUMB_R_UP", value, false);
-          break;
-        case KB_THUMB_R_DOWN:
-          print_action("KB_THUMB_R_DOWN", value, false);
-          break;
-        case KB_THUMB_R_RIGHT:
-          print_action("KB_THUMB_R_RIGHT", value, false);
-          break;
-        case KB_THUMB_R_LEFT:
-          print_action("KB_THUMB_R_LEFT", value, false);
-          break;
-        default:
-          break;
-      }
-      break;
-
-    case PAGE_MISC_ADDITIONAL_BUTTONS:
-      switch (event) {
-        case MISC_BUTTON_HOME:
-          print_action("MISC_BUTTON_HOME", value, false);
-          break;
-        case MISC_BUTTON_MINUS:
-          print_action("MISC_BUTTON_MINUS", value, false);
-          break;
-        case MISC_BUTTON_PREV:
-          print_action("MISC_BUTTON_PREV", value, false);
-          break;
-        case MISC_BUTTON_PLAY:
-          print_action("MISC_BUTTON_PLAY", value, false);
-          break;
-        case MISC_BUTTON_NEXT:
-          print_action("MISC_BUTTON_NEXT", value, false);
-          break;
-        case MISC_BUTTON_PLUS:
-          print_action("MISC_BUTTON_PLUS", value, false);
-          break;
-        default:
-          break;
-      }
-      break;
-
-    case PAGE_GAMEPAD_BUTTONS:
-      switch (event) {
-        // Buttons are the main gamepad buttons
-        case GP_BUTTON_A:
-          print_action("GP_BUTTON_A", value, false);
-          break;
-        case GP_BUTTON_B:
-          print_action("GP_BUTTON_B", value, false);
-          break;
-        case GP_BUTTON_C:
-          print_action("GP_BUTTON_C", value, false);
-          break;
-        case GP_BUTTON_X:
-          print_action("GP_BUTTON_X", value, false);
-          break;
-        case GP_BUTTON_Y:
-          print_action("GP_BUTTON_Y", value, false);
-          break;
-        case GP_BUTTON_Z:
-          print_action("GP_BUTTON_Z", value, false);
-          break;
-        case GP_BUTTON_SHOULDER_L:
-          print_action("GP_BUTTON_SHOULDER_L", value, false);
-          break;
-        case GP_BUTTON_SHOULDER_R:
-          print_action("GP_BUTTON_SHOULDER_R", value, false);
-          break;
-        case GP_BUTTON_TRIGGER_L:
-          print_action("GP_BUTTON_TRIGGER_L", value, false);
-          break;
-        case GP_BUTTON_TRIGGER_R:
-          print_action("GP_BUTTON_TRIGGER_R", value, false);
-          break;
-        case GP_BUTTON_UNKNOWN:
-          print_action("GP_BUTTON_UNKNOWN", value, true);
-          break;
-        case GP_BUTTON_THUMB_L:
-          print_action("GP_BUTTON_THUMB_L", value, false);
-          break;
-        case GP_BUTTON_THUMB_R:
-          print_action("GP_BUTTON_THUMB_R", value, false);
-          break;
-          // Misc main buttons
-        case GP_MISC_BUTTON_START:
-          print_action("GP_MISC_BUTTON_START", value, false);
-          break;
-        case GP_MISC_BUTTON_SELECT:
-          print_action("GP_MISC_BUTTON_SELECT", value, false);
-          break;
-        default:
-          break;
-      }
-      break;
-
-    case PAGE_GAMEPAD_DPAD_THUMB:
-      switch (event) {
-        // D-pad
-        case GP_DPAD_UP:
-          print_action("GP_DPAD_UP", value, false);
-          break;
-        case GP_DPAD_DOWN:
-          print_action("GP_DPAD_DOWN", value, false);
-          break;
-        case GP_DPAD_RIGHT:
-          print_action("GP_DPAD_RIGHT", value, false);
-          break;
-        case GP_DPAD_LEFT:
-          print_action("GP_DPAD_LEFT", value, false);
-          break;
-        // Thumb axis
-        case GP_THUMB_L_X:
-          print_action("GP_THUMB_L_X", value, true);
-          break;
-        case GP_THUMB_L_Y:
-          print_action("GP_THUMB_L_Y", value, true);
-          break;
-        case GP_THUMB_R_X:
-          print_action("GP_THUMB_R_X", value, true);
-          break;
-        case GP_THUMB_R_Y:
-          print_action("GP_THUMB_R_Y", value, true);
-          break;
-        default:
-          break;
-      }
-      break;
+static void PG9021_HOT on_gamepad_action(uint8_t player, uint16_t page,
+                                         uint16_t event, int32_t value) {
+  pg9021_event_id_t id = pg9021_event_id(page, event);
+  if (id == PG9021_EVENT_NONE) return;
 
-    default:
-      break;
+  print_action(player, page, event, pg9021_event_names[id], value,
+               pg9021_event_analog[id]);
+}
+
+// BTstack run loop: queue the report for event_task
+static void PG9021_HOT push_gamepad_action(uint8_t player, uint16_t page,
+                                           uint16_t event, int32_t value) {
+  pg9021_event_t ring_event = {player, (uint8_t)page, event, value};
+  pg9021_ring_push(&event_ring, &ring_event);
+}
+
+static void PG9021_HOT on_gamepad_report(uint8_t player,
+                                         const pg9021_state_t* state,
+                                         const pg9021_state_t* prev,
+                                         uint32_t changed) {
+  pg9021_report_to_fields(player, state, prev, changed, &push_gamepad_action);
+  pg9021_pipeline_notified();
+  xTaskNotifyGive(event_task_handle);
+  pg9021_frame_out_report(player, state, changed);
+  pg9021_udp_report(player, state);
+}
+
+static void PG9021_HOT event_task(void* arg) {
+  pg9021_event_t event;
+  for (;;) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    pg9021_pipeline_woke();
+    while (pg9021_ring_pop(&event_ring, &event)) {
+      on_gamepad_action(event.player, event.page, event.usage, event.value);
+    }
   }
 }
 
+static void setup_event_task() {
+  pg9021_ring_init(&event_ring, PG9021_RING_COALESCE);
+  pg9021_pipeline_create_task(PG9021_STAGE_DISPATCH, event_task, "event_task",
+                              4096, &event_task_handle);
+}
+
 static void IRAM_ATTR button_handler(void* arg) {
   uint32_t button_pin = (uint32_t)arg;
   xQueueSendFromISR(button_evt_queue, &button_pin, NULL);
 }
 
+static void connect_gamepad_on_main_thread(void* arg) { connect_gamepad(); }
+
 static void gpio_task(void* arg) {
   uint32_t io_num;
   int64_t end_time;
@@ -255,8 +130,8 @@ static void gpio_task(void* arg) {
         button_pressed_last_time = end_time;
         printf("Connect button pressed\n");
         void* ptr;
-        btstack_run_loop_freertos_execute_code_on_main_thread(&connect_gamepad,
-                                                              &ptr);
+        btstack_run_loop_freertos_execute_code_on_main_thread(
+            &connect_gamepad_on_main_thread, &ptr);
       }
     }
   }
@@ -273,7 +148,8 @@ static void setup_connect_button() {
 
   // Create a queue to handle gpio event from isr
   button_evt_queue = xQueueCreate(10, sizeof(uint32_t));
-  xTaskCreate(gpio_task, "gpio_task", 2048, NULL, 10, NULL);
+  pg9021_pipeline_create_task(PG9021_STAGE_BUTTON, gpio_task, "gpio_task",
+                              2048, NULL);
 
   // Install gpio isr service
   gpio_install_isr_service(0);
@@ -282,25 +158,100 @@ static void setup_connect_button() {
                        (void*)BUTTON_CONNECT_PIN);
 }
 
-int app_main(void) {
-
-  // MAC address your iPega PG-9021
-  set_gamepad_mac("00:90:E1:D1:9D:96");
+#ifdef UDP_SERVER_ADDRESS
+static void on_wifi_event(void* arg, esp_event_base_t base, int32_t id,
+                          void* data) {
+  // Retries forever, datagrams are dropped while the station is down
+  if (id == WIFI_EVENT_STA_START || id == WIFI_EVENT_STA_DISCONNECTED) {
+    esp_wifi_connect();
+  }
+}
 
-  // Prepare connect button
-  setup_connect_button();
+static void setup_wifi() {
+  wifi_init_config_t init_config = WIFI_INIT_CONFIG_DEFAULT();
+  wifi_config_t config = {
+      .sta = {.ssid = WIFI_SSID, .password = WIFI_PASSWORD},
+  };
 
-  // Set function to receive gamepad signals
-  set_gamepad_action_callback(&on_gamepad_action);
+  init_config.nvs_enable = 0;  // pg9021_cache.c initializes NVS later
+  esp_netif_init();
+  esp_event_loop_create_default();
+  esp_netif_create_default_wifi_sta();
+  esp_wifi_init(&init_config);
+  esp_event_handler_register(WIFI_EVENT, ESP_EVENT_ANY_ID, &on_wifi_event,
+                             NULL);
+  esp_wifi_set_mode(WIFI_MODE_STA);
+  esp_wifi_set_config(ESP_IF_WIFI_STA, &config);
+  esp_wifi_start();
+}
+#endif
 
+// Next to the controller, see pg9021_pipeline.h
+static void btstack_task(void* arg) {
   // Configure BTstack for ESP32 VHCI Controller
   btstack_init();
 
   // Setup btstack
   btstack_main(0, NULL);
 
+  // What is left for output buffering once everything is up
+  pg9021_console_print_heap();
+
   // Enter run loop (forever)
   btstack_run_loop_execute();
+}
+
+int app_main(void) {
+
+#ifdef CONFIG_BTDM_CTRL_MODE_BR_EDR_ONLY
+  // The BLE part of the controller is never used, its RAM goes to the heap.
+  // Only before the controller is initialized in btstack_init().
+  if (esp_bt_controller_mem_release(ESP_BT_MODE_BLE) != ESP_OK) {
+    printf("BLE controller memory not released\n");
+  }
+#endif
+
+  // MAC addresses of your iPega PG-9021s, player 1 first
+  for (size_t i = 0; i < sizeof(gamepad_macs) / sizeof(gamepad_macs[0]); ++i) {
+    pg9021_add_gamepad(gamepad_macs[i]);
+  }
+
+  // Print log records in the background
+  pg9021_log_start_task();
+
+  // "latency" and "stats" commands on the serial monitor
+  pg9021_console_start();
+
+  // Prepare connect button
+  setup_connect_button();
+
+  // Set function to receive gamepad signals, handled in event_task
+  setup_event_task();
+  set_gamepad_report_callback(&on_gamepad_report);
+
+#ifdef CAPTURE_UART_TX_PIN
+  if (pg9021_capture_start_uart(UART_NUM_1, CAPTURE_UART_TX_PIN,
+                                CAPTURE_UART_BAUD_RATE) != 0) {
+    printf("Capture on UART1 failed\n");
+  }
+#endif
+#ifdef FRAME_UART_TX_PIN
+  if (pg9021_frame_out_start_uart(UART_NUM_2, FRAME_UART_TX_PIN,
+                                  FRAME_UART_BAUD_RATE, FRAME_UART_MODE) != 0) {
+    printf("Frame output on UART2 failed\n");
+  }
+#endif
+#ifdef UDP_SERVER_ADDRESS
+  setup_wifi();
+  if (pg9021_udp_start_socket(UDP_SERVER_ADDRESS, UDP_SERVER_PORT) != 0) {
+    printf("UDP output to %s failed\n", UDP_SERVER_ADDRESS);
+  }
+#endif
+
+  // BTstack gets its own task, the main task has no core or priority of
+  // the layout
+  pg9021_pipeline_create_task(PG9021_STAGE_BTSTACK, btstack_task,
+                              "btstack_task", 4096, NULL);
 
   return 0;
 }
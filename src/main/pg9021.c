@@ -1,7 +1,10 @@
 #define BTSTACK_FILE__ "pg9021.c"
 
 #include <inttypes.h>
+#include <stdatomic.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "bluetooth_psm.h"
 #include "bluetooth_sdp.h"
@@ -9,92 +12,482 @@
 #include "btstack_config.h"
 #include "btstack_hid_parser.h"
 #include "l2cap.h"
+#include "pg9021.h"
+#include "pg9021_cache.h"
+#include "pg9021_capture.h"
+#include "pg9021_coalesce.h"
+#include "pg9021_filter.h"
+#include "pg9021_latency.h"
+#include "pg9021_layout.h"
+#include "pg9021_log.h"
 #include "pg9021_mapping.h"
+#include "pg9021_power.h"
+#include "pg9021_report.h"
+#include "pg9021_sdp.h"
+#include "pg9021_state.h"
 #include "sdp_util.h"
 
-#define MAX_ATTRIBUTE_VALUE_SIZE 300
+#define MAX_REPORT_SIZE 64
 
-// Keys
-static uint8_t keyboard_count_zeros = 0;
-static uint16_t keys_states[255];
-static uint16_t keyboard_last_key = 0;
-static uint16_t dpad_last_key = GP_DPAD_RELEASED;
+// Keyboard array error codes, every slot holds one when too many keys are
+// pressed
+#define KEY_ERROR_ROLLOVER 0x01
+#define KEY_ERROR_UNDEFINED 0x03
 
-// SDP
-static uint8_t hid_descriptor[MAX_ATTRIBUTE_VALUE_SIZE];
-static uint16_t hid_descriptor_len;
+// Channel ID to controller, open addressing with linear probing
+#define CHANNEL_SLOTS 16  // power of two, more than 2 * PG9021_MAX_PLAYERS
+#define CHANNEL_MASK (CHANNEL_SLOTS - 1)
 
-static uint16_t hid_control_psm;
-static uint16_t hid_interrupt_psm;
+// controller_t.channels_open
+#define CHANNEL_CONTROL 0x01
+#define CHANNEL_INTERRUPT 0x02
+#define CHANNEL_BOTH (CHANNEL_CONTROL | CHANNEL_INTERRUPT)
 
-static uint8_t attribute_value[MAX_ATTRIBUTE_VALUE_SIZE];
-static const unsigned int attribute_value_buffer_size =
-    MAX_ATTRIBUTE_VALUE_SIZE;
+// Page scan window, 11.25 ms as in the HCI default
+#define PAGE_SCAN_WINDOW 0x0012
 
-// L2CAP
-static uint16_t l2cap_hid_control_cid;
-static uint16_t l2cap_hid_interrupt_cid;
+// HCI commands of hid_host_configure_link(), in order
+typedef enum {
+  LINK_CONFIG_NONE,
+  LINK_CONFIG_PAGE_TIMEOUT,
+  LINK_CONFIG_PAGE_SCAN_ACTIVITY,
+  LINK_CONFIG_PAGE_SCAN_TYPE,
+  LINK_CONFIG_DONE
+} link_config_step_t;
 
-// Remote device address
-static bd_addr_t remote_addr;
+// Previous raw report per compiled report, for delta detection
+typedef struct {
+  uint16_t len;  // 0 - no previous report
+  uint8_t thumbs_settled;
+  uint8_t data[MAX_REPORT_SIZE];
+} last_report_t;
+
+// Everything about one gamepad, controllers[player]
+typedef struct {
+  uint8_t player;
+  uint8_t in_use;      // address configured or taken by an incoming connection
+  uint8_t sdp_wanted;  // waiting for the SDP client
+  bd_addr_t remote_addr;
+
+  // SDP
+  uint16_t hid_control_psm;
+  uint16_t hid_interrupt_psm;
+  uint8_t *hid_descriptor;  // on the heap, hid_descriptor_len bytes
+  uint16_t hid_descriptor_len;
+
+  // HID record cache, see pg9021_cache.h
+  uint32_t cache_hash;  // of the stored record, 0 - none
+  uint8_t sdp_check;    // record from the cache, not confirmed by SDP yet
+
+  // Time to first report
+  uint32_t connect_time_ms;  // btstack_run_loop_get_time_ms()
+  uint8_t first_report_pending;
+
+  // HID descriptor compiled into a field table, see pg9021_report.h
+  pg9021_report_table_t report_table;
+  uint8_t report_table_valid;
+
+  // Fixed offsets of a known controller layout, see pg9021_layout.h
+  pg9021_layout_binding_t layout_binding;
+  uint8_t layout_valid;
+
+  last_report_t last_reports[PG9021_REPORT_MAX_REPORTS];
+
+  // L2CAP
+  uint16_t l2cap_hid_control_cid;
+  uint16_t l2cap_hid_interrupt_cid;
+  uint8_t channels_open;  // CHANNEL_* bits
+  hci_con_handle_t con_handle;
+
+  // Reconnects, see pg9021_link_info_t
+  pg9021_link_state_t link_state;
+  uint8_t incoming;     // the gamepad connects, our attempt was dropped
+  uint8_t reacquiring;  // connected before, lost_time_ms is valid
+  uint16_t attempts;
+  uint32_t reconnects;
+  uint32_t reacquire_ms;
+  uint32_t lost_time_ms;  // btstack_run_loop_get_time_ms()
+  btstack_timer_source_t reconnect_timer;
+  uint8_t reconnect_timer_armed;
+
+  // Activity governor, see pg9021_power.h
+  pg9021_power_t power;
+  btstack_timer_source_t power_timer;
+  uint8_t power_timer_armed;
+  uint8_t sniff_wanted;   // idle, the link should be in sniff mode
+  uint8_t sniff_mode;     // as the last mode change event said
+  uint8_t sniff_pending;  // command sent, no mode change yet
+
+  // Keys of the report being decoded, they replace state.keys at its end
+  uint32_t keys_received[8];
+  uint8_t keys_seen;      // the report has keyboard fields
+  uint8_t keys_rollover;  // too many keys pressed, the previous set stays
+
+  pg9021_state_t state;
+
+  // Thumbs, raw values go through axis_filter into state.axes
+  pg9021_filter_t axis_filter;
+  unsigned filter_generation;  // of filter_config applied to axis_filter
+  uint32_t raw_axes;           // packed, see pg9021_filter.h
+  uint8_t thumbs_received;     // raw_axes changed since the last run
+  uint8_t thumbs_settled;      // the filter reached its fixed point
+
+  // Axis events are rate limited, held ones go out on the report or the
+  // timer
+  pg9021_coalesce_t axis_coalesce;
+  btstack_timer_source_t coalesce_timer;
+  uint32_t coalesce_timer_due;  // btstack_run_loop_get_time_ms()
+  uint8_t coalesce_timer_armed;
+} controller_t;
+
+typedef struct {
+  uint16_t cid;  // 0 - free
+  uint8_t player;
+} channel_slot_t;
+
+static controller_t controllers[PG9021_MAX_PLAYERS];
+static channel_slot_t channel_map[CHANNEL_SLOTS];
+
+static pg9021_decode_stats_t decode_stats;
+
+// Requested by pg9021_set_axis_filter(), applied on the next report
+static pg9021_axis_filter_config_t filter_config[PG9021_STATE_AXES];
+static atomic_uint filter_config_generation;
+
+// The SDP client runs one query at a time
+static controller_t *sdp_controller;
+static link_config_step_t link_config_step;
+static pg9021_sdp_assembler_t sdp_assembler;
 
 // Callbacks
+static gamepad_report_handler_t gamepad_report_callback;
 static gamepad_handler_t gamepad_action_callback;
 static btstack_packet_callback_registration_t hci_event_callback_registration;
 
-void set_gamepad_action_callback(gamepad_handler_t callback);
 static void packet_handler(uint8_t packet_type, uint16_t channel,
                            uint8_t *packet, uint16_t size);
 static void handle_sdp_client_query_result(uint8_t packet_type,
                                            uint16_t channel, uint8_t *packet,
                                            uint16_t size);
+static void hid_host_connect(controller_t *c);
+static void hid_host_cancel_reconnect(controller_t *c);
+static void hid_host_connect_failed(controller_t *c);
+static void query_next_sdp(void);
+
+static PG9021_HOT channel_slot_t *channel_find(uint16_t cid) {
+  unsigned i = cid & CHANNEL_MASK;
+  for (int probes = 0; probes < CHANNEL_SLOTS; ++probes) {
+    if (channel_map[i].cid == cid) return &channel_map[i];
+    if (channel_map[i].cid == 0) return NULL;
+    i = (i + 1) & CHANNEL_MASK;
+  }
+  return NULL;
+}
+
+// Full table - the channel is not routed, only stale CIDs could fill it
+static void channel_add(uint16_t cid, controller_t *c) {
+  if (!cid) return;
+  unsigned i = cid & CHANNEL_MASK;
+  for (int probes = 0; probes < CHANNEL_SLOTS; ++probes) {
+    if (channel_map[i].cid == 0 || channel_map[i].cid == cid) {
+      channel_map[i].cid = cid;
+      channel_map[i].player = c->player;
+      return;
+    }
+    i = (i + 1) & CHANNEL_MASK;
+  }
+}
+
+// Moves later entries of the probe sequence back into the hole
+static void channel_remove(uint16_t cid) {
+  channel_slot_t *slot = cid ? channel_find(cid) : NULL;
+  if (!slot) return;
+
+  unsigned hole = slot - channel_map;
+  channel_map[hole].cid = 0;
+  for (unsigned i = (hole + 1) & CHANNEL_MASK; channel_map[i].cid;
+       i = (i + 1) & CHANNEL_MASK) {
+    unsigned home = channel_map[i].cid & CHANNEL_MASK;
+    // Stays if its home is cyclically in (hole, i]
+    if (((i - home) & CHANNEL_MASK) < ((i - hole) & CHANNEL_MASK)) continue;
+    channel_map[hole] = channel_map[i];
+    channel_map[i].cid = 0;
+    hole = i;
+  }
+}
+
+static PG9021_HOT controller_t *controller_by_cid(uint16_t cid) {
+  channel_slot_t *slot = channel_find(cid);
+  return slot ? &controllers[slot->player] : NULL;
+}
 
-static void clear_keys_states(void) {
-  for (int i = 0; i < 255; ++i) {
-    keys_states[i] = 0;
+static controller_t *controller_by_addr(const bd_addr_t addr) {
+  for (int i = 0; i < PG9021_MAX_PLAYERS; ++i) {
+    if (controllers[i].in_use &&
+        bd_addr_cmp(controllers[i].remote_addr, addr) == 0) {
+      return &controllers[i];
+    }
   }
+  return NULL;
+}
 
-  keys_states[GP_THUMB_L_X] = GP_THUMB_RELEASED;
-  keys_states[GP_THUMB_L_Y] = GP_THUMB_RELEASED;
-  keys_states[GP_THUMB_R_X] = GP_THUMB_RELEASED;
-  keys_states[GP_THUMB_R_Y] = GP_THUMB_RELEASED;
+static controller_t *controller_by_handle(hci_con_handle_t handle) {
+  for (int i = 0; i < PG9021_MAX_PLAYERS; ++i) {
+    if (controllers[i].in_use && controllers[i].con_handle == handle) {
+      return &controllers[i];
+    }
+  }
+  return NULL;
+}
+
+static controller_t *controller_add(const bd_addr_t addr) {
+  controller_t *c = controller_by_addr(addr);
+  for (int i = 0; !c && i < PG9021_MAX_PLAYERS; ++i) {
+    if (!controllers[i].in_use) {
+      c = &controllers[i];
+      c->player = (uint8_t)i;
+      c->in_use = 1;
+      bd_addr_copy(c->remote_addr, addr);
+    }
+  }
+  return c;
+}
+
+static void clear_last_reports(controller_t *c) {
+  for (int i = 0; i < PG9021_REPORT_MAX_REPORTS; ++i) {
+    c->last_reports[i].len = 0;
+  }
+}
+
+static void clear_state(controller_t *c) {
+  pg9021_state_init(&c->state);
+  c->raw_axes = pg9021_filter_pack(c->state.axes);
+  pg9021_filter_reset(&c->axis_filter, c->raw_axes);
+  pg9021_coalesce_reset(&c->axis_coalesce, c->state.axes);
+  if (c->coalesce_timer_armed) {
+    btstack_run_loop_remove_timer(&c->coalesce_timer);
+    c->coalesce_timer_armed = 0;
+  }
+  memset(c->keys_received, 0, sizeof(c->keys_received));
+  c->keys_seen = 0;
+  c->keys_rollover = 0;
+  clear_last_reports(c);
 }
 
-void set_gamepad_mac(const char *mac) {
+static void query_sdp(controller_t *c) {
+  if (c == sdp_controller) return;
+  if (sdp_controller) {
+    c->sdp_wanted = 1;
+    return;
+  }
+  c->sdp_wanted = 0;
+  sdp_controller = c;
+  pg9021_sdp_reset(&sdp_assembler);
+  if (!sdp_assembler.arena) {
+    printf("[%u] No memory for the SDP query\n", c->player + 1);
+  }
+  uint8_t status = sdp_client_query_uuid16(
+      &handle_sdp_client_query_result, c->remote_addr,
+      BLUETOOTH_SERVICE_CLASS_HUMAN_INTERFACE_DEVICE_SERVICE);
+  if (status == ERROR_CODE_SUCCESS) return;
+
+  // No SDP_EVENT_QUERY_COMPLETE follows, the reconnect backoff retries
+  printf("[%u] SDP Query not started: 0x%02x\n", c->player + 1, status);
+  pg9021_sdp_release(&sdp_assembler);
+  query_next_sdp();
+  if (!c->channels_open) hid_host_connect_failed(c);
+}
+
+static void query_next_sdp(void) {
+  sdp_controller = NULL;
+  for (int i = 0; i < PG9021_MAX_PLAYERS; ++i) {
+    if (controllers[i].sdp_wanted) {
+      query_sdp(&controllers[i]);
+      return;
+    }
+  }
+}
+
+int pg9021_add_gamepad(const char *mac) {
+  bd_addr_t addr;
+
   // Parse human readable Bluetooth address
-  sscanf_bd_addr(mac, remote_addr);
+  if (!sscanf_bd_addr(mac, addr)) return -1;
+  controller_t *c = controller_add(addr);
+  if (!c) return -1;
+  if (c->link_state == PG9021_LINK_IDLE) c->link_state = PG9021_LINK_WAITING;
+  return c->player;
 }
 
+void set_gamepad_mac(const char *mac) { pg9021_add_gamepad(mac); }
+
 void connect_gamepad(void) {
-  clear_keys_states();
-  sdp_client_query_uuid16(
-      &handle_sdp_client_query_result, remote_addr,
-      BLUETOOTH_SERVICE_CLASS_HUMAN_INTERFACE_DEVICE_SERVICE);
-  printf("Trying to connect gamepad...\n");
+  for (int i = 0; i < PG9021_MAX_PLAYERS; ++i) {
+    controller_t *c = &controllers[i];
+    if (!c->in_use || c->link_state == PG9021_LINK_CONNECTED ||
+        c->link_state == PG9021_LINK_CONNECTING) {
+      continue;
+    }
+    hid_host_cancel_reconnect(c);
+    clear_state(c);
+    c->attempts = 0;
+    printf("[%u] Trying to connect gamepad...\n", c->player + 1);
+    hid_host_connect(c);
+  }
+}
+
+int pg9021_get_link_info(uint8_t player, pg9021_link_info_t *info) {
+  if (player >= PG9021_MAX_PLAYERS) return -1;
+  const controller_t *c = &controllers[player];
+  info->state = c->link_state;
+  info->attempts = c->attempts;
+  info->reconnects = c->reconnects;
+  info->reacquire_ms = c->reacquire_ms;
+  return 0;
+}
+
+void set_gamepad_report_callback(gamepad_report_handler_t callback) {
+  gamepad_report_callback = callback;
+}
+
+void PG9021_HOT pg9021_report_to_fields(uint8_t player,
+                                        const pg9021_state_t *state,
+                                        const pg9021_state_t *prev,
+                                        uint32_t changed,
+                                        gamepad_handler_t handler) {
+  for (int i = 0; i < PG9021_STATE_AXES; ++i) {
+    if (changed & PG9021_CHANGED_AXIS(i)) {
+      (*handler)(player, PAGE_GAMEPAD_DPAD_THUMB, pg9021_state_axis_usage(i),
+                 state->axes[i]);
+    }
+  }
+
+  if (changed & PG9021_CHANGED_HAT) {
+    if (prev->hat != GP_DPAD_RELEASED) {
+      (*handler)(player, PAGE_GAMEPAD_DPAD_THUMB, prev->hat, 0);
+    }
+    if (state->hat != GP_DPAD_RELEASED) {
+      (*handler)(player, PAGE_GAMEPAD_DPAD_THUMB, state->hat, 1);
+    }
+  }
+
+  if (changed & PG9021_CHANGED_BUTTONS) {
+    uint32_t buttons = state->buttons ^ prev->buttons;
+    while (buttons) {
+      int bit = __builtin_ctz(buttons);
+      buttons &= buttons - 1;
+      int32_t value = (state->buttons >> bit) & 1;
+      if (bit < PG9021_STATE_MISC_SHIFT) {
+        (*handler)(player, PAGE_GAMEPAD_BUTTONS,
+                   bit - PG9021_STATE_GAMEPAD_SHIFT + 1, value);
+      } else {
+        (*handler)(player, PAGE_MISC_ADDITIONAL_BUTTONS,
+                   pg9021_state_misc_usage(bit - PG9021_STATE_MISC_SHIFT),
+                   value);
+      }
+    }
+  }
+
+  if (changed & PG9021_CHANGED_KEYS) {
+    for (int word = 0; word < 8; ++word) {
+      uint32_t keys = state->keys[word] ^ prev->keys[word];
+      while (keys) {
+        int bit = __builtin_ctz(keys);
+        keys &= keys - 1;
+        (*handler)(player, PAGE_KEYBOARD_BUTTONS, word * 32 + bit,
+                   (state->keys[word] >> bit) & 1);
+      }
+    }
+  }
+}
+
+// Compatibility adapter, one gamepad_action_callback call per changed field
+static void PG9021_HOT report_to_action_callback(uint8_t player,
+                                                 const pg9021_state_t *state,
+                                                 const pg9021_state_t *prev,
+                                                 uint32_t changed) {
+  pg9021_report_to_fields(player, state, prev, changed,
+                          gamepad_action_callback);
 }
 
 void set_gamepad_action_callback(gamepad_handler_t callback) {
   gamepad_action_callback = callback;
+  set_gamepad_report_callback(callback ? &report_to_action_callback : NULL);
 }
 
-static void on_device_input(uint16_t page, uint16_t usage, int32_t value) {
-  if (keys_states[usage] != value) {
-    keys_states[usage] = value;
-    (*gamepad_action_callback)(page, usage, value);
+int pg9021_get_state(uint8_t player, pg9021_state_t *snapshot) {
+  if (player >= PG9021_MAX_PLAYERS || !controllers[player].in_use) return -1;
+  *snapshot = controllers[player].state;
+  return 0;
+}
+
+void pg9021_get_decode_stats(pg9021_decode_stats_t *stats) {
+  *stats = decode_stats;
+}
+
+void pg9021_reset_decode_stats(void) {
+  memset(&decode_stats, 0, sizeof(decode_stats));
+  for (int i = 0; i < PG9021_MAX_PLAYERS; ++i) {
+    memset(&controllers[i].axis_coalesce.stats, 0,
+           sizeof(controllers[i].axis_coalesce.stats));
   }
 }
 
-static uint16_t smooth_curve(uint16_t prev, uint16_t current) {
-  if (current == 255 || current == 127 || current == 0) {
-    return current;
+int pg9021_set_axis_rate(int axis, const pg9021_axis_rate_t *config) {
+  for (int i = 0; i < PG9021_MAX_PLAYERS; ++i) {
+    if (pg9021_coalesce_configure(&controllers[i].axis_coalesce, axis,
+                                  config) != 0) {
+      return -1;
+    }
   }
+  return 0;
+}
+
+int pg9021_get_axis_rate(int axis, pg9021_axis_rate_t *config) {
+  if (axis < 0 || axis >= PG9021_STATE_AXES) return -1;
+  *config = controllers[0].axis_coalesce.config[axis];
+  return 0;
+}
 
-  if (prev == 127 &&
-      ((current > 117 && current < 127) || (current > 127 && current < 137))) {
-    return 127;
+void pg9021_get_coalesce_stats(pg9021_coalesce_stats_t *stats) {
+  memset(stats, 0, sizeof(*stats));
+  for (int i = 0; i < PG9021_MAX_PLAYERS; ++i) {
+    stats->emitted += controllers[i].axis_coalesce.stats.emitted;
+    stats->coalesced += controllers[i].axis_coalesce.stats.coalesced;
   }
+}
 
-  return (uint8_t)((prev + current) / 2);
+static void print_decode_stats(void) {
+  printf("Reports skipped: %" PRIu32 ", partial: %" PRIu32 ", full: %" PRIu32
+         "\n",
+         decode_stats.skipped, decode_stats.partial, decode_stats.full);
+}
+
+static void PG9021_HOT on_button_input(controller_t *c, int bit,
+                                       int32_t value) {
+  if (value) {
+    c->state.buttons |= 1UL << bit;
+  } else {
+    c->state.buttons &= ~(1UL << bit);
+  }
+}
+
+int pg9021_set_axis_filter(int axis,
+                           const pg9021_axis_filter_config_t *config) {
+  if (axis < 0 || axis >= PG9021_STATE_AXES ||
+      config->smoothing > PG9021_FILTER_MAX_SMOOTHING) {
+    return -1;
+  }
+  filter_config[axis] = *config;
+  atomic_fetch_add_explicit(&filter_config_generation, 1,
+                            memory_order_release);
+  return 0;
+}
+
+int pg9021_get_axis_filter(int axis, pg9021_axis_filter_config_t *config) {
+  if (axis < 0 || axis >= PG9021_STATE_AXES) return -1;
+  *config = filter_config[axis];
+  return 0;
 }
 
 static void hid_host_setup(void) {
@@ -114,12 +507,364 @@ static void hid_host_setup(void) {
   // try to become master on incoming connections
   hci_set_master_slave_policy(HCI_ROLE_MASTER);
 
+  // Page scan stays on, a gamepad may reconnect before we page it
+  gap_connectable_control(1);
+
   // register for HCI events
   hci_event_callback_registration.callback = &packet_handler;
   hci_add_event_handler(&hci_event_callback_registration);
+}
+
+static void hid_host_bind_layout(controller_t *c) {
+  uint32_t fingerprint = pg9021_layout_fingerprint(&c->report_table);
+
+  c->layout_valid =
+      pg9021_layout_bind(&c->report_table, &c->layout_binding) == 0;
+  if (c->layout_valid) {
+    printf("[%u] HID layout: %s (fingerprint 0x%08" PRIx32
+           ", report ID %u)\n",
+           c->player + 1, c->layout_binding.layout->name, fingerprint,
+           c->layout_binding.report_id);
+  } else {
+    printf("[%u] HID layout unknown (fingerprint 0x%08" PRIx32
+           "), using generic decoder\n",
+           c->player + 1, fingerprint);
+  }
+}
+
+static void hid_host_set_descriptor(controller_t *c, const uint8_t *descriptor,
+                                    uint16_t len) {
+  // Sized to fit, most descriptors are far below the maximum
+  uint8_t *copy = realloc(c->hid_descriptor, len ? len : 1);
+  if (!copy) {
+    printf("[%u] No memory for the HID Descriptor: %u bytes\n",
+           c->player + 1, len);
+    return;
+  }
+  c->hid_descriptor = copy;
+  c->hid_descriptor_len = len;
+  memcpy(c->hid_descriptor, descriptor, len);
+  printf("[%u] HID Descriptor:\n", c->player + 1);
+  printf_hexdump(c->hid_descriptor, c->hid_descriptor_len);
+
+  // Traces hold one controller, the first
+  if (c->player == 0) pg9021_capture_descriptor(descriptor, len);
+
+  c->report_table_valid =
+      pg9021_report_table_compile(&c->report_table, c->hid_descriptor,
+                                  c->hid_descriptor_len) == 0;
+  if (c->report_table_valid) {
+    printf("[%u] HID Descriptor compiled: %u fields\n", c->player + 1,
+           c->report_table.field_count);
+    hid_host_bind_layout(c);
+    clear_last_reports(c);
+  } else {
+    c->layout_valid = 0;
+    printf("[%u] HID Descriptor not compiled, using HID parser\n",
+           c->player + 1);
+  }
+}
+
+static void hid_host_connect_failed(controller_t *c);
+
+static void hid_host_open_control(controller_t *c) {
+  uint8_t status;
+
+  if (!c->hid_control_psm) {
+    c->hid_control_psm = BLUETOOTH_PSM_HID_CONTROL;
+    printf("[%u] HID Control PSM missing, using default 0x%04x\n",
+           c->player + 1, c->hid_control_psm);
+  }
+  if (!c->hid_interrupt_psm) {
+    c->hid_interrupt_psm = BLUETOOTH_PSM_HID_INTERRUPT;
+    printf("[%u] HID Interrupt PSM missing, using default 0x%04x\n",
+           c->player + 1, c->hid_interrupt_psm);
+    hid_host_connect_failed(c);
+    return;
+  }
+  printf("[%u] Setup HID\n", c->player + 1);
+  status = l2cap_create_channel(packet_handler, c->remote_addr,
+                                c->hid_control_psm, 48,
+                                &c->l2cap_hid_control_cid);
+  if (status) {
+    printf("[%u] Connecting to HID Control failed: 0x%02x\n", c->player + 1,
+           status);
+    c->l2cap_hid_control_cid = 0;
+    hid_host_connect_failed(c);
+  } else {
+    channel_add(c->l2cap_hid_control_cid, c);
+  }
+}
+
+// Returns 1 if the HID record is known, from SDP earlier or the cache
+static int hid_host_load_record(controller_t *c) {
+  pg9021_cache_entry_t entry;
+
+  if (c->hid_descriptor_len) return 1;
+  if (!PG9021_DESCRIPTOR_CACHE ||
+      pg9021_cache_load(c->remote_addr, &entry) != 0) {
+    return 0;
+  }
+  printf("[%u] HID record from cache\n", c->player + 1);
+  c->hid_control_psm = entry.control_psm;
+  c->hid_interrupt_psm = entry.interrupt_psm;
+  c->cache_hash = pg9021_cache_hash(&entry);
+  c->sdp_check = 1;
+  hid_host_set_descriptor(c, entry.descriptor, entry.descriptor_len);
+  return 1;
+}
+
+// After an SDP query, only written when the record changed
+static void hid_host_store_record(controller_t *c) {
+  pg9021_cache_entry_t entry;
+
+  if (!PG9021_DESCRIPTOR_CACHE || !c->hid_descriptor_len ||
+      c->hid_descriptor_len > PG9021_CACHE_MAX_DESCRIPTOR) {
+    return;
+  }
+  entry.control_psm = c->hid_control_psm;
+  entry.interrupt_psm = c->hid_interrupt_psm;
+  entry.descriptor_len = c->hid_descriptor_len;
+  entry.descriptor = c->hid_descriptor;
+
+  uint32_t hash = pg9021_cache_hash(&entry);
+  if (hash == c->cache_hash) return;
+  if (pg9021_cache_store(c->remote_addr, &entry) == 0) {
+    c->cache_hash = hash;
+    printf("[%u] HID record cached\n", c->player + 1);
+  } else {
+    printf("[%u] HID record not cached\n", c->player + 1);
+  }
+}
+
+// A known record skips the SDP round trip, it is checked once connected
+static void hid_host_connect(controller_t *c) {
+  c->link_state = PG9021_LINK_CONNECTING;
+  c->incoming = 0;
+  c->connect_time_ms = btstack_run_loop_get_time_ms();
+  c->first_report_pending = 1;
+  if (hid_host_load_record(c)) {
+    hid_host_open_control(c);
+  } else {
+    query_sdp(c);
+  }
+}
+
+static void hid_host_first_report(controller_t *c) {
+  c->first_report_pending = 0;
+  printf("[%u] First report %" PRIu32 " ms after connecting\n",
+         c->player + 1, btstack_run_loop_get_time_ms() - c->connect_time_ms);
+}
+
+// One sniff command in flight per link, retried on the next HCI event
+static void hid_host_update_sniff(controller_t *c) {
+  const pg9021_power_profile_t *profile =
+      pg9021_power_profile(pg9021_power_get_profile());
+
+  if (c->sniff_pending || c->sniff_wanted == c->sniff_mode ||
+      c->link_state != PG9021_LINK_CONNECTED ||
+      (c->sniff_wanted && !profile->sniff_max_ms) ||
+      !hci_can_send_command_packet_now()) {
+    return;
+  }
+  // Set first, the command status event may come back right away
+  c->sniff_pending = 1;
+  if (c->sniff_wanted) {
+    // In 0.625 ms slots, max before min
+    hci_send_cmd(&hci_sniff_mode, c->con_handle, profile->sniff_max_ms * 8 / 5,
+                 profile->sniff_min_ms * 8 / 5, profile->sniff_attempt,
+                 profile->sniff_timeout);
+  } else {
+    hci_send_cmd(&hci_exit_sniff_mode, c->con_handle);
+  }
+}
+
+static void hid_host_arm_power_timer(controller_t *c, uint32_t now);
+
+static void hid_host_handle_power_timer(btstack_timer_source_t *timer) {
+  controller_t *c = btstack_run_loop_get_timer_context(timer);
+  uint32_t now = btstack_run_loop_get_time_ms();
+
+  c->power_timer_armed = 0;
+  if (pg9021_power_check(&c->power, now)) {
+    printf("[%u] Idle\n", c->player + 1);
+    c->sniff_wanted = 1;
+    hid_host_update_sniff(c);
+  }
+  hid_host_arm_power_timer(c, now);
+}
+
+// Fires when the idle time is up, later reports only move it back
+static void hid_host_arm_power_timer(controller_t *c, uint32_t now) {
+  int32_t next = pg9021_power_next(&c->power, now);
+  if (next < 0 || c->power_timer_armed) return;
+  c->power_timer_armed = 1;
+  btstack_run_loop_set_timer_handler(&c->power_timer,
+                                     &hid_host_handle_power_timer);
+  btstack_run_loop_set_timer_context(&c->power_timer, c);
+  btstack_run_loop_set_timer(&c->power_timer, next);
+  btstack_run_loop_add_timer(&c->power_timer);
+}
+
+// A report changed the state. Nothing is printed, this is the wake path.
+static void PG9021_HOT hid_host_activity(controller_t *c, uint32_t now) {
+  if (pg9021_power_activity(&c->power, now)) {
+    c->sniff_wanted = 0;
+    hid_host_update_sniff(c);
+  }
+  if (!c->power_timer_armed) hid_host_arm_power_timer(c, now);
+}
+
+static void hid_host_power_start(controller_t *c) {
+  c->sniff_wanted = 0;
+  c->sniff_mode = 0;
+  c->sniff_pending = 0;
+  uint32_t now = btstack_run_loop_get_time_ms();
+  pg9021_power_connected(&c->power, now);
+  hid_host_arm_power_timer(c, now);
+}
+
+static void hid_host_power_stop(controller_t *c) {
+  pg9021_power_disconnected(&c->power);
+  if (c->power_timer_armed) {
+    btstack_run_loop_remove_timer(&c->power_timer);
+    c->power_timer_armed = 0;
+  }
+}
+
+static void hid_host_cancel_reconnect(controller_t *c) {
+  if (c->reconnect_timer_armed) {
+    btstack_run_loop_remove_timer(&c->reconnect_timer);
+    c->reconnect_timer_armed = 0;
+  }
+}
+
+static void hid_host_handle_reconnect_timer(btstack_timer_source_t *timer) {
+  controller_t *c = btstack_run_loop_get_timer_context(timer);
+
+  c->reconnect_timer_armed = 0;
+  if (c->link_state != PG9021_LINK_WAITING) return;
+  printf("[%u] Reconnecting, attempt %u\n", c->player + 1, c->attempts + 1);
+  hid_host_connect(c);
+}
+
+// Delay doubles per failed attempt, returns it
+static uint32_t hid_host_schedule_reconnect(controller_t *c) {
+  uint32_t delay = PG9021_RECONNECT_MIN_MS;
+
+  for (uint16_t i = 0; i < c->attempts && delay < PG9021_RECONNECT_MAX_MS;
+       ++i) {
+    delay *= 2;
+  }
+  if (delay > PG9021_RECONNECT_MAX_MS) delay = PG9021_RECONNECT_MAX_MS;
+
+  c->link_state = PG9021_LINK_WAITING;
+  c->incoming = 0;
+  hid_host_cancel_reconnect(c);
+  btstack_run_loop_set_timer_handler(&c->reconnect_timer,
+                                     &hid_host_handle_reconnect_timer);
+  btstack_run_loop_set_timer_context(&c->reconnect_timer, c);
+  btstack_run_loop_set_timer(&c->reconnect_timer, delay);
+  btstack_run_loop_add_timer(&c->reconnect_timer);
+  c->reconnect_timer_armed = 1;
+  return delay;
+}
+
+// Channels of an attempt that is given up, their events are not routed
+static void hid_host_drop_channels(controller_t *c) {
+  uint16_t cids[2] = {c->l2cap_hid_control_cid, c->l2cap_hid_interrupt_cid};
+
+  c->l2cap_hid_control_cid = 0;
+  c->l2cap_hid_interrupt_cid = 0;
+  c->channels_open = 0;
+  for (int i = 0; i < 2; ++i) {
+    if (!cids[i]) continue;
+    channel_remove(cids[i]);
+    l2cap_disconnect(cids[i], 0);
+  }
+}
+
+// Any step of a connection attempt failed, SDP or either channel
+static void hid_host_connect_failed(controller_t *c) {
+  if (c->link_state != PG9021_LINK_CONNECTING) return;
+  hid_host_drop_channels(c);
+  if (c->attempts < UINT16_MAX) c->attempts++;
+  uint32_t delay = hid_host_schedule_reconnect(c);
+  printf("[%u] Connection attempt %u failed, retry in %" PRIu32 " ms\n",
+         c->player + 1, c->attempts, delay);
+}
+
+// A channel closed or the ACL link went down while connected
+static void hid_host_link_lost(controller_t *c) {
+  if (c->link_state != PG9021_LINK_CONNECTED) return;
+  printf("[%u] HID Connection closed, reconnecting\n", c->player + 1);
+  print_decode_stats();
+  // Otherwise the record is kept for the reconnect
+  if (!PG9021_DESCRIPTOR_CACHE) {
+    free(c->hid_descriptor);
+    c->hid_descriptor = NULL;
+    c->hid_descriptor_len = 0;
+    c->report_table_valid = 0;
+    c->layout_valid = 0;
+  }
+  hid_host_drop_channels(c);
+  hid_host_power_stop(c);
+  clear_state(c);
+  c->lost_time_ms = btstack_run_loop_get_time_ms();
+  c->reacquiring = 1;
+  c->attempts = 0;
+  hid_host_schedule_reconnect(c);
+}
+
+static void hid_host_link_up(controller_t *c) {
+  hid_host_cancel_reconnect(c);
+  c->link_state = PG9021_LINK_CONNECTED;
+  c->incoming = 0;
+  c->attempts = 0;
+  hid_host_power_start(c);
+  if (!c->reacquiring) return;
+  c->reacquiring = 0;
+  c->reconnects++;
+  c->reacquire_ms = btstack_run_loop_get_time_ms() - c->lost_time_ms;
+  printf("[%u] Reconnected %" PRIu32 " ms after the link loss\n",
+         c->player + 1, c->reacquire_ms);
+}
 
-  // Disable stdout buffering
-  setbuf(stdout, NULL);
+// The gamepad pages us, its channels replace our attempt
+static void hid_host_accept(controller_t *c) {
+  if (c->incoming) return;
+  hid_host_link_lost(c);  // a stale link, the gamepad connects again
+  hid_host_cancel_reconnect(c);
+  hid_host_drop_channels(c);
+  c->link_state = PG9021_LINK_CONNECTING;
+  c->incoming = 1;
+  c->connect_time_ms = btstack_run_loop_get_time_ms();
+  c->first_report_pending = 1;
+}
+
+// One HCI command per call, from the event handler until all are sent
+static void hid_host_configure_link(void) {
+  if (link_config_step == LINK_CONFIG_NONE ||
+      link_config_step == LINK_CONFIG_DONE ||
+      !hci_can_send_command_packet_now()) {
+    return;
+  }
+  // Advanced first, the command complete event may come back right away
+  switch (link_config_step++) {
+    case LINK_CONFIG_PAGE_TIMEOUT:
+      // In 0.625 ms slots
+      hci_send_cmd(&hci_write_page_timeout, PG9021_PAGE_TIMEOUT_MS * 8 / 5);
+      break;
+    case LINK_CONFIG_PAGE_SCAN_ACTIVITY:
+      hci_send_cmd(&hci_write_page_scan_activity,
+                   PG9021_PAGE_SCAN_INTERVAL_MS * 8 / 5, PAGE_SCAN_WINDOW);
+      break;
+    case LINK_CONFIG_PAGE_SCAN_TYPE:
+      hci_send_cmd(&hci_write_page_scan_type, 1);  // interlaced
+      break;
+    default:
+      break;
+  }
 }
 
 /* @section SDP parser callback
@@ -134,156 +879,321 @@ static void handle_sdp_client_query_result(uint8_t packet_type,
   UNUSED(channel);
   UNUSED(size);
 
-  des_iterator_t attribute_list_it;
-  des_iterator_t additional_des_it;
-  des_iterator_t prot_it;
-  uint8_t *des_element;
-  uint8_t *element;
-  uint32_t uuid;
-  uint8_t status;
+  controller_t *c = sdp_controller;
+  const pg9021_sdp_record_t *record = &sdp_assembler.record;
+  uint16_t overflows = sdp_assembler.overflows;
+  uint8_t checked;
+
+  if (!c) return;
 
   switch (hci_event_packet_get_type(packet)) {
     case SDP_EVENT_QUERY_ATTRIBUTE_VALUE:
-      if (sdp_event_query_attribute_byte_get_attribute_length(packet) <=
-          attribute_value_buffer_size) {
-        attribute_value[sdp_event_query_attribute_byte_get_data_offset(
-            packet)] = sdp_event_query_attribute_byte_get_data(packet);
-        if ((uint16_t)(sdp_event_query_attribute_byte_get_data_offset(packet) +
-                       1) ==
-            sdp_event_query_attribute_byte_get_attribute_length(packet)) {
-          switch (sdp_event_query_attribute_byte_get_attribute_id(packet)) {
-            case BLUETOOTH_ATTRIBUTE_PROTOCOL_DESCRIPTOR_LIST:
-              for (des_iterator_init(&attribute_list_it, attribute_value);
-                   des_iterator_has_more(&attribute_list_it);
-                   des_iterator_next(&attribute_list_it)) {
-                if (des_iterator_get_type(&attribute_list_it) != DE_DES)
-                  continue;
-                des_element = des_iterator_get_element(&attribute_list_it);
-                des_iterator_init(&prot_it, des_element);
-                element = des_iterator_get_element(&prot_it);
-                if (!element) continue;
-                if (de_get_element_type(element) != DE_UUID) continue;
-                uuid = de_get_uuid32(element);
-                des_iterator_next(&prot_it);
-                switch (uuid) {
-                  case BLUETOOTH_PROTOCOL_L2CAP:
-                    if (!des_iterator_has_more(&prot_it)) continue;
-                    de_element_get_uint16(des_iterator_get_element(&prot_it),
-                                          &hid_control_psm);
-                    printf("HID Control PSM: 0x%04x\n", (int)hid_control_psm);
-                    break;
-                  default:
-                    break;
-                }
-              }
-              break;
-            case BLUETOOTH_ATTRIBUTE_ADDITIONAL_PROTOCOL_DESCRIPTOR_LISTS:
-              for (des_iterator_init(&attribute_list_it, attribute_value);
-                   des_iterator_has_more(&attribute_list_it);
-                   des_iterator_next(&attribute_list_it)) {
-                if (des_iterator_get_type(&attribute_list_it) != DE_DES)
-                  continue;
-                des_element = des_iterator_get_element(&attribute_list_it);
-                for (des_iterator_init(&additional_des_it, des_element);
-                     des_iterator_has_more(&additional_des_it);
-                     des_iterator_next(&additional_des_it)) {
-                  if (des_iterator_get_type(&additional_des_it) != DE_DES)
-                    continue;
-                  des_element = des_iterator_get_element(&additional_des_it);
-                  des_iterator_init(&prot_it, des_element);
-                  element = des_iterator_get_element(&prot_it);
-                  if (!element) continue;
-                  if (de_get_element_type(element) != DE_UUID) continue;
-                  uuid = de_get_uuid32(element);
-                  des_iterator_next(&prot_it);
-                  switch (uuid) {
-                    case BLUETOOTH_PROTOCOL_L2CAP:
-                      if (!des_iterator_has_more(&prot_it)) continue;
-                      de_element_get_uint16(des_iterator_get_element(&prot_it),
-                                            &hid_interrupt_psm);
-                      printf("HID Interrupt PSM: 0x%04x\n",
-                             (int)hid_interrupt_psm);
-                      break;
-                    default:
-                      break;
-                  }
-                }
-              }
-              break;
-            case BLUETOOTH_ATTRIBUTE_HID_DESCRIPTOR_LIST:
-              for (des_iterator_init(&attribute_list_it, attribute_value);
-                   des_iterator_has_more(&attribute_list_it);
-                   des_iterator_next(&attribute_list_it)) {
-                if (des_iterator_get_type(&attribute_list_it) != DE_DES)
-                  continue;
-                des_element = des_iterator_get_element(&attribute_list_it);
-                for (des_iterator_init(&additional_des_it, des_element);
-                     des_iterator_has_more(&additional_des_it);
-                     des_iterator_next(&additional_des_it)) {
-                  if (des_iterator_get_type(&additional_des_it) != DE_STRING)
-                    continue;
-                  element = des_iterator_get_element(&additional_des_it);
-                  const uint8_t *descriptor = de_get_string(element);
-                  hid_descriptor_len = de_get_data_size(element);
-                  memcpy(hid_descriptor, descriptor, hid_descriptor_len);
-                  printf("HID Descriptor:\n");
-                  printf_hexdump(hid_descriptor, hid_descriptor_len);
-                }
-              }
-              break;
-            default:
-              break;
+      switch (pg9021_sdp_add_byte(
+          &sdp_assembler,
+          sdp_event_query_attribute_byte_get_attribute_id(packet),
+          sdp_event_query_attribute_byte_get_attribute_length(packet),
+          sdp_event_query_attribute_byte_get_data_offset(packet),
+          sdp_event_query_attribute_byte_get_data(packet))) {
+        case 0:
+          if (sdp_assembler.overflows != overflows) {
+            printf("[%u] SDP attribute 0x%04x too large: %u bytes\n",
+                   c->player + 1, sdp_assembler.attribute_id,
+                   sdp_assembler.len);
           }
-        }
-      } else {
-        fprintf(stderr,
-                "SDP attribute value buffer size exceeded: available %d, "
-                "required %d\n",
-                attribute_value_buffer_size,
-                sdp_event_query_attribute_byte_get_attribute_length(packet));
+          break;
+        case BLUETOOTH_ATTRIBUTE_PROTOCOL_DESCRIPTOR_LIST:
+          if (!record->control_psm) break;
+          c->hid_control_psm = record->control_psm;
+          printf("[%u] HID Control PSM: 0x%04x\n", c->player + 1,
+                 (int)c->hid_control_psm);
+          break;
+        case BLUETOOTH_ATTRIBUTE_ADDITIONAL_PROTOCOL_DESCRIPTOR_LISTS:
+          if (!record->interrupt_psm) break;
+          c->hid_interrupt_psm = record->interrupt_psm;
+          printf("[%u] HID Interrupt PSM: 0x%04x\n", c->player + 1,
+                 (int)c->hid_interrupt_psm);
+          break;
+        case BLUETOOTH_ATTRIBUTE_HID_DESCRIPTOR_LIST:
+          if (!record->descriptor) break;
+          if (record->descriptor_len > PG9021_REPORT_MAX_DESCRIPTOR) {
+            printf("[%u] HID Descriptor too large: %u bytes\n",
+                   c->player + 1, record->descriptor_len);
+            break;
+          }
+          // Unchanged when SDP checks a cached record
+          if (record->descriptor_len == c->hid_descriptor_len &&
+              memcmp(record->descriptor, c->hid_descriptor,
+                     c->hid_descriptor_len) == 0) {
+            break;
+          }
+          hid_host_set_descriptor(c, record->descriptor,
+                                  record->descriptor_len);
+          break;
       }
       break;
 
     case SDP_EVENT_QUERY_COMPLETE:
+      // The descriptor was copied, the arena goes back to the heap
+      pg9021_sdp_release(&sdp_assembler);
+      // The next controller may query while this one connects
+      query_next_sdp();
       if (sdp_event_query_complete_get_status(packet) != ERROR_CODE_SUCCESS) {
-        printf("SDP Query failed\n");
+        printf("[%u] SDP Query failed\n", c->player + 1);
+        // Fails the attempt unless it was the check of a connected record
+        if (!c->channels_open) hid_host_connect_failed(c);
         break;
       }
-      if ((l2cap_hid_interrupt_cid != 0) && (l2cap_hid_control_cid != 0)) {
-        printf("HID device re-connected\n");
+      checked = c->sdp_check;
+      c->sdp_check = 0;
+      hid_host_store_record(c);
+      if (c->channels_open == CHANNEL_BOTH) {
+        if (!checked) printf("[%u] HID device re-connected\n", c->player + 1);
         break;
       }
-      if (!hid_control_psm) {
-        hid_control_psm = BLUETOOTH_PSM_HID_CONTROL;
-        printf("HID Control PSM missing, using default 0x%04x\n",
-               hid_control_psm);
-      }
-      if (!hid_interrupt_psm) {
-        hid_interrupt_psm = BLUETOOTH_PSM_HID_INTERRUPT;
-        printf("HID Interrupt PSM missing, using default 0x%04x\n",
-               hid_interrupt_psm);
-        break;
-      }
-      printf("Setup HID\n");
-      status =
-          l2cap_create_channel(packet_handler, remote_addr, hid_control_psm, 48,
-                               &l2cap_hid_control_cid);
-      if (status) {
-        printf("Connecting to HID Control failed: 0x%02x\n", status);
+      // Channels of an incoming connection are on their way
+      if (c->incoming || c->link_state != PG9021_LINK_CONNECTING) break;
+      hid_host_open_control(c);
+      break;
+  }
+}
+
+// Key codes of one report are collected as a set, array slots and bitmap
+// fields alike
+static void PG9021_HOT hid_host_handle_key(controller_t *c, uint16_t usage,
+                                           int32_t value) {
+  c->keys_seen = 1;
+  if (usage >= KEY_ERROR_ROLLOVER && usage <= KEY_ERROR_UNDEFINED) {
+    c->keys_rollover = 1;
+    return;
+  }
+  if (usage == 0 || usage > 0xff || !value) return;
+  if (usage >= 0xE0 && usage <= 0xE7) return;  // Trash
+
+  c->keys_received[usage >> 5] |= 1UL << (usage & 31);
+}
+
+// The set replaces the previous one, the difference between the two is
+// every press and release of the report
+static void PG9021_HOT hid_host_apply_keys(controller_t *c) {
+  if (!c->keys_rollover) {
+    memcpy(c->state.keys, c->keys_received, sizeof(c->state.keys));
+  }
+  memset(c->keys_received, 0, sizeof(c->keys_received));
+  c->keys_seen = 0;
+  c->keys_rollover = 0;
+}
+
+static void PG9021_HOT hid_host_handle_dpad(controller_t *c, int32_t value) {
+  c->state.hat = value & 0x0f;
+}
+
+static void PG9021_HOT hid_host_handle_thumb(controller_t *c, uint16_t usage,
+                                             int32_t value) {
+  int axis = pg9021_state_axis(usage);
+  if (axis < 0) return;
+
+  int shift = 8 * axis;
+  c->raw_axes =
+      (c->raw_axes & ~(0xffu << shift)) | ((uint32_t)(value & 0xff) << shift);
+  c->thumbs_received = 1;
+}
+
+// Once per report, after all of its thumb fields were handled
+static void PG9021_HOT hid_host_filter_thumbs(controller_t *c) {
+  unsigned generation = atomic_load_explicit(&filter_config_generation,
+                                             memory_order_acquire);
+  if (generation != c->filter_generation) {
+    c->filter_generation = generation;
+    for (int axis = 0; axis < PG9021_STATE_AXES; ++axis) {
+      pg9021_filter_configure(&c->axis_filter, axis, &filter_config[axis]);
+    }
+  }
+
+  pg9021_filter_unpack(pg9021_filter_run(&c->axis_filter, c->raw_axes),
+                       c->state.axes);
+  // An identical report would still move the value, so it can't be skipped
+  c->thumbs_settled = c->axis_filter.settled;
+  c->thumbs_received = 0;
+}
+
+static void PG9021_HOT hid_host_handle_field(controller_t *c,
+                                             uint16_t usage_page,
+                                             uint16_t usage, int32_t value) {
+  int bit;
+
+  switch (usage_page) {
+    case PAGE_KEYBOARD_BUTTONS:
+      hid_host_handle_key(c, usage, value);
+      break;
+
+    case PAGE_GAMEPAD_DPAD_THUMB:
+      if (usage == GP_USAGE_DPAD) {
+        hid_host_handle_dpad(c, value);
+      } else {
+        hid_host_handle_thumb(c, usage, value);
       }
       break;
+
+    case PAGE_GAMEPAD_BUTTONS:
+      bit = pg9021_state_gamepad(usage);
+      if (bit >= 0) on_button_input(c, bit, value);
+      break;
+
+    case PAGE_MISC_ADDITIONAL_BUTTONS:
+      bit = pg9021_state_misc(usage);
+      if (bit >= 0) on_button_input(c, bit, value);
+      break;
+
+    default:
+      PG9021_LOGW(PG9021_LOG_USAGE, c->player, "Unknown page", usage_page,
+                  usage, value);
+      break;
   }
 }
 
-static void hid_host_handle_interrupt_report(const uint8_t *report,
-                                             uint16_t report_len) {
-  // check if HID Input Report
-  if (report_len < 1) return;
-  if (*report != 0xa1) return;
-  report++;
-  report_len--;
+static void PG9021_HOT hid_host_handle_button(controller_t *c, int index,
+                                              uint32_t buttons) {
+  if (index >= PG9021_STATE_GAMEPAD_BUTTONS) return;
+  on_button_input(c, PG9021_STATE_GAMEPAD_SHIFT + index,
+                  (buttons >> index) & 1);
+}
+
+static void PG9021_HOT hid_host_handle_misc(controller_t *c,
+                                            const pg9021_layout_t *layout,
+                                            int index, uint8_t misc) {
+  int bit = pg9021_state_misc(layout->misc_usages[index]);
+  if (bit >= 0) on_button_input(c, bit, (misc >> index) & 1);
+}
+
+// Known layout, values are read at the fixed offsets of layout_binding.
+// With a previous report only the fields that differ from it are handled.
+static void PG9021_HOT hid_host_handle_layout_report(
+    controller_t *c, const uint8_t *report, const uint8_t *prev_report) {
+  const pg9021_layout_binding_t *binding = &c->layout_binding;
+  const pg9021_layout_t *layout = binding->layout;
+  pg9021_layout_values_t values;
+  pg9021_layout_values_t prev_values;
+
+  if (layout->kind == PG9021_LAYOUT_KEYBOARD) {
+    if (prev_report &&
+        memcmp(&report[binding->keys_byte], &prev_report[binding->keys_byte],
+               binding->key_count) == 0) {
+      return;  // Only modifiers changed
+    }
+    pg9021_layout_decode_keyboard(binding, report, &values);
+    for (int i = 0; i < binding->key_count; ++i) {
+      hid_host_handle_key(c, values.keys[i], 1);
+    }
+    hid_host_apply_keys(c);
+    return;
+  }
+
+  pg9021_layout_decode_gamepad(binding, report, &values);
+  if (!prev_report) {
+    for (int i = 0; i < PG9021_LAYOUT_AXES; ++i) {
+      hid_host_handle_thumb(c, layout->axis_usages[i], values.axes[i]);
+    }
+    hid_host_filter_thumbs(c);
+    hid_host_handle_dpad(c, values.hat);
+    for (int i = 0; i < binding->button_count; ++i) {
+      hid_host_handle_button(c, i, values.buttons);
+    }
+    for (int i = 0; i < binding->misc_count; ++i) {
+      hid_host_handle_misc(c, layout, i, values.misc);
+    }
+    return;
+  }
+
+  pg9021_layout_decode_gamepad(binding, prev_report, &prev_values);
+
+  // Axes still moving towards their raw value are handled every report
+  if (!c->thumbs_settled ||
+      memcmp(values.axes, prev_values.axes, sizeof(values.axes)) != 0) {
+    for (int i = 0; i < PG9021_LAYOUT_AXES; ++i) {
+      hid_host_handle_thumb(c, layout->axis_usages[i], values.axes[i]);
+    }
+    hid_host_filter_thumbs(c);
+  }
+
+  if (values.hat != prev_values.hat) {
+    hid_host_handle_dpad(c, values.hat);
+  }
+
+  uint32_t changed = values.buttons ^ prev_values.buttons;
+  while (changed) {
+    int i = __builtin_ctz(changed);
+    changed &= changed - 1;
+    hid_host_handle_button(c, i, values.buttons);
+  }
+
+  changed = values.misc ^ prev_values.misc;
+  while (changed) {
+    int i = __builtin_ctz(changed);
+    changed &= changed - 1;
+    hid_host_handle_misc(c, layout, i, values.misc);
+  }
+}
+
+static void PG9021_HOT hid_host_decode_report(controller_t *c,
+                                              const uint8_t *report,
+                                              uint16_t report_len) {
+  if (c->report_table_valid) {
+    const pg9021_report_t *table_report =
+        pg9021_report_table_select(&c->report_table, &report, &report_len);
+    if (!table_report) return;
+
+    last_report_t *last =
+        &c->last_reports[table_report - c->report_table.reports];
+    const uint8_t *prev_report = NULL;
+    if (last->len == report_len) {
+      if (last->thumbs_settled &&
+          memcmp(last->data, report, report_len) == 0) {
+        decode_stats.skipped++;
+        return;
+      }
+      prev_report = last->data;
+    }
+    c->thumbs_settled = prev_report ? last->thumbs_settled : 1;
+
+    if (c->layout_valid &&
+        table_report->report_id == c->layout_binding.report_id &&
+        report_len >= c->layout_binding.report_len) {
+      hid_host_handle_layout_report(c, report, prev_report);
+      if (prev_report) {
+        decode_stats.partial++;
+      } else {
+        decode_stats.full++;
+      }
+    } else {
+      c->thumbs_settled = 1;
+      const pg9021_field_t *field =
+          &c->report_table.fields[table_report->first_field];
+      const pg9021_field_t *end = field + table_report->field_count;
+      for (; field < end; ++field) {
+        uint16_t usage;
+        int32_t value;
+        if (!pg9021_field_get(field, report, report_len, &usage, &value)) {
+          break;
+        }
+        hid_host_handle_field(c, field->usage_page, usage, value);
+      }
+      if (c->thumbs_received) hid_host_filter_thumbs(c);
+      if (c->keys_seen) hid_host_apply_keys(c);
+      decode_stats.full++;
+    }
+
+    if (report_len <= MAX_REPORT_SIZE) {
+      memcpy(last->data, report, report_len);
+      last->len = report_len;
+      last->thumbs_settled = c->thumbs_settled;
+    } else {
+      last->len = 0;
+    }
+    return;
+  }
+
   btstack_hid_parser_t parser;
-  btstack_hid_parser_init(&parser, hid_descriptor, hid_descriptor_len,
+  btstack_hid_parser_init(&parser, c->hid_descriptor, c->hid_descriptor_len,
                           HID_REPORT_TYPE_INPUT, report, report_len);
 
   while (btstack_hid_parser_has_more(&parser)) {
@@ -291,56 +1201,81 @@ static void hid_host_handle_interrupt_report(const uint8_t *report,
     uint16_t usage;
     int32_t value;
     btstack_hid_parser_get_field(&parser, &usage_page, &usage, &value);
+    hid_host_handle_field(c, usage_page, usage, value);
+  }
+  if (c->thumbs_received) hid_host_filter_thumbs(c);
+  if (c->keys_seen) hid_host_apply_keys(c);
+  decode_stats.full++;
+}
 
-    switch (usage_page) {
-      case PAGE_KEYBOARD_BUTTONS:
-        if (usage < 0xE0 || usage > 0xE7) {  // Trash
-          if (usage == 0) {
-            keyboard_count_zeros++;
-            if (keyboard_count_zeros > 5) {  // 5 zeros between cmds
-              keyboard_count_zeros = 0;
-              if (keyboard_last_key != 0) {
-                (*gamepad_action_callback)(usage_page, keyboard_last_key, 0);
-                keyboard_last_key = 0;
-              }
-            }
-          } else {
-            keyboard_count_zeros = 0;
-            if (usage != keyboard_last_key) {
-              keyboard_last_key = usage;
-              (*gamepad_action_callback)(usage_page, usage, 1);
-            }
-          }
-        }
-        break;
+static void hid_host_arm_coalesce_timer(controller_t *c, uint32_t now);
 
-      case PAGE_GAMEPAD_DPAD_THUMB:
-        if (usage == GP_USAGE_DPAD) {
-          if (value == GP_DPAD_RELEASED) {  // D-pad button released
-            if (dpad_last_key != GP_DPAD_RELEASED) {
-              (*gamepad_action_callback)(usage_page, dpad_last_key, 0);
-              dpad_last_key = GP_DPAD_RELEASED;
-            }
-          } else if (dpad_last_key != value) {  // D-pad button pressed
-            dpad_last_key = value;
-            (*gamepad_action_callback)(usage_page, value, 1);
-          }
-        } else {  // Thumb
-          value = smooth_curve(keys_states[usage], value);
-          on_device_input(usage_page, usage, value);
-        }
-        break;
+static void hid_host_handle_coalesce_timer(btstack_timer_source_t *timer) {
+  controller_t *c = btstack_run_loop_get_timer_context(timer);
+  uint32_t now = btstack_run_loop_get_time_ms();
 
-      case PAGE_GAMEPAD_BUTTONS:
-      case PAGE_MISC_ADDITIONAL_BUTTONS:
-        on_device_input(usage_page, usage, value);
-        break;
+  c->coalesce_timer_armed = 0;
+  uint32_t changed = pg9021_coalesce_due(&c->axis_coalesce, &c->state, now);
+  if (changed && gamepad_report_callback) {
+    (*gamepad_report_callback)(c->player, &c->state, &c->state, changed);
+  }
+  hid_host_arm_coalesce_timer(c, now);
+}
 
-      default:
-        printf("UNNOWN page: 0x%04x, usage: 0x%04x, value=%d\n", usage_page,
-               usage, value);
-        break;
-    }
+// Fire when the first held axis is due
+static void PG9021_HOT hid_host_arm_coalesce_timer(controller_t *c,
+                                                   uint32_t now) {
+  int32_t next = pg9021_coalesce_next(&c->axis_coalesce, now);
+  if (next < 0) return;
+  if (c->coalesce_timer_armed) {
+    if ((int32_t)(c->coalesce_timer_due - (now + next)) <= 0) return;
+    btstack_run_loop_remove_timer(&c->coalesce_timer);
+  }
+  c->coalesce_timer_due = now + next;
+  c->coalesce_timer_armed = 1;
+  btstack_run_loop_set_timer_handler(&c->coalesce_timer,
+                                     &hid_host_handle_coalesce_timer);
+  btstack_run_loop_set_timer_context(&c->coalesce_timer, c);
+  btstack_run_loop_set_timer(&c->coalesce_timer, next);
+  btstack_run_loop_add_timer(&c->coalesce_timer);
+}
+
+// received - pg9021_latency_now() when the L2CAP data packet arrived
+static void PG9021_HOT hid_host_handle_interrupt_report(controller_t *c,
+                                                        const uint8_t *report,
+                                                        uint16_t report_len,
+                                                        uint32_t received) {
+  // check if HID Input Report
+  if (report_len < 1) return;
+  if (*report != 0xa1) return;
+  report++;
+  report_len--;
+
+  pg9021_state_t prev_state = c->state;
+  hid_host_decode_report(c, report, report_len);
+
+  uint32_t changed = pg9021_state_changes(&prev_state, &c->state);
+  if (changed || c->axis_coalesce.pending) {
+    uint32_t now = btstack_run_loop_get_time_ms();
+    if (changed) hid_host_activity(c, now);
+    changed = pg9021_coalesce_report(&c->axis_coalesce, &c->state, changed,
+                                     now);
+    if (c->axis_coalesce.pending) hid_host_arm_coalesce_timer(c, now);
+  }
+#if PG9021_LATENCY
+  uint32_t decoded = pg9021_latency_now();
+  pg9021_latency_add(PG9021_LATENCY_DECODE, decoded - received);
+#else
+  (void)received;
+#endif
+
+  if (changed && gamepad_report_callback) {
+    (*gamepad_report_callback)(c->player, &c->state, &prev_state, changed);
+#if PG9021_LATENCY
+    uint32_t handled = pg9021_latency_now();
+    pg9021_latency_add(PG9021_LATENCY_CALLBACK, handled - decoded);
+    pg9021_latency_add(PG9021_LATENCY_TOTAL, handled - received);
+#endif
   }
 }
 
@@ -351,31 +1286,81 @@ static void hid_host_handle_interrupt_report(const uint8_t *report,
  */
 
 /* LISTING_START(packetHandler): Packet Handler */
-static void packet_handler(uint8_t packet_type, uint16_t channel,
-                           uint8_t *packet, uint16_t size) {
+static void PG9021_HOT packet_handler(uint8_t packet_type, uint16_t channel,
+                                      uint8_t *packet, uint16_t size) {
   uint8_t event;
   uint8_t status;
   bd_addr_t event_addr;
   uint16_t l2cap_cid;
+  controller_t *c;
 
   switch (packet_type) {
     case HCI_EVENT_PACKET:
       event = hci_event_packet_get_type(packet);
       switch (event) {
         /* @text When BTSTACK_EVENT_STATE with state HCI_STATE_WORKING
-         * is received and the example is started in client mode, the remote SDP
-         * HID query is started.
+         * is received and the example is started in client mode, every
+         * configured gamepad is connected, after a remote SDP HID query
+         * unless its HID record is cached.
          */
         case BTSTACK_EVENT_STATE:
           if (btstack_event_state_get_state(packet) == HCI_STATE_WORKING) {
-            printf("Start SDP HID query for remote HID Device %s.\n",
-                   bd_addr_to_str(remote_addr));
-            sdp_client_query_uuid16(
-                &handle_sdp_client_query_result, remote_addr,
-                BLUETOOTH_SERVICE_CLASS_HUMAN_INTERFACE_DEVICE_SERVICE);
+            link_config_step = LINK_CONFIG_PAGE_TIMEOUT;
+            hid_host_configure_link();
+            for (int i = 0; i < PG9021_MAX_PLAYERS; ++i) {
+              if (!controllers[i].in_use) continue;
+              printf("[%d] Connecting to remote HID Device %s.\n", i + 1,
+                     bd_addr_to_str(controllers[i].remote_addr));
+              hid_host_connect(&controllers[i]);
+            }
           }
           break;
 
+        case HCI_EVENT_COMMAND_STATUS:
+          // A rejected sniff command is not retried until the next change
+          if (hci_event_command_status_get_status(packet) &&
+              (hci_event_command_status_get_command_opcode(packet) ==
+                   hci_sniff_mode.opcode ||
+               hci_event_command_status_get_command_opcode(packet) ==
+                   hci_exit_sniff_mode.opcode)) {
+            for (int i = 0; i < PG9021_MAX_PLAYERS; ++i) {
+              c = &controllers[i];
+              if (!c->sniff_pending) continue;
+              c->sniff_pending = 0;
+              c->sniff_wanted = c->sniff_mode;
+            }
+          }
+          // fall through
+        case HCI_EVENT_COMMAND_COMPLETE:
+          hid_host_configure_link();
+          for (int i = 0; i < PG9021_MAX_PLAYERS; ++i) {
+            hid_host_update_sniff(&controllers[i]);
+          }
+          break;
+
+        case HCI_EVENT_MODE_CHANGE:
+          c = controller_by_handle(hci_event_mode_change_get_handle(packet));
+          if (!c) break;
+          c->sniff_pending = 0;
+          if (hci_event_mode_change_get_status(packet) == ERROR_CODE_SUCCESS) {
+            c->sniff_mode = hci_event_mode_change_get_mode(packet) == 2;
+          } else {
+            c->sniff_wanted = c->sniff_mode;
+          }
+          hid_host_update_sniff(c);
+          break;
+
+        case HCI_EVENT_DISCONNECTION_COMPLETE:
+          c = controller_by_handle(
+              hci_event_disconnection_complete_get_connection_handle(packet));
+          if (!c) break;
+          printf("[%u] Disconnected, reason 0x%02x\n", c->player + 1,
+                 hci_event_disconnection_complete_get_reason(packet));
+          c->con_handle = HCI_CON_HANDLE_INVALID;
+          // Usually after the channels closed, then it does nothing
+          hid_host_link_lost(c);
+          break;
+
         /* LISTING_PAUSE */
         case HCI_EVENT_PIN_CODE_REQUEST:
           // inform about pin code request
@@ -387,10 +1372,19 @@ static void packet_handler(uint8_t packet_type, uint16_t channel,
         /* LISTING_RESUME */
         case L2CAP_EVENT_INCOMING_CONNECTION:
           l2cap_cid = l2cap_event_incoming_connection_get_local_cid(packet);
+          l2cap_event_incoming_connection_get_address(packet, event_addr);
+          c = controller_add(event_addr);
           switch (l2cap_event_incoming_connection_get_psm(packet)) {
             case PSM_HID_CONTROL:
             case PSM_HID_INTERRUPT:
-              l2cap_accept_connection(l2cap_cid);
+              if (c) {
+                hid_host_accept(c);
+                channel_add(l2cap_cid, c);
+                l2cap_accept_connection(l2cap_cid);
+                break;
+              }
+              printf("No free player for %s\n", bd_addr_to_str(event_addr));
+              l2cap_decline_connection(l2cap_cid);
               break;
             default:
               l2cap_decline_connection(l2cap_cid);
@@ -398,66 +1392,96 @@ static void packet_handler(uint8_t packet_type, uint16_t channel,
           }
           break;
         case L2CAP_EVENT_CHANNEL_OPENED:
+          l2cap_cid = l2cap_event_channel_opened_get_local_cid(packet);
+          c = controller_by_cid(l2cap_cid);
+          if (!c) break;
           status = packet[2];
           if (status) {
-            printf("L2CAP Connection failed: 0x%02x\n", status);
+            printf("[%u] L2CAP Connection failed: 0x%02x\n", c->player + 1,
+                   status);
+            channel_remove(l2cap_cid);
+            if (l2cap_cid == c->l2cap_hid_control_cid) {
+              c->l2cap_hid_control_cid = 0;
+            }
+            if (l2cap_cid == c->l2cap_hid_interrupt_cid) {
+              c->l2cap_hid_interrupt_cid = 0;
+            }
+            hid_host_connect_failed(c);
             break;
           }
-          l2cap_cid = l2cap_event_channel_opened_get_local_cid(packet);
+          c->con_handle = l2cap_event_channel_opened_get_handle(packet);
           switch (l2cap_event_channel_opened_get_psm(packet)) {
             case PSM_HID_CONTROL:
+              c->l2cap_hid_control_cid = l2cap_cid;
+              c->channels_open |= CHANNEL_CONTROL;
               if (l2cap_event_channel_opened_get_incoming(packet) == 0) {
-                status = l2cap_create_channel(packet_handler, remote_addr,
-                                              hid_interrupt_psm, 48,
-                                              &l2cap_hid_interrupt_cid);
+                status = l2cap_create_channel(packet_handler, c->remote_addr,
+                                              c->hid_interrupt_psm, 48,
+                                              &c->l2cap_hid_interrupt_cid);
                 if (status) {
-                  printf("Connecting to HID Interrupt failed: 0x%02x\n",
-                         status);
+                  printf("[%u] Connecting to HID Interrupt failed: 0x%02x\n",
+                         c->player + 1, status);
+                  c->l2cap_hid_interrupt_cid = 0;
+                  hid_host_connect_failed(c);
                   break;
                 }
+                channel_add(c->l2cap_hid_interrupt_cid, c);
               }
-              l2cap_hid_control_cid = l2cap_cid;
               break;
             case PSM_HID_INTERRUPT:
-              l2cap_hid_interrupt_cid = l2cap_cid;
+              c->l2cap_hid_interrupt_cid = l2cap_cid;
+              c->channels_open |= CHANNEL_INTERRUPT;
               break;
             default:
               break;
           }
 
-          if ((l2cap_hid_control_cid != 0) && (l2cap_hid_interrupt_cid != 0)) {
-            if (hid_descriptor_len == 0) {
-              printf("Start SDP HID query to get HID Descriptor\n");
-              sdp_client_query_uuid16(
-                  &handle_sdp_client_query_result, remote_addr,
-                  BLUETOOTH_SERVICE_CLASS_HUMAN_INTERFACE_DEVICE_SERVICE);
+          if (c->channels_open == CHANNEL_BOTH) {
+            hid_host_link_up(c);
+            if (!hid_host_load_record(c)) {
+              printf("[%u] Start SDP HID query to get HID Descriptor\n",
+                     c->player + 1);
+              query_sdp(c);
             } else {
-              printf("HID Connection established\n");
+              printf("[%u] HID Connection established\n", c->player + 1);
+              if (c->sdp_check) query_sdp(c);
             }
           }
           break;
         case L2CAP_EVENT_CHANNEL_CLOSED:
-          if ((l2cap_hid_control_cid != 0) && (l2cap_hid_interrupt_cid != 0)) {
-            printf("HID Connection closed\n");
-            hid_descriptor_len = 0;
-          }
           l2cap_cid = l2cap_event_channel_closed_get_local_cid(packet);
-          if (l2cap_cid == l2cap_hid_control_cid) {
-            l2cap_hid_control_cid = 0;
+          c = controller_by_cid(l2cap_cid);
+          if (!c) break;
+          channel_remove(l2cap_cid);
+          if (l2cap_cid == c->l2cap_hid_control_cid) {
+            c->l2cap_hid_control_cid = 0;
+            c->channels_open &= ~CHANNEL_CONTROL;
           }
-          if (l2cap_cid == l2cap_hid_interrupt_cid) {
-            l2cap_hid_interrupt_cid = 0;
+          if (l2cap_cid == c->l2cap_hid_interrupt_cid) {
+            c->l2cap_hid_interrupt_cid = 0;
+            c->channels_open &= ~CHANNEL_INTERRUPT;
           }
+          // Only one of them applies, by link_state
+          hid_host_link_lost(c);
+          hid_host_connect_failed(c);
+          break;
         default:
           break;
       }
       break;
     case L2CAP_DATA_PACKET:
-      // for now, just dump incoming data
-      if (channel == l2cap_hid_interrupt_cid) {
-        hid_host_handle_interrupt_report(packet, size);
-      } else if (channel == l2cap_hid_control_cid) {
-        printf("HID Control: ");
+      // One probe of channel_map, whatever the number of controllers
+      c = controller_by_cid(channel);
+      if (!c) break;
+      if (channel == c->l2cap_hid_interrupt_cid) {
+        uint32_t received = PG9021_LATENCY ? pg9021_latency_now() : 0;
+        if (c->player == 0 && pg9021_capture_active()) {
+          pg9021_capture_report(packet, size);
+        }
+        hid_host_handle_interrupt_report(c, packet, size, received);
+        if (c->first_report_pending) hid_host_first_report(c);
+      } else if (channel == c->l2cap_hid_control_cid) {
+        printf("[%u] HID Control: ", c->player + 1);
         printf_hexdump(packet, size);
       } else {
         break;
@@ -467,12 +1491,89 @@ static void packet_handler(uint8_t packet_type, uint16_t channel,
   }
 }
 
+// Benchmark controller, see pg9021_bench.h
+static controller_t *bench_controller;
+static gamepad_report_handler_t bench_saved_callback;
+static pg9021_decode_stats_t bench_saved_stats;
+static pg9021_histogram_t *bench_saved_latency;  // PG9021_LATENCY_STAGES
+
+int pg9021_bench_attach(const uint8_t *descriptor, uint16_t len,
+                        gamepad_report_handler_t callback) {
+  static const pg9021_axis_rate_t every_change = {0, 0};
+
+  if (bench_controller || len > PG9021_REPORT_MAX_DESCRIPTOR) return -1;
+  controller_t *c = calloc(1, sizeof(*c));
+  if (!c) return -1;
+  c->hid_descriptor = malloc(len ? len : 1);
+  bench_saved_latency =
+      malloc(PG9021_LATENCY_STAGES * sizeof(*bench_saved_latency));
+  if (!c->hid_descriptor || !bench_saved_latency) {
+    free(bench_saved_latency);
+    bench_saved_latency = NULL;
+    free(c->hid_descriptor);
+    free(c);
+    return -1;
+  }
+
+  c->con_handle = HCI_CON_HANDLE_INVALID;
+  memcpy(c->hid_descriptor, descriptor, len);
+  c->hid_descriptor_len = len;
+  c->report_table_valid = pg9021_report_table_compile(
+                              &c->report_table, descriptor, len) == 0;
+  c->layout_valid =
+      c->report_table_valid &&
+      pg9021_layout_bind(&c->report_table, &c->layout_binding) == 0;
+  pg9021_filter_init(&c->axis_filter);
+  // Nothing held, so no coalesce timer outlives the controller
+  pg9021_coalesce_init(&c->axis_coalesce);
+  for (int i = 0; i < PG9021_STATE_AXES; ++i) {
+    pg9021_coalesce_configure(&c->axis_coalesce, i, &every_change);
+  }
+  clear_state(c);
+
+  bench_controller = c;
+  bench_saved_callback = gamepad_report_callback;
+  bench_saved_stats = decode_stats;
+  pg9021_latency_save(bench_saved_latency);
+  gamepad_report_callback = callback;
+  return 0;
+}
+
+void pg9021_bench_report(uint8_t *packet, uint16_t len) {
+  uint32_t received = PG9021_LATENCY ? pg9021_latency_now() : 0;
+  hid_host_handle_interrupt_report(bench_controller, packet, len, received);
+}
+
+void pg9021_bench_detach(void) {
+  if (!bench_controller) return;
+  gamepad_report_callback = bench_saved_callback;
+  decode_stats = bench_saved_stats;
+  pg9021_latency_restore(bench_saved_latency);
+  free(bench_saved_latency);
+  bench_saved_latency = NULL;
+  free(bench_controller->hid_descriptor);
+  free(bench_controller);
+  bench_controller = NULL;
+}
+
 int btstack_main(int argc, const char *argv[]);
 int btstack_main(int argc, const char *argv[]) {
   (void)argc;
   (void)argv;
 
-  clear_keys_states();
+  for (int i = 0; i < PG9021_MAX_PLAYERS; ++i) {
+    controller_t *c = &controllers[i];
+    c->player = (uint8_t)i;
+    c->con_handle = HCI_CON_HANDLE_INVALID;
+    pg9021_filter_init(&c->axis_filter);
+    pg9021_coalesce_init(&c->axis_coalesce);
+    clear_state(c);
+  }
+  pg9021_cache_init();
+  pg9021_power_init();
+  for (int i = 0; i < PG9021_STATE_AXES; ++i) {
+    filter_config[i] = controllers[0].axis_filter.config[i];
+  }
   hid_host_setup();
   hci_power_control(HCI_POWER_ON);
 
@@ -0,0 +1,121 @@
+#ifndef PG9021_H
+#define PG9021_H
+
+#include <stdint.h>
+
+#include "pg9021_coalesce.h"
+#include "pg9021_filter.h"
+#include "pg9021_mapping.h"
+#include "pg9021_state.h"
+
+// Decoder counters, one of them is incremented per input report
+typedef struct {
+  uint32_t skipped;  // byte identical to the previous report
+  uint32_t partial;  // only changed fields decoded (known layout)
+  uint32_t full;     // all fields decoded
+} pg9021_decode_stats_t;
+
+/*
+ * Reconnects. A configured gamepad that is not connected is paged again
+ * after a delay that doubles per failed attempt, from
+ * PG9021_RECONNECT_MIN_MS up to PG9021_RECONNECT_MAX_MS, while page scan
+ * stays on so the gamepad can connect by itself in the meantime.
+ */
+#ifndef PG9021_RECONNECT_MIN_MS
+#define PG9021_RECONNECT_MIN_MS 250
+#endif
+
+#ifndef PG9021_RECONNECT_MAX_MS
+#define PG9021_RECONNECT_MAX_MS 16000
+#endif
+
+// A failed page gives up after this, BTstack's default is 5120 ms
+#ifndef PG9021_PAGE_TIMEOUT_MS
+#define PG9021_PAGE_TIMEOUT_MS 2560
+#endif
+
+// Interlaced page scan, the default interval is 1280 ms
+#ifndef PG9021_PAGE_SCAN_INTERVAL_MS
+#define PG9021_PAGE_SCAN_INTERVAL_MS 320
+#endif
+
+typedef enum {
+  PG9021_LINK_IDLE,        // not configured
+  PG9021_LINK_CONNECTING,  // SDP or L2CAP in progress
+  PG9021_LINK_CONNECTED,
+  PG9021_LINK_WAITING      // for the next attempt, or the gamepad
+} pg9021_link_state_t;
+
+typedef struct {
+  pg9021_link_state_t state;
+  uint16_t attempts;      // failed since the last connection
+  uint32_t reconnects;    // after a link loss
+  uint32_t reacquire_ms;  // link loss to connected, the last one
+} pg9021_link_info_t;
+
+/*
+ * Called once per input report that changed the controller state.
+ * changed is a mask of PG9021_CHANGED_* bits, see pg9021_state.h.
+ */
+typedef void (*gamepad_report_handler_t)(uint8_t player,
+                                         const pg9021_state_t *state,
+                                         const pg9021_state_t *prev,
+                                         uint32_t changed);
+
+// Configure a gamepad, returns its player index (0 .. PG9021_MAX_PLAYERS - 1)
+// or -1 for an invalid address or a full table. A known address keeps its
+// index. Gamepads connecting on their own take a free index too.
+int pg9021_add_gamepad(const char *mac);
+
+// pg9021_add_gamepad() without the index
+void set_gamepad_mac(const char *mac);
+
+// Connect every configured gamepad that is not connected now, without
+// waiting for the reconnect delay
+void connect_gamepad(void);
+
+// Returns -1 for an invalid player. BTstack run loop only.
+int pg9021_get_link_info(uint8_t player, pg9021_link_info_t *info);
+void set_gamepad_report_callback(gamepad_report_handler_t callback);
+
+// Per field callback, implemented on top of the report callback
+void set_gamepad_action_callback(gamepad_handler_t callback);
+
+// Split one report into per field calls of handler
+void pg9021_report_to_fields(uint8_t player, const pg9021_state_t *state,
+                             const pg9021_state_t *prev, uint32_t changed,
+                             gamepad_handler_t handler);
+
+// Copy of the current state of one controller, -1 for an unused player
+int pg9021_get_state(uint8_t player, pg9021_state_t *snapshot);
+
+// Thumb filter of one PG9021_AXIS_* axis, applied from the next report.
+// Returns -1 for an invalid axis or config. BTstack run loop only.
+int pg9021_set_axis_filter(int axis,
+                           const pg9021_axis_filter_config_t *config);
+int pg9021_get_axis_filter(int axis, pg9021_axis_filter_config_t *config);
+
+// Axis event rate limit of one PG9021_AXIS_* axis for every controller, see
+// pg9021_coalesce.h. Returns -1 for an invalid axis or config. BTstack run
+// loop only.
+int pg9021_set_axis_rate(int axis, const pg9021_axis_rate_t *config);
+int pg9021_get_axis_rate(int axis, pg9021_axis_rate_t *config);
+
+void pg9021_get_decode_stats(pg9021_decode_stats_t *stats);
+void pg9021_get_coalesce_stats(pg9021_coalesce_stats_t *stats);
+
+// Decode and coalesce stats, summed over the controllers. BTstack run loop
+// only.
+void pg9021_reset_decode_stats(void);
+
+// Benchmark controller outside the player table, for pg9021_bench.c. Its
+// reports go through the interrupt report path to callback instead of the
+// report callback, without axis coalescing. Run loop only, the decode
+// stats are restored on detach. Returns -1 if one is attached already or
+// out of memory.
+int pg9021_bench_attach(const uint8_t *descriptor, uint16_t len,
+                        gamepad_report_handler_t callback);
+void pg9021_bench_report(uint8_t *packet, uint16_t len);
+void pg9021_bench_detach(void);
+
+#endif  // PG9021_H
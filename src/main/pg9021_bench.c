@@ -0,0 +1,558 @@
+#include "pg9021_bench.h"
+
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pg9021.h"
+#include "pg9021_filter.h"
+#include "pg9021_mapping.h"
+#include "pg9021_port.h"
+#include "pg9021_ring.h"
+#include "pg9021_state.h"
+
+#ifdef ESP_PLATFORM
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "nvs.h"
+#include "pg9021_pipeline.h"
+#include "sdkconfig.h"
+#define BENCH_PLATFORM "esp32"
+#define BENCH_UNIT "cycles"
+#else
+#define BENCH_PLATFORM "host"
+#define BENCH_UNIT "ns"
+#endif
+
+#if defined(ESP_PLATFORM) && defined(CONFIG_PM_ENABLE)
+#include "esp_pm.h"
+#define BENCH_PM 1
+#else
+#define BENCH_PM 0
+#endif
+
+#define FLASH_NAMESPACE "pg9021_bench"
+#define FLASH_KEY "blob"
+
+#define GAMEPAD_REPORT_ID 0x03
+#define KEYBOARD_REPORT_ID 0x01
+#define KEYBOARD_SLOTS 6
+
+// PG-9021 in gamepad mode: report 3 with 4 axes, hat, 15 buttons, 6 misc
+static const uint8_t gamepad_descriptor[] = {
+    0x05, 0x01, 0x09, 0x05, 0xa1, 0x01, 0x85, 0x03, 0x05, 0x01, 0x09, 0x30,
+    0x09, 0x31, 0x09, 0x32, 0x09, 0x35, 0x15, 0x00, 0x26, 0xff, 0x00, 0x75,
+    0x08, 0x95, 0x04, 0x81, 0x02, 0x09, 0x39, 0x15, 0x00, 0x25, 0x07, 0x35,
+    0x00, 0x46, 0x3b, 0x01, 0x65, 0x14, 0x75, 0x04, 0x95, 0x01, 0x81, 0x42,
+    0x75, 0x04, 0x95, 0x01, 0x81, 0x03, 0x05, 0x09, 0x19, 0x01, 0x29, 0x0f,
+    0x15, 0x00, 0x25, 0x01, 0x75, 0x01, 0x95, 0x0f, 0x81, 0x02, 0x75, 0x01,
+    0x95, 0x01, 0x81, 0x03, 0x05, 0x0c, 0x0a, 0x23, 0x02, 0x0a, 0xea, 0x00,
+    0x0a, 0xb6, 0x00, 0x0a, 0xcd, 0x00, 0x0a, 0xb5, 0x00, 0x0a, 0xe9, 0x00,
+    0x75, 0x01, 0x95, 0x06, 0x81, 0x02, 0x75, 0x01, 0x95, 0x02, 0x81, 0x03,
+    0xc0};
+
+// PG-9021 in keyboard mode: report 1 with modifiers and 6 key codes
+static const uint8_t keyboard_descriptor[] = {
+    0x05, 0x01, 0x09, 0x06, 0xa1, 0x01, 0x85, 0x01, 0x05, 0x07, 0x19, 0xe0,
+    0x29, 0xe7, 0x15, 0x00, 0x25, 0x01, 0x75, 0x01, 0x95, 0x08, 0x81, 0x02,
+    0x75, 0x08, 0x95, 0x01, 0x81, 0x03, 0x05, 0x07, 0x19, 0x00, 0x29, 0x65,
+    0x15, 0x00, 0x25, 0x65, 0x75, 0x08, 0x95, 0x06, 0x81, 0x00, 0xc0};
+
+static const char *const scenario_names[PG9021_BENCH_SCENARIOS] = {
+    [PG9021_BENCH_IDLE] = "idle",
+    [PG9021_BENCH_MASH] = "mash",
+    [PG9021_BENCH_SWEEP] = "sweep",
+    [PG9021_BENCH_KEYBOARD] = "keyboard",
+};
+
+static const char *const bench_names[PG9021_BENCHES] = {
+    [PG9021_BENCH_DECODE] = "decode",
+    [PG9021_BENCH_FILTER] = "filter",
+    [PG9021_BENCH_FIELDS] = "fields",
+    [PG9021_BENCH_DISPATCH] = "dispatch",
+};
+
+// One scenario, the states are the ones its reports encode
+typedef struct {
+  uint8_t packets[PG9021_BENCH_REPORTS][PG9021_BENCH_REPORT_SIZE];
+  pg9021_state_t states[PG9021_BENCH_REPORTS];
+} corpus_t;
+
+typedef uint32_t (*bench_pass_t)(const corpus_t *corpus);
+
+static uint32_t pass_ticks[PG9021_BENCH_MAX_PASSES];
+static uint32_t bench_events;
+static pg9021_filter_t bench_filter;
+static pg9021_ring_t bench_ring;
+
+const uint8_t *pg9021_bench_descriptor(pg9021_bench_scenario_t scenario,
+                                       uint16_t *len) {
+  if (scenario == PG9021_BENCH_KEYBOARD) {
+    *len = sizeof(keyboard_descriptor);
+    return keyboard_descriptor;
+  }
+  *len = sizeof(gamepad_descriptor);
+  return gamepad_descriptor;
+}
+
+static void scenario_state(pg9021_bench_scenario_t scenario, int index,
+                           pg9021_state_t *state) {
+  uint8_t value = (uint8_t)(index * 256 / PG9021_BENCH_REPORTS);
+
+  pg9021_state_init(state);
+  switch (scenario) {
+    case PG9021_BENCH_MASH:
+      // A held button that changes every report and one pressed on every
+      // second report, with misc buttons and the d-pad in between
+      state->buttons = 1u << (index % 15);
+      if (index & 1) state->buttons |= 1u << 14;
+      if (index & 8) {
+        state->buttons |= 1u << (PG9021_STATE_MISC_SHIFT +
+                                 (index >> 4) % PG9021_STATE_MISC_BUTTONS);
+      }
+      if (index & 2) state->hat = (index >> 2) & 7;
+      break;
+    case PG9021_BENCH_SWEEP:
+      state->axes[PG9021_AXIS_L_X] = value;
+      state->axes[PG9021_AXIS_L_Y] = (uint8_t)(255 - value);
+      state->axes[PG9021_AXIS_R_X] = value ^ 0x80;
+      state->axes[PG9021_AXIS_R_Y] = (uint8_t)(255 - (value ^ 0x80));
+      break;
+    case PG9021_BENCH_KEYBOARD:
+      // Distinct letters, a different set every report
+      for (int k = 0; k < index % (KEYBOARD_SLOTS + 1); ++k) {
+        pg9021_state_set_key(state, 0x04 + (index / 7 + 5 * k) % 26, 1);
+      }
+      break;
+    default:
+      break;
+  }
+}
+
+static void encode_report(pg9021_bench_scenario_t scenario,
+                          const pg9021_state_t *state, uint8_t *packet) {
+  memset(packet, 0, PG9021_BENCH_REPORT_SIZE);
+  packet[0] = 0xa1;
+  if (scenario == PG9021_BENCH_KEYBOARD) {
+    uint8_t *slot = &packet[4];
+    packet[1] = KEYBOARD_REPORT_ID;
+    for (int usage = 0; usage < 256; ++usage) {
+      if (pg9021_state_key(state, (uint8_t)usage)) *slot++ = (uint8_t)usage;
+    }
+    return;
+  }
+  packet[1] = GAMEPAD_REPORT_ID;
+  memcpy(&packet[2], state->axes, PG9021_STATE_AXES);
+  packet[6] = state->hat;
+  packet[7] = (uint8_t)state->buttons;
+  packet[8] = (uint8_t)(state->buttons >> 8) & 0x7f;
+  packet[9] = (uint8_t)(state->buttons >> PG9021_STATE_MISC_SHIFT) & 0x3f;
+}
+
+static void make_corpus(pg9021_bench_scenario_t scenario, corpus_t *corpus) {
+  for (int i = 0; i < PG9021_BENCH_REPORTS; ++i) {
+    scenario_state(scenario, i, &corpus->states[i]);
+    encode_report(scenario, &corpus->states[i], corpus->packets[i]);
+  }
+}
+
+static void count_report(uint8_t player, const pg9021_state_t *state,
+                         const pg9021_state_t *prev, uint32_t changed) {
+  (void)player;
+  (void)state;
+  (void)prev;
+  (void)changed;
+  bench_events++;
+}
+
+static void count_field(uint8_t player, uint16_t page, uint16_t usage,
+                        int32_t value) {
+  (void)player;
+  (void)page;
+  (void)usage;
+  (void)value;
+  bench_events++;
+}
+
+static void push_field(uint8_t player, uint16_t page, uint16_t usage,
+                       int32_t value) {
+  pg9021_event_t event = {player, (uint8_t)page, usage, value};
+  pg9021_ring_push(&bench_ring, &event);
+}
+
+// Events are reports that changed the state
+static uint32_t decode_pass(const corpus_t *corpus) {
+  uint8_t packet[PG9021_BENCH_REPORT_SIZE];
+
+  bench_events = 0;
+  for (int i = 0; i < PG9021_BENCH_REPORTS; ++i) {
+    // The L2CAP buffer is writable, the corpus is not
+    memcpy(packet, corpus->packets[i], sizeof(packet));
+    pg9021_bench_report(packet, sizeof(packet));
+  }
+  return bench_events;
+}
+
+// Events are reports that moved the output
+static uint32_t filter_pass(const corpus_t *corpus) {
+  uint32_t events = 0;
+  uint32_t output = bench_filter.output;
+
+  for (int i = 0; i < PG9021_BENCH_REPORTS; ++i) {
+    uint32_t next = pg9021_filter_run(
+        &bench_filter, pg9021_filter_pack(corpus->states[i].axes));
+    events += next != output;
+    output = next;
+  }
+  return events;
+}
+
+// The corpus wraps around, the first report follows the last one
+static const pg9021_state_t *previous_state(const corpus_t *corpus, int i) {
+  return &corpus->states[(i ? i : PG9021_BENCH_REPORTS) - 1];
+}
+
+static uint32_t fields_pass(const corpus_t *corpus) {
+  bench_events = 0;
+  for (int i = 0; i < PG9021_BENCH_REPORTS; ++i) {
+    const pg9021_state_t *prev = previous_state(corpus, i);
+    uint32_t changed = pg9021_state_changes(prev, &corpus->states[i]);
+    if (changed) {
+      pg9021_report_to_fields(0, &corpus->states[i], prev, changed,
+                              &count_field);
+    }
+  }
+  return bench_events;
+}
+
+// Events are the gamepad actions event_task would log
+static uint32_t dispatch_pass(const corpus_t *corpus) {
+  pg9021_event_t event;
+  uint32_t events = 0;
+
+  for (int i = 0; i < PG9021_BENCH_REPORTS; ++i) {
+    const pg9021_state_t *prev = previous_state(corpus, i);
+    uint32_t changed = pg9021_state_changes(prev, &corpus->states[i]);
+    if (!changed) continue;
+    pg9021_report_to_fields(0, &corpus->states[i], prev, changed,
+                            &push_field);
+    while (pg9021_ring_pop(&bench_ring, &event)) {
+      events += pg9021_event_id(event.page, event.usage) != PG9021_EVENT_NONE;
+    }
+  }
+  return events;
+}
+
+static void sort_ticks(uint32_t *ticks, int count) {
+  for (int i = 1; i < count; ++i) {
+    uint32_t value = ticks[i];
+    int j = i;
+    for (; j > 0 && ticks[j - 1] > value; --j) ticks[j] = ticks[j - 1];
+    ticks[j] = value;
+  }
+}
+
+static void time_passes(pg9021_bench_result_t *result, int passes,
+                        bench_pass_t pass, const corpus_t *corpus) {
+  // Warms up the caches and leaves the state of a finished pass
+  result->events = (*pass)(corpus);
+  for (int i = 0; i < passes; ++i) {
+    uint32_t start = pg9021_port_ticks();
+    (*pass)(corpus);
+    pass_ticks[i] = pg9021_port_ticks() - start;
+  }
+  sort_ticks(pass_ticks, passes);
+  result->reports = PG9021_BENCH_REPORTS;
+  result->min = pass_ticks[0];
+  result->median = pass_ticks[passes / 2];
+  result->max = pass_ticks[passes - 1];
+}
+
+int pg9021_bench_run(pg9021_bench_t *bench, int passes) {
+  uint16_t descriptor_len;
+
+  if (passes < 1 || passes > PG9021_BENCH_MAX_PASSES) return -1;
+  corpus_t *corpus = malloc(sizeof(*corpus));
+  if (!corpus) return -1;
+
+  memset(bench, 0, sizeof(*bench));
+  bench->passes = (uint16_t)passes;
+  for (int s = 0; s < PG9021_BENCH_SCENARIOS; ++s) {
+    const uint8_t *descriptor = pg9021_bench_descriptor(s, &descriptor_len);
+    make_corpus(s, corpus);
+
+    if (pg9021_bench_attach(descriptor, descriptor_len, &count_report) == 0) {
+      time_passes(&bench->results[PG9021_BENCH_DECODE][s], passes,
+                  &decode_pass, corpus);
+      pg9021_bench_detach();
+    }
+    if (s != PG9021_BENCH_KEYBOARD) {
+      pg9021_filter_init(&bench_filter);
+      time_passes(&bench->results[PG9021_BENCH_FILTER][s], passes,
+                  &filter_pass, corpus);
+    }
+    time_passes(&bench->results[PG9021_BENCH_FIELDS][s], passes,
+                &fields_pass, corpus);
+    pg9021_ring_init(&bench_ring, PG9021_RING_COALESCE);
+    time_passes(&bench->results[PG9021_BENCH_DISPATCH][s], passes,
+                &dispatch_pass, corpus);
+  }
+  free(corpus);
+  return 0;
+}
+
+// Ticks per report with two decimals
+static void print_per_report(const char *name, uint32_t ticks,
+                             uint16_t reports) {
+  uint64_t hundredths = (uint64_t)ticks * 100 / reports;
+  printf(", \"%s\": %" PRIu64 ".%02u", name, hundredths / 100,
+         (unsigned)(hundredths % 100));
+}
+
+void pg9021_bench_print_json(const pg9021_bench_t *bench) {
+  int first = 1;
+
+  printf("{\"platform\": \"%s\", \"unit\": \"%s\", \"ticks_per_us\": %d, "
+         "\"passes\": %u, \"reports\": %d, \"results\": [",
+         BENCH_PLATFORM, BENCH_UNIT, PG9021_PORT_TICKS_PER_US, bench->passes,
+         PG9021_BENCH_REPORTS);
+  for (int b = 0; b < PG9021_BENCHES; ++b) {
+    for (int s = 0; s < PG9021_BENCH_SCENARIOS; ++s) {
+      const pg9021_bench_result_t *result = &bench->results[b][s];
+      if (!result->reports) continue;
+      printf("%s\n  {\"benchmark\": \"%s\", \"scenario\": \"%s\", "
+             "\"events\": %" PRIu32,
+             first ? "" : ",", bench_names[b], scenario_names[s],
+             result->events);
+      print_per_report("min", result->min, result->reports);
+      print_per_report("median", result->median, result->reports);
+      print_per_report("max", result->max, result->reports);
+      printf("}");
+      first = 0;
+    }
+  }
+  printf("\n]}\n");
+}
+
+// Decoded reports go through the event ring like to event_task
+static void dispatch_report(uint8_t player, const pg9021_state_t *state,
+                            const pg9021_state_t *prev, uint32_t changed) {
+  pg9021_event_t event;
+
+  pg9021_report_to_fields(player, state, prev, changed, &push_field);
+  while (pg9021_ring_pop(&bench_ring, &event)) {
+    bench_events += pg9021_event_id(event.page, event.usage) !=
+                    PG9021_EVENT_NONE;
+  }
+}
+
+#ifdef ESP_PLATFORM
+static nvs_handle_t flash_handle;
+static atomic_int flash_writing;
+static atomic_int flash_writer_done;
+static atomic_uint flash_writes;
+
+// NVS skips a blob that did not change, every commit writes a new one
+static void flash_writer_task(void *arg) {
+  uint8_t blob[PG9021_BENCH_FLASH_BLOB];
+  uint8_t fill = 0;
+
+  while (atomic_load(&flash_writing)) {
+    memset(blob, ++fill, sizeof(blob));
+    if (nvs_set_blob(flash_handle, FLASH_KEY, blob, sizeof(blob)) == ESP_OK &&
+        nvs_commit(flash_handle) == ESP_OK) {
+      atomic_fetch_add(&flash_writes, 1);
+    }
+  }
+  nvs_erase_key(flash_handle, FLASH_KEY);
+  nvs_commit(flash_handle);
+  atomic_store(&flash_writer_done, 1);
+  vTaskDelete(NULL);
+}
+
+static void flash_writer_start(void) {
+  atomic_store(&flash_writes, 0);
+  atomic_store(&flash_writer_done, 0);
+  atomic_store(&flash_writing, 1);
+  pg9021_pipeline_create_task(PG9021_STAGE_BACKGROUND, flash_writer_task,
+                              "bench_flash", 3072, NULL);
+}
+
+static uint32_t flash_writer_stop(void) {
+  atomic_store(&flash_writing, 0);
+  while (!atomic_load(&flash_writer_done)) vTaskDelay(1);
+  return atomic_load(&flash_writes);
+}
+#endif
+
+// Every report on its own, the writer gets the CPU between passes
+static void flash_run(const corpus_t *corpus, int passes,
+                      pg9021_histogram_t *ticks) {
+  uint8_t packet[PG9021_BENCH_REPORT_SIZE];
+
+  for (int pass = 0; pass < passes; ++pass) {
+#ifdef ESP_PLATFORM
+    vTaskDelay(1);
+#endif
+    for (int i = 0; i < PG9021_BENCH_REPORTS; ++i) {
+      memcpy(packet, corpus->packets[i], sizeof(packet));
+      uint32_t start = pg9021_port_ticks();
+      pg9021_bench_report(packet, sizeof(packet));
+      pg9021_histogram_add(ticks, pg9021_port_ticks() - start);
+    }
+  }
+}
+
+int pg9021_bench_run_flash(pg9021_bench_flash_t *bench, int passes) {
+  uint16_t descriptor_len;
+  int status = -1;
+
+  if (passes < 1 || passes > PG9021_BENCH_MAX_PASSES) return -1;
+  corpus_t *corpus = malloc(sizeof(*corpus));
+  if (!corpus) return -1;
+#ifdef ESP_PLATFORM
+  if (nvs_open(FLASH_NAMESPACE, NVS_READWRITE, &flash_handle) != ESP_OK) {
+    free(corpus);
+    return -1;
+  }
+#endif
+
+  memset(bench, 0, sizeof(*bench));
+#ifdef ESP_PLATFORM
+  bench->hot_path = PG9021_HOT_PATH;
+#endif
+  bench->passes = (uint16_t)passes;
+  make_corpus(PG9021_BENCH_MASH, corpus);
+  const uint8_t *descriptor =
+      pg9021_bench_descriptor(PG9021_BENCH_MASH, &descriptor_len);
+  pg9021_ring_init(&bench_ring, PG9021_RING_COALESCE);
+  if (pg9021_bench_attach(descriptor, descriptor_len, &dispatch_report) ==
+      0) {
+    // Warms up the caches like a connected gamepad
+    flash_run(corpus, 1, &bench->quiet.ticks);
+    memset(&bench->quiet.ticks, 0, sizeof(bench->quiet.ticks));
+    flash_run(corpus, passes, &bench->quiet.ticks);
+#ifdef ESP_PLATFORM
+    flash_writer_start();
+    flash_run(corpus, passes, &bench->writing.ticks);
+    bench->writing.writes = flash_writer_stop();
+#endif
+    pg9021_bench_detach();
+    status = 0;
+  }
+
+#ifdef ESP_PLATFORM
+  nvs_close(flash_handle);
+#endif
+  free(corpus);
+  return status;
+}
+
+static void print_flash_run(const char *name,
+                            const pg9021_bench_flash_run_t *run, int first) {
+  const pg9021_histogram_t *ticks = &run->ticks;
+
+  printf("%s\n  {\"run\": \"%s\", \"writes\": %" PRIu32
+         ", \"reports\": %" PRIu32 ", \"p50\": %" PRIu32
+         ", \"p99\": %" PRIu32 ", \"p999\": %" PRIu32 ", \"max\": %" PRIu32
+         "}",
+         first ? "" : ",", name, run->writes, ticks->count,
+         pg9021_histogram_percentile(ticks, 500),
+         pg9021_histogram_percentile(ticks, 990),
+         pg9021_histogram_percentile(ticks, 999), ticks->max);
+}
+
+void pg9021_bench_flash_print_json(const pg9021_bench_flash_t *bench) {
+  printf("{\"platform\": \"%s\", \"unit\": \"%s\", \"ticks_per_us\": %d, "
+         "\"hot_path\": %u, \"passes\": %u, \"reports\": %d, \"runs\": [",
+         BENCH_PLATFORM, BENCH_UNIT, PG9021_PORT_TICKS_PER_US,
+         bench->hot_path, bench->passes, PG9021_BENCH_REPORTS);
+  print_flash_run("quiet", &bench->quiet, 1);
+  if (bench->writing.ticks.count) {
+    print_flash_run("flash", &bench->writing, 0);
+  }
+  printf("\n]}\n");
+}
+
+#if BENCH_PM
+static esp_pm_lock_handle_t bench_lock;
+#endif
+
+// CCOUNT counts at the current CPU frequency
+static void hold_cpu_frequency(int hold) {
+#if BENCH_PM
+  if (!bench_lock) {
+    esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "bench", &bench_lock);
+  }
+  if (!bench_lock) return;
+  if (hold) {
+    esp_pm_lock_acquire(bench_lock);
+  } else {
+    esp_pm_lock_release(bench_lock);
+  }
+#else
+  (void)hold;
+#endif
+}
+
+static void run_and_print(int passes) {
+  pg9021_bench_t bench;
+
+  hold_cpu_frequency(1);
+  int status = pg9021_bench_run(&bench, passes);
+  hold_cpu_frequency(0);
+  if (status != 0) {
+    printf("Benchmark not run, 1..%d passes\n", PG9021_BENCH_MAX_PASSES);
+    return;
+  }
+  pg9021_bench_print_json(&bench);
+}
+
+static void run_flash_and_print(int passes) {
+  pg9021_bench_flash_t *bench = malloc(sizeof(*bench));
+  int status = -1;
+
+  if (bench) {
+    hold_cpu_frequency(1);
+    status = pg9021_bench_run_flash(bench, passes);
+    hold_cpu_frequency(0);
+  }
+  if (status != 0) {
+    printf("Flash benchmark not run, 1..%d passes\n",
+           PG9021_BENCH_MAX_PASSES);
+  } else {
+    pg9021_bench_flash_print_json(bench);
+  }
+  free(bench);
+}
+
+#ifdef ESP_PLATFORM
+extern void btstack_run_loop_freertos_execute_code_on_main_thread(
+    void (*fn)(void *arg), void *arg);
+
+static void run_on_main_thread(void *arg) { run_and_print((int)(intptr_t)arg); }
+
+static void run_flash_on_main_thread(void *arg) {
+  run_flash_and_print((int)(intptr_t)arg);
+}
+#endif
+
+void pg9021_bench_start(int passes) {
+#ifdef ESP_PLATFORM
+  btstack_run_loop_freertos_execute_code_on_main_thread(
+      &run_on_main_thread, (void *)(intptr_t)passes);
+#else
+  run_and_print(passes);
+#endif
+}
+
+void pg9021_bench_start_flash(int passes) {
+#ifdef ESP_PLATFORM
+  btstack_run_loop_freertos_execute_code_on_main_thread(
+      &run_flash_on_main_thread, (void *)(intptr_t)passes);
+#else
+  run_flash_and_print(passes);
+#endif
+}
@@ -0,0 +1,106 @@
+#ifndef PG9021_BENCH_H
+#define PG9021_BENCH_H
+
+#include <stdint.h>
+
+#include "pg9021_latency.h"
+
+/*
+ * Microbenchmarks of the input path on a synthetic report corpus, the same
+ * on the host and on the ESP32:
+ *   decode   - hid_host_handle_interrupt_report() with the thumb filter, on
+ *              a controller of its own (pg9021_bench_attach())
+ *   filter   - pg9021_filter_run() on the raw axes of each report
+ *   fields   - pg9021_report_to_fields(), a state change to field calls
+ *   dispatch - the fields through an event ring to the gamepad action
+ *              lookup, like event_task
+ * Each one runs over every scenario of the corpus. Times are
+ * pg9021_port_ticks() per report: ns on the host, CPU cycles (CCOUNT) on
+ * the ESP32.
+ */
+
+#define PG9021_BENCH_REPORTS 128  // per scenario and pass
+#define PG9021_BENCH_REPORT_SIZE 10
+
+#ifndef PG9021_BENCH_MAX_PASSES
+#define PG9021_BENCH_MAX_PASSES 64
+#endif
+
+#ifndef PG9021_BENCH_PASSES
+#define PG9021_BENCH_PASSES 32
+#endif
+
+// Flash mode, per pass the mash scenario is decoded and dispatched report by
+// report. A pass per RTOS tick, the first run quiet, the second while a
+// background task keeps committing a blob to NVS. Compare the worst case of
+// builds with and without PG9021_HOT_PATH (pg9021_port.h).
+#define PG9021_BENCH_FLASH_BLOB 512  // bytes per NVS commit
+
+typedef enum {
+  PG9021_BENCH_IDLE,      // sticks centred, nothing pressed
+  PG9021_BENCH_MASH,      // buttons, misc buttons and d-pad every report
+  PG9021_BENCH_SWEEP,     // all axes across their whole range
+  PG9021_BENCH_KEYBOARD,  // keyboard mode, 0 to 6 keys held
+  PG9021_BENCH_SCENARIOS
+} pg9021_bench_scenario_t;
+
+typedef enum {
+  PG9021_BENCH_DECODE,
+  PG9021_BENCH_FILTER,
+  PG9021_BENCH_FIELDS,
+  PG9021_BENCH_DISPATCH,
+  PG9021_BENCHES
+} pg9021_bench_id_t;
+
+// Ticks of a whole pass over the scenario, the first pass is not timed
+typedef struct {
+  uint16_t reports;  // per pass, 0 - not run on this scenario
+  uint32_t events;   // per pass: reports that changed the state, fields
+  uint32_t min;
+  uint32_t median;
+  uint32_t max;
+} pg9021_bench_result_t;
+
+typedef struct {
+  uint16_t passes;
+  pg9021_bench_result_t results[PG9021_BENCHES][PG9021_BENCH_SCENARIOS];
+} pg9021_bench_t;
+
+typedef struct {
+  uint32_t writes;           // NVS commits during the run
+  pg9021_histogram_t ticks;  // per report
+} pg9021_bench_flash_run_t;
+
+typedef struct {
+  uint8_t hot_path;  // input path in IRAM, PG9021_HOT_PATH on the ESP32
+  uint16_t passes;
+  pg9021_bench_flash_run_t quiet;
+  pg9021_bench_flash_run_t writing;  // ESP32 only, no reports on the host
+} pg9021_bench_flash_t;
+
+// HID descriptor of the scenario's reports, PG-9021 in gamepad or keyboard
+// mode
+const uint8_t *pg9021_bench_descriptor(pg9021_bench_scenario_t scenario,
+                                       uint16_t *len);
+
+// 1 .. PG9021_BENCH_MAX_PASSES passes. BTstack run loop only, the decode
+// benchmark borrows the report path. Returns -1 without memory for the
+// corpus.
+int pg9021_bench_run(pg9021_bench_t *bench, int passes);
+
+// One JSON object on stdout
+void pg9021_bench_print_json(const pg9021_bench_t *bench);
+
+// Runs and prints on the BTstack run loop, on the host right away
+void pg9021_bench_start(int passes);
+
+// 1 .. PG9021_BENCH_MAX_PASSES passes per run, BTstack run loop only.
+// Returns -1 without memory or NVS.
+int pg9021_bench_run_flash(pg9021_bench_flash_t *bench, int passes);
+
+void pg9021_bench_flash_print_json(const pg9021_bench_flash_t *bench);
+
+// Like pg9021_bench_start(), the run loop sleeps between passes
+void pg9021_bench_start_flash(int passes);
+
+#endif  // PG9021_BENCH_H
@@ -0,0 +1,168 @@
+#include "pg9021_cache.h"
+
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef ESP_PLATFORM
+#include "nvs.h"
+#include "nvs_flash.h"
+#endif
+
+#define CACHE_NAMESPACE "pg9021"
+
+// As written, only descriptor_len bytes of the descriptor
+typedef struct {
+  uint8_t version;
+  uint8_t reserved[3];
+  uint32_t hash;
+  uint16_t control_psm;
+  uint16_t interrupt_psm;
+  uint16_t descriptor_len;
+  uint8_t descriptor[PG9021_CACHE_MAX_DESCRIPTOR];
+} stored_entry_t;
+
+#define STORED_HEADER_SIZE offsetof(stored_entry_t, descriptor)
+
+static uint32_t fnv1a(uint32_t hash, const void *data, size_t len) {
+  const uint8_t *bytes = data;
+  for (size_t i = 0; i < len; ++i) {
+    hash = (hash ^ bytes[i]) * 16777619u;
+  }
+  return hash;
+}
+
+// The same bytes in the same order as the stored record
+uint32_t pg9021_cache_hash(const pg9021_cache_entry_t *entry) {
+  uint32_t hash = 2166136261u;
+  hash = fnv1a(hash, &entry->control_psm, sizeof(entry->control_psm));
+  hash = fnv1a(hash, &entry->interrupt_psm, sizeof(entry->interrupt_psm));
+  hash = fnv1a(hash, &entry->descriptor_len, sizeof(entry->descriptor_len));
+  hash = fnv1a(hash, entry->descriptor, entry->descriptor_len);
+  return hash ? hash : 1;
+}
+
+// entry points into stored, only use it if 1 is returned
+static int stored_valid(const stored_entry_t *stored, size_t len,
+                        pg9021_cache_entry_t *entry) {
+  if (len < STORED_HEADER_SIZE || stored->version != PG9021_CACHE_VERSION ||
+      stored->descriptor_len > PG9021_CACHE_MAX_DESCRIPTOR ||
+      len != STORED_HEADER_SIZE + stored->descriptor_len) {
+    return 0;
+  }
+  entry->control_psm = stored->control_psm;
+  entry->interrupt_psm = stored->interrupt_psm;
+  entry->descriptor_len = stored->descriptor_len;
+  entry->descriptor = stored->descriptor;
+  return stored->hash == pg9021_cache_hash(entry);
+}
+
+static size_t stored_make(stored_entry_t *stored,
+                          const pg9021_cache_entry_t *entry) {
+  memset(stored, 0, STORED_HEADER_SIZE);
+  stored->version = PG9021_CACHE_VERSION;
+  stored->hash = pg9021_cache_hash(entry);
+  stored->control_psm = entry->control_psm;
+  stored->interrupt_psm = entry->interrupt_psm;
+  stored->descriptor_len = entry->descriptor_len;
+  memcpy(stored->descriptor, entry->descriptor, entry->descriptor_len);
+  return STORED_HEADER_SIZE + entry->descriptor_len;
+}
+
+#ifdef ESP_PLATFORM
+static nvs_handle_t cache_handle;
+static int cache_open;
+static stored_entry_t cache_stored;  // too large for the BTstack task stack
+
+void pg9021_cache_init(void) {
+  esp_err_t err = nvs_flash_init();
+  if (err == ESP_ERR_NVS_NO_FREE_PAGES ||
+      err == ESP_ERR_NVS_NEW_VERSION_FOUND) {
+    nvs_flash_erase();
+    err = nvs_flash_init();
+  }
+  if (err == ESP_OK) {
+    err = nvs_open(CACHE_NAMESPACE, NVS_READWRITE, &cache_handle);
+  }
+  cache_open = err == ESP_OK;
+  if (!cache_open) printf("HID record cache not available\n");
+}
+
+// NVS keys are at most 15 characters, the address in hex is 12
+static void cache_key(const uint8_t address[6], char *key) {
+  snprintf(key, 13, "%02x%02x%02x%02x%02x%02x", address[0], address[1],
+           address[2], address[3], address[4], address[5]);
+}
+
+int pg9021_cache_load(const uint8_t address[6], pg9021_cache_entry_t *entry) {
+  size_t len = sizeof(cache_stored);
+  char key[13];
+
+  if (!cache_open) return -1;
+  cache_key(address, key);
+  if (nvs_get_blob(cache_handle, key, &cache_stored, &len) != ESP_OK ||
+      !stored_valid(&cache_stored, len, entry)) {
+    return -1;
+  }
+  return 0;
+}
+
+int pg9021_cache_store(const uint8_t address[6],
+                       const pg9021_cache_entry_t *entry) {
+  char key[13];
+
+  if (!cache_open || entry->descriptor_len > PG9021_CACHE_MAX_DESCRIPTOR) {
+    return -1;
+  }
+  cache_key(address, key);
+  size_t len = stored_make(&cache_stored, entry);
+  if (nvs_set_blob(cache_handle, key, &cache_stored, len) != ESP_OK ||
+      nvs_commit(cache_handle) != ESP_OK) {
+    return -1;
+  }
+  return 0;
+}
+#else
+// Host stand-in for NVS, lost on exit
+#define HOST_ENTRIES 8
+
+typedef struct {
+  uint8_t address[6];
+  size_t len;  // 0 - free
+  stored_entry_t stored;
+} host_entry_t;
+
+static host_entry_t host_entries[HOST_ENTRIES];
+
+void pg9021_cache_init(void) {}
+
+static host_entry_t *host_find(const uint8_t address[6]) {
+  for (int i = 0; i < HOST_ENTRIES; ++i) {
+    if (host_entries[i].len &&
+        memcmp(host_entries[i].address, address, 6) == 0) {
+      return &host_entries[i];
+    }
+  }
+  return NULL;
+}
+
+int pg9021_cache_load(const uint8_t address[6], pg9021_cache_entry_t *entry) {
+  host_entry_t *host = host_find(address);
+  if (!host || !stored_valid(&host->stored, host->len, entry)) return -1;
+  return 0;
+}
+
+int pg9021_cache_store(const uint8_t address[6],
+                       const pg9021_cache_entry_t *entry) {
+  host_entry_t *host = host_find(address);
+
+  if (entry->descriptor_len > PG9021_CACHE_MAX_DESCRIPTOR) return -1;
+  for (int i = 0; !host && i < HOST_ENTRIES; ++i) {
+    if (!host_entries[i].len) host = &host_entries[i];
+  }
+  if (!host) return -1;
+  memcpy(host->address, address, 6);
+  host->len = stored_make(&host->stored, entry);
+  return 0;
+}
+#endif
@@ -0,0 +1,48 @@
+#ifndef PG9021_CACHE_H
+#define PG9021_CACHE_H
+
+#include <stdint.h>
+
+#include "pg9021_report.h"
+
+/*
+ * HID record cache, what the SDP query of a gamepad returned, keyed by its
+ * Bluetooth address. A known gamepad is connected with the cached PSMs and
+ * descriptor and the record is checked by SDP after the channels are up.
+ * Entries are stored in NVS on the ESP32 and in RAM on the host.
+ */
+
+// 0 - always query SDP before connecting, for comparison
+#ifndef PG9021_DESCRIPTOR_CACHE
+#define PG9021_DESCRIPTOR_CACHE 1
+#endif
+
+// Bumped when the stored layout changes, older entries are ignored
+#define PG9021_CACHE_VERSION 1
+
+#define PG9021_CACHE_MAX_DESCRIPTOR PG9021_REPORT_MAX_DESCRIPTOR
+
+// The descriptor is not copied, the stored blob is built in one static
+// buffer so the callers on the BTstack task keep their stacks small
+typedef struct {
+  uint16_t control_psm;
+  uint16_t interrupt_psm;
+  uint16_t descriptor_len;
+  const uint8_t *descriptor;
+} pg9021_cache_entry_t;
+
+// Once, before any other call. The others are BTstack run loop only.
+void pg9021_cache_init(void);
+
+// Returns -1 if there is no entry or it is from another version or corrupt.
+// entry->descriptor is valid until the next call.
+int pg9021_cache_load(const uint8_t address[6], pg9021_cache_entry_t *entry);
+
+// Blocks while NVS writes, returns -1 on failure
+int pg9021_cache_store(const uint8_t address[6],
+                       const pg9021_cache_entry_t *entry);
+
+// FNV-1a of the PSMs and descriptor, 0 is never returned
+uint32_t pg9021_cache_hash(const pg9021_cache_entry_t *entry);
+
+#endif  // PG9021_CACHE_H
@@ -0,0 +1,229 @@
+#include "pg9021_capture.h"
+
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pg9021_pipeline.h"
+#include "pg9021_port.h"
+#include "pg9021_report.h"
+
+#ifdef ESP_PLATFORM
+#include "driver/uart.h"
+#include "esp_partition.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#endif
+
+#define CAPTURE_MASK (PG9021_CAPTURE_SIZE - 1)
+
+static uint8_t *capture_buffer;  // on the first start, kept from then on
+static atomic_uint capture_head;  // producer
+static atomic_uint capture_tail;  // flush
+static atomic_int capture_running;
+static pg9021_capture_sink_t capture_sink;
+static uint32_t capture_last_time;
+
+static uint8_t descriptor[PG9021_REPORT_MAX_DESCRIPTOR];
+static uint16_t descriptor_len;
+
+static pg9021_capture_stats_t capture_stats;
+
+// Producer side, drops the whole record if it does not fit
+static int capture_write(const uint8_t *header, size_t header_len,
+                         const uint8_t *data, size_t len) {
+  unsigned head = atomic_load_explicit(&capture_head, memory_order_relaxed);
+  unsigned tail = atomic_load_explicit(&capture_tail, memory_order_acquire);
+
+  if (PG9021_CAPTURE_SIZE - (head - tail) < header_len + len) return -1;
+
+  const uint8_t *parts[2] = {header, data};
+  size_t sizes[2] = {header_len, len};
+  for (int i = 0; i < 2 && sizes[i]; ++i) {
+    size_t offset = head & CAPTURE_MASK;
+    size_t first = PG9021_CAPTURE_SIZE - offset;
+    if (first > sizes[i]) first = sizes[i];
+    memcpy(&capture_buffer[offset], parts[i], first);
+    memcpy(capture_buffer, parts[i] + first, sizes[i] - first);
+    head += sizes[i];
+  }
+
+  atomic_store_explicit(&capture_head, head, memory_order_release);
+  return 0;
+}
+
+static void capture_record(pg9021_trace_record_type_t type,
+                           const uint8_t *data, uint16_t len) {
+  uint8_t header[PG9021_TRACE_MAX_RECORD_HEADER];
+  uint32_t now = (uint32_t)pg9021_port_time_us();
+  size_t header_len =
+      pg9021_trace_encode_record(header, type, now - capture_last_time, len);
+
+  // A dropped record's gap is added to the next one written
+  if (capture_write(header, header_len, data, len) == 0) {
+    capture_last_time = now;
+    capture_stats.records++;
+  } else {
+    capture_stats.dropped++;
+  }
+}
+
+void pg9021_capture_report(const uint8_t *packet, uint16_t len) {
+  if (!atomic_load_explicit(&capture_running, memory_order_relaxed)) return;
+  if (len > PG9021_TRACE_MAX_REPORT) {
+    capture_stats.dropped++;
+    return;
+  }
+  capture_record(PG9021_TRACE_RECORD_REPORT, packet, len);
+}
+
+void pg9021_capture_descriptor(const uint8_t *data, uint16_t len) {
+  if (len > PG9021_REPORT_MAX_DESCRIPTOR) len = PG9021_REPORT_MAX_DESCRIPTOR;
+  memcpy(descriptor, data, len);
+  descriptor_len = len;
+
+  if (atomic_load_explicit(&capture_running, memory_order_relaxed)) {
+    capture_record(PG9021_TRACE_RECORD_DESCRIPTOR, descriptor, len);
+  }
+}
+
+void pg9021_capture_flush(void) {
+  pg9021_capture_sink_t sink = capture_sink;
+  unsigned tail = atomic_load_explicit(&capture_tail, memory_order_relaxed);
+  unsigned head = atomic_load_explicit(&capture_head, memory_order_acquire);
+
+  while (sink && tail != head) {
+    size_t offset = tail & CAPTURE_MASK;
+    size_t len = head - tail;
+    if (len > PG9021_CAPTURE_SIZE - offset) {
+      len = PG9021_CAPTURE_SIZE - offset;
+    }
+
+    if ((*sink)(&capture_buffer[offset], len) != 0) {
+      // The sink is full or broken, the trace ends here
+      atomic_store_explicit(&capture_running, 0, memory_order_relaxed);
+      capture_sink = NULL;
+      break;
+    }
+    capture_stats.bytes += len;
+    tail += len;
+    atomic_store_explicit(&capture_tail, tail, memory_order_release);
+  }
+
+  // Stopped and everything written, a new capture can start
+  if (!atomic_load_explicit(&capture_running, memory_order_acquire) &&
+      tail == atomic_load_explicit(&capture_head, memory_order_acquire)) {
+    capture_sink = NULL;
+  }
+}
+
+#ifdef ESP_PLATFORM
+static TaskHandle_t capture_task_handle;
+
+static void capture_task(void *arg) {
+  for (;;) {
+    pg9021_capture_flush();
+    vTaskDelay(pdMS_TO_TICKS(PG9021_CAPTURE_FLUSH_MS));
+  }
+}
+#endif
+
+int pg9021_capture_start(pg9021_capture_sink_t sink) {
+  uint8_t header[PG9021_TRACE_HEADER_SIZE];
+
+  if (capture_sink) return -1;
+  if (!capture_buffer) capture_buffer = malloc(PG9021_CAPTURE_SIZE);
+  if (!capture_buffer) return -1;
+
+  memset(&capture_stats, 0, sizeof(capture_stats));
+  atomic_store(&capture_head, 0);
+  atomic_store(&capture_tail, 0);
+  capture_last_time = (uint32_t)pg9021_port_time_us();
+  capture_sink = sink;
+
+  capture_write(header, pg9021_trace_encode_header(header, capture_last_time),
+                NULL, 0);
+  if (descriptor_len) {
+    capture_record(PG9021_TRACE_RECORD_DESCRIPTOR, descriptor,
+                   descriptor_len);
+  }
+  atomic_store_explicit(&capture_running, 1, memory_order_release);
+
+#ifdef ESP_PLATFORM
+  if (!capture_task_handle) {
+    pg9021_pipeline_create_task(PG9021_STAGE_BACKGROUND, capture_task,
+                                "capture_task", 2048, &capture_task_handle);
+  }
+#endif
+  return 0;
+}
+
+// The capture task writes what is left, then the sink is released
+void pg9021_capture_stop(void) {
+  atomic_store_explicit(&capture_running, 0, memory_order_release);
+}
+
+int pg9021_capture_active(void) {
+  return atomic_load_explicit(&capture_running, memory_order_relaxed);
+}
+
+void pg9021_capture_get_stats(pg9021_capture_stats_t *stats) {
+  *stats = capture_stats;
+}
+
+#ifdef ESP_PLATFORM
+static const esp_partition_t *capture_partition;
+static size_t capture_partition_offset;
+
+static int partition_sink(const uint8_t *data, size_t len) {
+  if (capture_partition_offset + len > capture_partition->size) return -1;
+  if (esp_partition_write(capture_partition, capture_partition_offset, data,
+                          len) != ESP_OK) {
+    return -1;
+  }
+  capture_partition_offset += len;
+  return 0;
+}
+
+int pg9021_capture_start_partition(const char *label) {
+  // Without a label the first data partition would be NVS
+  if (!label) return -1;
+  capture_partition = esp_partition_find_first(
+      ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, label);
+  if (!capture_partition ||
+      esp_partition_erase_range(capture_partition, 0,
+                                capture_partition->size) != ESP_OK) {
+    return -1;
+  }
+  capture_partition_offset = 0;
+  return pg9021_capture_start(&partition_sink);
+}
+
+static int capture_uart_port = -1;
+
+static int uart_sink(const uint8_t *data, size_t len) {
+  int written = uart_write_bytes(capture_uart_port, (const char *)data, len);
+  return written == (int)len ? 0 : -1;
+}
+
+int pg9021_capture_start_uart(int port, int tx_pin, int baud_rate) {
+  if (capture_uart_port < 0) {
+    uart_config_t config = {
+        .baud_rate = baud_rate,
+        .data_bits = UART_DATA_8_BITS,
+        .parity = UART_PARITY_DISABLE,
+        .stop_bits = UART_STOP_BITS_1,
+        .flow_ctrl = UART_HW_FLOWCTRL_DISABLE,
+    };
+    if (uart_param_config(port, &config) != ESP_OK ||
+        uart_set_pin(port, tx_pin, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE,
+                     UART_PIN_NO_CHANGE) != ESP_OK ||
+        uart_driver_install(port, 256, PG9021_CAPTURE_SIZE / 4, 0, NULL, 0) !=
+            ESP_OK) {
+      return -1;
+    }
+    capture_uart_port = port;
+  }
+  return pg9021_capture_start(&uart_sink);
+}
+#endif
@@ -0,0 +1,61 @@
+#ifndef PG9021_CAPTURE_H
+#define PG9021_CAPTURE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "pg9021_trace.h"
+
+/*
+ * Capture of raw HID interrupt reports in the pg9021_trace.h format.
+ * Reports are appended to a RAM ring on the BTstack run loop and written
+ * to the sink in bulk by a low priority task, so capturing does not
+ * change the timing of the input path.
+ */
+
+#ifndef PG9021_CAPTURE_SIZE
+#define PG9021_CAPTURE_SIZE 16384  // bytes, power of two
+#endif
+
+#ifndef PG9021_CAPTURE_FLUSH_MS
+#define PG9021_CAPTURE_FLUSH_MS 100
+#endif
+
+// Writes one chunk of the trace, returns 0 on success
+typedef int (*pg9021_capture_sink_t)(const uint8_t *data, size_t len);
+
+typedef struct {
+  uint32_t records;
+  uint32_t bytes;    // written to the sink
+  uint32_t dropped;  // records that did not fit into the RAM ring
+} pg9021_capture_stats_t;
+
+// Call from the BTstack run loop, returns -1 if a capture is running or
+// there is no memory for the ring. The ring is allocated on the first start.
+int pg9021_capture_start(pg9021_capture_sink_t sink);
+
+// Buffered records are still written by the next pg9021_capture_flush()
+void pg9021_capture_stop(void);
+int pg9021_capture_active(void);
+
+// BTstack run loop
+void pg9021_capture_report(const uint8_t *packet, uint16_t len);
+void pg9021_capture_descriptor(const uint8_t *descriptor, uint16_t len);
+
+// Write everything buffered to the sink. Called by the capture task every
+// PG9021_CAPTURE_FLUSH_MS on the ESP32, by the application elsewhere.
+void pg9021_capture_flush(void);
+
+void pg9021_capture_get_stats(pg9021_capture_stats_t *stats);
+
+#ifdef ESP_PLATFORM
+// Data partition with this label, erased when the capture starts. The
+// partitions.csv of the project has one, PG9021_CAPTURE_PARTITION.
+#define PG9021_CAPTURE_PARTITION "capture"
+int pg9021_capture_start_partition(const char *label);
+
+// Raw bytes on a UART that is not the console
+int pg9021_capture_start_uart(int port, int tx_pin, int baud_rate);
+#endif
+
+#endif  // PG9021_CAPTURE_H
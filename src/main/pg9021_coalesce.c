@@ -0,0 +1,103 @@
+#include "pg9021_coalesce.h"
+
+#include <string.h>
+
+#include "pg9021_port.h"
+
+void pg9021_coalesce_init(pg9021_coalesce_t *coalesce) {
+  memset(coalesce, 0, sizeof(*coalesce));
+  for (int i = 0; i < PG9021_STATE_AXES; ++i) {
+    coalesce->config[i].interval_ms = PG9021_COALESCE_INTERVAL_MS;
+    coalesce->config[i].min_delta = PG9021_COALESCE_MIN_DELTA;
+    coalesce->emitted_value[i] = GP_THUMB_RELEASED;
+  }
+}
+
+int pg9021_coalesce_configure(pg9021_coalesce_t *coalesce, int axis,
+                              const pg9021_axis_rate_t *config) {
+  if (axis < 0 || axis >= PG9021_STATE_AXES) return -1;
+  coalesce->config[axis] = *config;
+  return 0;
+}
+
+void pg9021_coalesce_reset(pg9021_coalesce_t *coalesce, const uint8_t *axes) {
+  memcpy(coalesce->emitted_value, axes, PG9021_STATE_AXES);
+  memset(coalesce->emitted_time, 0, sizeof(coalesce->emitted_time));
+  coalesce->pending = 0;
+}
+
+static uint32_t PG9021_HOT coalesce_emit(pg9021_coalesce_t *coalesce, int axis,
+                                         uint8_t value, uint32_t now_ms) {
+  coalesce->emitted_value[axis] = value;
+  coalesce->emitted_time[axis] = now_ms;
+  coalesce->pending &= ~(1 << axis);
+  coalesce->stats.emitted++;
+  return PG9021_CHANGED_AXIS(axis);
+}
+
+uint32_t PG9021_HOT pg9021_coalesce_report(pg9021_coalesce_t *coalesce,
+                                           const pg9021_state_t *state,
+                                           uint32_t changed, uint32_t now_ms) {
+  uint32_t result = changed & ~PG9021_CHANGED_AXES;
+  uint32_t axes = ((changed & PG9021_CHANGED_AXES) >> 4) | coalesce->pending;
+
+  while (axes) {
+    int axis = __builtin_ctz(axes);
+    axes &= axes - 1;
+
+    uint8_t value = state->axes[axis];
+    uint8_t emitted = coalesce->emitted_value[axis];
+    int held = (coalesce->pending >> axis) & 1;
+
+    // A held value was replaced before it went out
+    if (held && (changed & PG9021_CHANGED_AXIS(axis))) {
+      coalesce->stats.coalesced++;
+    }
+    if (value == emitted) {
+      coalesce->pending &= ~(1 << axis);
+      continue;
+    }
+
+    const pg9021_axis_rate_t *config = &coalesce->config[axis];
+    int delta = value > emitted ? value - emitted : emitted - value;
+    if (now_ms - coalesce->emitted_time[axis] >= config->interval_ms ||
+        (config->min_delta && delta >= config->min_delta)) {
+      result |= coalesce_emit(coalesce, axis, value, now_ms);
+    } else {
+      coalesce->pending |= 1 << axis;
+    }
+  }
+  return result;
+}
+
+uint32_t pg9021_coalesce_due(pg9021_coalesce_t *coalesce,
+                             const pg9021_state_t *state, uint32_t now_ms) {
+  uint32_t result = 0;
+  uint32_t axes = coalesce->pending;
+
+  while (axes) {
+    int axis = __builtin_ctz(axes);
+    axes &= axes - 1;
+    if (now_ms - coalesce->emitted_time[axis] >=
+        coalesce->config[axis].interval_ms) {
+      result |= coalesce_emit(coalesce, axis, state->axes[axis], now_ms);
+    }
+  }
+  return result;
+}
+
+int32_t PG9021_HOT pg9021_coalesce_next(const pg9021_coalesce_t *coalesce,
+                                        uint32_t now_ms) {
+  int32_t next = -1;
+  uint32_t axes = coalesce->pending;
+
+  while (axes) {
+    int axis = __builtin_ctz(axes);
+    axes &= axes - 1;
+    uint32_t elapsed = now_ms - coalesce->emitted_time[axis];
+    uint32_t interval = coalesce->config[axis].interval_ms;
+    int32_t remaining = elapsed >= interval ? 0 : (int32_t)(interval - elapsed);
+    if (next < 0 || remaining < next) next = remaining;
+  }
+  return next;
+}
@@ -0,0 +1,66 @@
+#ifndef PG9021_COALESCE_H
+#define PG9021_COALESCE_H
+
+#include <stdint.h>
+
+#include "pg9021_state.h"
+
+/*
+ * Rate limit for thumb axis events. An axis change is passed on at once
+ * when interval_ms went by since the axis was last passed on, or when it
+ * moved by min_delta or more since then. Otherwise it is held and the
+ * latest value goes out when the interval is up, on the next report or
+ * the timer, whichever comes first. Buttons, hat and keys are never held.
+ */
+
+#ifndef PG9021_COALESCE_INTERVAL_MS
+#define PG9021_COALESCE_INTERVAL_MS 20
+#endif
+
+#ifndef PG9021_COALESCE_MIN_DELTA
+#define PG9021_COALESCE_MIN_DELTA 64
+#endif
+
+typedef struct {
+  uint16_t interval_ms;  // 0 - every change
+  uint8_t min_delta;     // 0 - off
+} pg9021_axis_rate_t;
+
+typedef struct {
+  uint32_t emitted;    // axis events passed on
+  uint32_t coalesced;  // axis changes replaced by a later value
+} pg9021_coalesce_stats_t;
+
+typedef struct {
+  pg9021_axis_rate_t config[PG9021_STATE_AXES];
+  uint8_t emitted_value[PG9021_STATE_AXES];
+  uint32_t emitted_time[PG9021_STATE_AXES];
+  uint8_t pending;  // bit per axis
+  pg9021_coalesce_stats_t stats;
+} pg9021_coalesce_t;
+
+// PG9021_COALESCE_* defaults, nothing held
+void pg9021_coalesce_init(pg9021_coalesce_t *coalesce);
+
+// Returns -1 for an invalid axis. Any task, a report may see half of it.
+int pg9021_coalesce_configure(pg9021_coalesce_t *coalesce, int axis,
+                              const pg9021_axis_rate_t *config);
+
+// The consumer saw these axes, e.g. on a new connection
+void pg9021_coalesce_reset(pg9021_coalesce_t *coalesce, const uint8_t *axes);
+
+// Changed mask of a report with the held axes removed and the due ones
+// added
+uint32_t pg9021_coalesce_report(pg9021_coalesce_t *coalesce,
+                                const pg9021_state_t *state, uint32_t changed,
+                                uint32_t now_ms);
+
+// Changed mask of the held axes that are due, for the timer
+uint32_t pg9021_coalesce_due(pg9021_coalesce_t *coalesce,
+                             const pg9021_state_t *state, uint32_t now_ms);
+
+// Milliseconds until the next held axis is due, -1 if none is held
+int32_t pg9021_coalesce_next(const pg9021_coalesce_t *coalesce,
+                             uint32_t now_ms);
+
+#endif  // PG9021_COALESCE_H
@@ -0,0 +1,353 @@
+#include "pg9021_console.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pg9021.h"
+#include "pg9021_bench.h"
+#include "pg9021_latency.h"
+#include "pg9021_pipeline.h"
+#include "pg9021_power.h"
+#include "pg9021_udp.h"
+
+#ifdef ESP_PLATFORM
+#include "driver/uart.h"
+#include "esp_heap_caps.h"
+#include "esp_vfs_dev.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "sdkconfig.h"
+#endif
+
+#define MAX_ARGS 6
+
+typedef struct {
+  const char *name;
+  const char *help;
+  int (*run)(int argc, char **argv);
+  uint8_t run_loop;  // touches state of the input path, runs on the run loop
+} console_command_t;
+
+// A command line handed to the BTstack run loop, argv points into line
+typedef struct {
+  int (*run)(int argc, char **argv);
+  int argc;
+  char *argv[MAX_ARGS];
+  char line[PG9021_CONSOLE_LINE_SIZE];
+} posted_command_t;
+
+#ifdef ESP_PLATFORM
+extern void btstack_run_loop_freertos_execute_code_on_main_thread(
+    void (*fn)(void *arg), void *arg);
+#endif
+
+static int command_help(int argc, char **argv);
+
+static int command_bench(int argc, char **argv) {
+  int flash = argc > 1 && strcmp(argv[1], "flash") == 0;
+  int passes = argc > 1 + flash ? atoi(argv[1 + flash]) : PG9021_BENCH_PASSES;
+  if (passes < 1 || passes > PG9021_BENCH_MAX_PASSES) {
+    printf("bench [flash] <passes 1..%d>\n", PG9021_BENCH_MAX_PASSES);
+    return -1;
+  }
+  if (flash) {
+    pg9021_bench_start_flash(passes);
+  } else {
+    pg9021_bench_start(passes);
+  }
+  return 0;
+}
+
+static int command_latency(int argc, char **argv) {
+  if (argc > 1 && strcmp(argv[1], "reset") == 0) {
+    pg9021_latency_reset();
+    printf("Latency reset\n");
+    return 0;
+  }
+  pg9021_latency_print();
+  return 0;
+}
+
+static int command_link(int argc, char **argv) {
+  static const char *const states[] = {"idle", "connecting", "connected",
+                                       "waiting"};
+  pg9021_link_info_t info;
+
+  printf("player state      attempts reconnects reacquire_ms\n");
+  for (int i = 0; i < PG9021_MAX_PLAYERS; ++i) {
+    pg9021_get_link_info((uint8_t)i, &info);
+    printf("%6d %-10s %8u %10" PRIu32 " %12" PRIu32 "\n", i + 1,
+           states[info.state], info.attempts, info.reconnects,
+           info.reacquire_ms);
+  }
+  return 0;
+}
+
+static int command_stats(int argc, char **argv) {
+  pg9021_decode_stats_t stats;
+  pg9021_coalesce_stats_t coalesce_stats;
+
+  if (argc > 1 && strcmp(argv[1], "reset") == 0) {
+    pg9021_reset_decode_stats();
+    printf("Stats reset\n");
+    return 0;
+  }
+  pg9021_get_decode_stats(&stats);
+  printf("Reports skipped: %" PRIu32 ", partial: %" PRIu32 ", full: %" PRIu32
+         "\n",
+         stats.skipped, stats.partial, stats.full);
+  pg9021_get_coalesce_stats(&coalesce_stats);
+  printf("Axis events emitted: %" PRIu32 ", coalesced: %" PRIu32
+         " (%" PRIu32 " per 100 emitted)\n",
+         coalesce_stats.emitted, coalesce_stats.coalesced,
+         coalesce_stats.emitted
+             ? (uint32_t)((uint64_t)coalesce_stats.coalesced * 100 /
+                          coalesce_stats.emitted)
+             : 0);
+  return 0;
+}
+
+static int command_filter(int argc, char **argv) {
+  pg9021_axis_filter_config_t config;
+
+  if (argc == 6) {
+    config.deadzone = (uint8_t)atoi(argv[2]);
+    config.smoothing = (uint8_t)atoi(argv[3]);
+    config.fast_delta = (uint8_t)atoi(argv[4]);
+    config.hysteresis = (uint8_t)atoi(argv[5]);
+    if (pg9021_set_axis_filter(atoi(argv[1]), &config) != 0) {
+      printf("Invalid axis or smoothing (0..%d)\n",
+             PG9021_FILTER_MAX_SMOOTHING);
+      return -1;
+    }
+  } else if (argc != 1) {
+    printf("filter <axis> <deadzone> <smoothing> <fast delta> <hysteresis>\n");
+    return -1;
+  }
+
+  printf("axis deadzone smoothing fast hysteresis\n");
+  for (int i = 0; i < PG9021_STATE_AXES; ++i) {
+    pg9021_get_axis_filter(i, &config);
+    printf("%4d %8u %9u %4u %10u\n", i, config.deadzone, config.smoothing,
+           config.fast_delta, config.hysteresis);
+  }
+  return 0;
+}
+
+static int command_power(int argc, char **argv) {
+  const pg9021_power_profile_t *profile;
+  pg9021_power_stats_t stats;
+
+  if (argc == 2) {
+    int id = 0;
+    while ((profile = pg9021_power_profile(id)) &&
+           strcmp(profile->name, argv[1]) != 0) {
+      id++;
+    }
+    if (!profile) {
+      printf("Unknown profile '%s'\n", argv[1]);
+      return -1;
+    }
+    pg9021_power_set_profile(id);
+  } else if (argc != 1) {
+    printf("power <profile>\n");
+    return -1;
+  }
+
+  printf("  profile     idle_ms sniff_ms cpu_mhz light_sleep\n");
+  for (int id = 0; (profile = pg9021_power_profile(id)); ++id) {
+    printf("%c %-11s %7u %4u-%-3u %7u %11u\n",
+           id == pg9021_power_get_profile() ? '*' : ' ', profile->name,
+           profile->idle_ms, profile->sniff_min_ms, profile->sniff_max_ms,
+           profile->cpu_min_mhz, profile->light_sleep);
+  }
+  pg9021_power_get_stats(&stats);
+  printf("Active gamepads: %d, went idle: %" PRIu32 ", woke up: %" PRIu32
+         "\n",
+         pg9021_power_active(), stats.idle, stats.wakeups);
+  return 0;
+}
+
+static int command_rate(int argc, char **argv) {
+  pg9021_axis_rate_t config;
+
+  if (argc == 4) {
+    config.interval_ms = (uint16_t)atoi(argv[2]);
+    config.min_delta = (uint8_t)atoi(argv[3]);
+    if (pg9021_set_axis_rate(atoi(argv[1]), &config) != 0) {
+      printf("Invalid axis\n");
+      return -1;
+    }
+  } else if (argc != 1) {
+    printf("rate <axis> <interval ms> <min delta>\n");
+    return -1;
+  }
+
+  printf("axis interval delta\n");
+  for (int i = 0; i < PG9021_STATE_AXES; ++i) {
+    pg9021_get_axis_rate(i, &config);
+    printf("%4d %8u %5u\n", i, config.interval_ms, config.min_delta);
+  }
+  return 0;
+}
+
+static int command_udp(int argc, char **argv) {
+  uint16_t interval_ms, keyframe_ms;
+  pg9021_udp_stats_t stats;
+
+  if (argc == 3) {
+    if (pg9021_udp_set_rate((uint16_t)atoi(argv[1]),
+                            (uint16_t)atoi(argv[2])) != 0) {
+      printf("Invalid interval (1..1000 ms)\n");
+      return -1;
+    }
+  } else if (argc != 1) {
+    printf("udp <interval ms> <keyframe ms>\n");
+    return -1;
+  }
+
+  pg9021_udp_get_rate(&interval_ms, &keyframe_ms);
+  pg9021_udp_get_stats(&stats);
+  printf("Interval: %u ms, keyframe: %u ms\n", interval_ms, keyframe_ms);
+  printf("Datagrams: %" PRIu32 " (%" PRIu32 " bytes), full: %" PRIu32
+         ", delta: %" PRIu32 ", errors: %" PRIu32 ", torn: %" PRIu32 "\n",
+         stats.datagrams, stats.bytes, stats.full, stats.delta, stats.errors,
+         stats.torn);
+  return 0;
+}
+
+static int command_pipeline(int argc, char **argv) {
+  if (argc > 1 && strcmp(argv[1], "reset") == 0) {
+    pg9021_pipeline_reset_probe();
+    printf("Jitter probe reset\n");
+    return 0;
+  }
+  pg9021_pipeline_print();
+  return 0;
+}
+
+#ifdef ESP_PLATFORM
+void pg9021_console_print_heap(void) {
+  const uint32_t caps = MALLOC_CAP_8BIT | MALLOC_CAP_INTERNAL;
+  printf("Heap free: %u, largest block: %u, lowest free: %u bytes\n",
+         (unsigned)heap_caps_get_free_size(caps),
+         (unsigned)heap_caps_get_largest_free_block(caps),
+         (unsigned)heap_caps_get_minimum_free_size(caps));
+}
+
+static int command_heap(int argc, char **argv) {
+  pg9021_console_print_heap();
+  return 0;
+}
+#endif
+
+static const console_command_t commands[] = {
+    {"bench", "[flash] [passes] input path microbenchmarks as JSON",
+     &command_bench},
+    {"filter", "[axis deadzone smoothing fast hysteresis] thumb filter",
+     &command_filter, 1},
+#ifdef ESP_PLATFORM
+    {"heap", "free internal RAM and largest block", &command_heap},
+#endif
+    {"help", "list commands", &command_help},
+    {"latency", "[reset] input latency p50/p99/max", &command_latency},
+    {"link", "gamepad connections and reconnects", &command_link, 1},
+    {"pipeline", "[reset] task layout and dispatch jitter",
+     &command_pipeline},
+    {"power", "[profile] activity governor profiles", &command_power, 1},
+    {"rate", "[axis interval_ms min_delta] axis event rate limit",
+     &command_rate, 1},
+    {"stats", "[reset] decoder and coalescing counters", &command_stats, 1},
+    {"udp", "[interval_ms keyframe_ms] UDP state stream", &command_udp},
+};
+
+#define COMMAND_COUNT (sizeof(commands) / sizeof(commands[0]))
+
+static int command_help(int argc, char **argv) {
+  for (size_t i = 0; i < COMMAND_COUNT; ++i) {
+    printf("%-8s %s\n", commands[i].name, commands[i].help);
+  }
+  return 0;
+}
+
+static void run_posted_command(void *arg) {
+  posted_command_t *command = arg;
+  (*command->run)(command->argc, command->argv);
+  free(command);
+}
+
+// The console task and the run loop may be on different cores. Returns 0
+// once the command is queued, it prints its own errors.
+static int post_command(const console_command_t *command, int argc,
+                        char **argv, const char *buffer) {
+  posted_command_t *posted = malloc(sizeof(*posted));
+  if (!posted) {
+    printf("No memory for '%s'\n", command->name);
+    return -1;
+  }
+  posted->run = command->run;
+  posted->argc = argc;
+  memcpy(posted->line, buffer, sizeof(posted->line));
+  for (int i = 0; i < argc; ++i) {
+    posted->argv[i] = posted->line + (argv[i] - buffer);
+  }
+#ifdef ESP_PLATFORM
+  btstack_run_loop_freertos_execute_code_on_main_thread(&run_posted_command,
+                                                        posted);
+#else
+  run_posted_command(posted);
+#endif
+  return 0;
+}
+
+int pg9021_console_execute(const char *line) {
+  char buffer[PG9021_CONSOLE_LINE_SIZE];
+  char *argv[MAX_ARGS];
+  char *save;
+  int argc = 0;
+
+  strncpy(buffer, line, sizeof(buffer) - 1);
+  buffer[sizeof(buffer) - 1] = '\0';
+
+  for (char *arg = strtok_r(buffer, " \t\r\n", &save);
+       arg && argc < MAX_ARGS; arg = strtok_r(NULL, " \t\r\n", &save)) {
+    argv[argc++] = arg;
+  }
+  if (!argc) return 0;
+
+  for (size_t i = 0; i < COMMAND_COUNT; ++i) {
+    if (strcmp(argv[0], commands[i].name) != 0) continue;
+    if (commands[i].run_loop) {
+      return post_command(&commands[i], argc, argv, buffer);
+    }
+    return (*commands[i].run)(argc, argv);
+  }
+  printf("Unknown command '%s', try 'help'\n", argv[0]);
+  return -1;
+}
+
+#ifdef ESP_PLATFORM
+static void console_task(void *arg) {
+  char line[PG9021_CONSOLE_LINE_SIZE];
+
+  for (;;) {
+    if (fgets(line, sizeof(line), stdin)) {
+      pg9021_console_execute(line);
+    }
+  }
+}
+
+void pg9021_console_start(void) {
+  // Blocking reads from stdin need the UART driver
+  if (uart_driver_install(CONFIG_ESP_CONSOLE_UART_NUM, 256, 0, 0, NULL, 0) !=
+      ESP_OK) {
+    printf("Console UART driver install failed\n");
+    return;
+  }
+  esp_vfs_dev_uart_use_driver(CONFIG_ESP_CONSOLE_UART_NUM);
+  pg9021_pipeline_create_task(PG9021_STAGE_BACKGROUND, console_task,
+                              "console_task", 3072, NULL);
+}
+#endif
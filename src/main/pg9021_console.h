@@ -0,0 +1,22 @@
+#ifndef PG9021_CONSOLE_H
+#define PG9021_CONSOLE_H
+
+// Diagnostic commands on the serial console, "help" lists them
+
+#ifndef PG9021_CONSOLE_LINE_SIZE
+#define PG9021_CONSOLE_LINE_SIZE 64
+#endif
+
+// Run one command line, returns -1 for an unknown command
+int pg9021_console_execute(const char *line);
+
+#ifdef ESP_PLATFORM
+// Low priority task reading command lines from the console UART
+void pg9021_console_start(void);
+
+// Free internal heap, its largest block and the lowest free so far, also
+// the "heap" command
+void pg9021_console_print_heap(void);
+#endif
+
+#endif  // PG9021_CONSOLE_H
@@ -0,0 +1,141 @@
+#include "pg9021_filter.h"
+
+#include "pg9021_port.h"
+
+// SWAR helpers, four unsigned bytes per word
+#define LANES_LOW 0x01010101u
+#define LANES_HIGH 0x80808080u
+#define LANES(value) ((uint32_t)(value)*LANES_LOW)
+
+#define CENTRE LANES(GP_THUMB_RELEASED)
+
+// a - b per byte, modulo 256
+static inline uint32_t lanes_sub(uint32_t a, uint32_t b) {
+  return ((a | LANES_HIGH) - (b & ~LANES_HIGH)) ^ ((a ^ ~b) & LANES_HIGH);
+}
+
+// Lane high bit to 0xff / 0x00
+static inline uint32_t lanes_expand(uint32_t high) {
+  return ((high & LANES_HIGH) >> 7) * 0xff;
+}
+
+// 0xff where a < b, the borrow out of each byte of a - b
+static inline uint32_t lanes_less(uint32_t a, uint32_t b) {
+  uint32_t difference = lanes_sub(a, b);
+  return lanes_expand((~a & b) | (~(a ^ b) & difference));
+}
+
+static inline uint32_t lanes_sub_saturate(uint32_t a, uint32_t b) {
+  return lanes_sub(a, b) & ~lanes_less(a, b);
+}
+
+// 0xff where the byte is not zero
+static inline uint32_t lanes_nonzero(uint32_t v) {
+  return lanes_expand(((v & ~LANES_HIGH) + ~LANES_HIGH) | v);
+}
+
+// v / 2^shift rounded up, never 0 for a non zero byte
+static inline uint32_t lanes_shift_up(uint32_t v, int shift) {
+  uint32_t quotient = (v >> shift) & LANES(0xff >> shift);
+  uint32_t remainder = v & LANES((1 << shift) - 1);
+  return quotient + (lanes_nonzero(remainder) & LANES_LOW);
+}
+
+static void filter_update(pg9021_filter_t *filter) {
+  for (int shift = 0; shift <= PG9021_FILTER_MAX_SMOOTHING; ++shift) {
+    filter->smoothing_mask[shift] = 0;
+  }
+  filter->fast_delta = 0;
+  filter->hysteresis = 0;
+
+  for (int i = 0; i < PG9021_STATE_AXES; ++i) {
+    const pg9021_axis_filter_config_t *config = &filter->config[i];
+    filter->smoothing_mask[config->smoothing] |= 0xffu << (8 * i);
+    // A delta never exceeds 0xff, so 0 disables the fast path
+    uint32_t fast = config->fast_delta ? config->fast_delta : 0xff;
+    filter->fast_delta |= fast << (8 * i);
+    filter->hysteresis |= (uint32_t)config->hysteresis << (8 * i);
+    filter->deadzone_squared[i] = config->deadzone * config->deadzone;
+  }
+  filter->settled = 0;
+}
+
+void pg9021_filter_init(pg9021_filter_t *filter) {
+  static const pg9021_axis_filter_config_t default_config =
+      PG9021_FILTER_DEFAULT_CONFIG;
+
+  for (int i = 0; i < PG9021_STATE_AXES; ++i) {
+    filter->config[i] = default_config;
+  }
+  filter_update(filter);
+  pg9021_filter_reset(filter, CENTRE);
+}
+
+int pg9021_filter_configure(pg9021_filter_t *filter, int axis,
+                            const pg9021_axis_filter_config_t *config) {
+  if (axis < 0 || axis >= PG9021_STATE_AXES ||
+      config->smoothing > PG9021_FILTER_MAX_SMOOTHING) {
+    return -1;
+  }
+  filter->config[axis] = *config;
+  filter_update(filter);
+  return 0;
+}
+
+void pg9021_filter_reset(pg9021_filter_t *filter, uint32_t axes) {
+  filter->filtered = axes;
+  filter->output = axes;
+  filter->settled = 0;
+}
+
+// Centre a stick, axes 2 * stick and 2 * stick + 1, inside its ellipse
+static uint32_t PG9021_HOT filter_deadzone(const pg9021_filter_t *filter,
+                                           uint32_t raw) {
+  for (int axis = 0; axis < PG9021_STATE_AXES; axis += 2) {
+    uint32_t rx2 = filter->deadzone_squared[axis];
+    uint32_t ry2 = filter->deadzone_squared[axis + 1];
+    if (!rx2 || !ry2) continue;
+
+    int shift = 8 * axis;
+    int dx = (int)((raw >> shift) & 0xff) - GP_THUMB_RELEASED;
+    int dy = (int)((raw >> (shift + 8)) & 0xff) - GP_THUMB_RELEASED;
+    if ((uint32_t)(dx * dx) * ry2 + (uint32_t)(dy * dy) * rx2 <= rx2 * ry2) {
+      raw = (raw & ~(0xffffu << shift)) | (CENTRE & (0xffffu << shift));
+    }
+  }
+  return raw;
+}
+
+uint32_t PG9021_HOT pg9021_filter_run(pg9021_filter_t *filter, uint32_t raw) {
+  uint32_t target = filter_deadzone(filter, raw);
+  uint32_t filtered = filter->filtered;
+
+  // Smoothing, only one of up and down is non zero per axis
+  uint32_t up = lanes_sub_saturate(target, filtered);
+  uint32_t down = lanes_sub_saturate(filtered, target);
+  uint32_t fast = lanes_less(filter->fast_delta, up | down);
+  uint32_t step_up = up & fast;
+  uint32_t step_down = down & fast;
+  for (int shift = 0; shift <= PG9021_FILTER_MAX_SMOOTHING; ++shift) {
+    uint32_t mask = filter->smoothing_mask[shift] & ~fast;
+    if (!mask) continue;
+    step_up |= lanes_shift_up(up, shift) & mask;
+    step_down |= lanes_shift_up(down, shift) & mask;
+  }
+  filtered = filtered + step_up - step_down;
+
+  // Hysteresis
+  uint32_t output = filter->output;
+  uint32_t distance = lanes_sub_saturate(filtered, output) |
+                      lanes_sub_saturate(output, filtered);
+  uint32_t pass = lanes_less(filter->hysteresis, distance) |
+                  ~lanes_nonzero(filtered) |
+                  ~lanes_nonzero(filtered ^ CENTRE) |
+                  ~lanes_nonzero(~filtered);
+  output = (filtered & pass) | (output & ~pass);
+
+  filter->filtered = filtered;
+  filter->output = output;
+  filter->settled = filtered == target;
+  return output;
+}
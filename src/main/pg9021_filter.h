@@ -0,0 +1,72 @@
+#ifndef PG9021_FILTER_H
+#define PG9021_FILTER_H
+
+#include <stdint.h>
+
+#include "pg9021_state.h"
+
+/*
+ * Thumb axis filter. The four axes travel as one packed word, axis n in
+ * byte n (pg9021_state_t.axes order), and every stage works on all of them
+ * at once:
+ *
+ *   deadzone   - a stick inside the ellipse of its two axis deadzones is
+ *                centred, both axes need a deadzone
+ *   smoothing  - integer EMA, each report moves 1/2^smoothing of the way
+ *                to the raw value, rounded towards it so it always lands.
+ *                A jump above fast_delta is taken in one step, so there
+ *                is no lag while the stick moves (One-Euro style).
+ *   hysteresis - the output only moves once the filtered value is more
+ *                than hysteresis away, centre and both ends pass always
+ */
+
+#define PG9021_FILTER_MAX_SMOOTHING 3
+
+typedef struct {
+  uint8_t deadzone;    // 0 - off
+  uint8_t smoothing;   // 0 - off .. PG9021_FILTER_MAX_SMOOTHING
+  uint8_t fast_delta;  // 0 - always smooth
+  uint8_t hysteresis;  // 0 - off
+} pg9021_axis_filter_config_t;
+
+typedef struct {
+  pg9021_axis_filter_config_t config[PG9021_STATE_AXES];
+
+  // Packed per axis parameters, derived from config
+  uint32_t smoothing_mask[PG9021_FILTER_MAX_SMOOTHING + 1];
+  uint32_t fast_delta;
+  uint32_t hysteresis;
+  uint32_t deadzone_squared[PG9021_STATE_AXES];
+
+  uint32_t filtered;  // EMA state
+  uint32_t output;
+  uint8_t settled;  // the same input would not change the output
+} pg9021_filter_t;
+
+#define PG9021_FILTER_DEFAULT_CONFIG {10, 2, 16, 1}
+
+// All axes PG9021_FILTER_DEFAULT_CONFIG and centred
+void pg9021_filter_init(pg9021_filter_t *filter);
+
+// Returns -1 for an invalid axis or smoothing
+int pg9021_filter_configure(pg9021_filter_t *filter, int axis,
+                            const pg9021_axis_filter_config_t *config);
+
+// Jump to the given packed axes, e.g. on a new connection
+void pg9021_filter_reset(pg9021_filter_t *filter, uint32_t axes);
+
+// Feed one report's raw axes, returns the packed output
+uint32_t pg9021_filter_run(pg9021_filter_t *filter, uint32_t raw);
+
+static inline uint32_t pg9021_filter_pack(const uint8_t *axes) {
+  return axes[0] | (axes[1] << 8) | (axes[2] << 16) |
+         ((uint32_t)axes[3] << 24);
+}
+
+static inline void pg9021_filter_unpack(uint32_t packed, uint8_t *axes) {
+  for (int i = 0; i < PG9021_STATE_AXES; ++i) {
+    axes[i] = (uint8_t)(packed >> (8 * i));
+  }
+}
+
+#endif  // PG9021_FILTER_H
@@ -0,0 +1,201 @@
+#include "pg9021_frame.h"
+
+#include <string.h>
+
+#include "pg9021_port.h"
+
+#define KEYS_SIZE 32
+
+// CRC-8, polynomial 0x07, a nibble at a time
+static const uint8_t PG9021_HOT_DATA crc8_table[16] = {
+    0x00, 0x07, 0x0e, 0x09, 0x1c, 0x1b, 0x12, 0x15,
+    0x38, 0x3f, 0x36, 0x31, 0x24, 0x23, 0x2a, 0x2d};
+
+uint8_t PG9021_HOT pg9021_frame_crc8(const uint8_t *data, size_t len) {
+  uint8_t crc = 0;
+  for (size_t i = 0; i < len; ++i) {
+    crc ^= data[i];
+    crc = (uint8_t)(crc << 4) ^ crc8_table[crc >> 4];
+    crc = (uint8_t)(crc << 4) ^ crc8_table[crc >> 4];
+  }
+  return crc;
+}
+
+static void PG9021_HOT store_32(uint8_t *buffer, uint32_t value) {
+  for (int i = 0; i < 4; ++i) buffer[i] = (uint8_t)(value >> (i * 8));
+}
+
+static uint32_t read_32(const uint8_t *buffer) {
+  return buffer[0] | (buffer[1] << 8) | (buffer[2] << 16) |
+         ((uint32_t)buffer[3] << 24);
+}
+
+static size_t PG9021_HOT store_keys(uint8_t *buffer,
+                                    const pg9021_state_t *state) {
+  for (int word = 0; word < 8; ++word) {
+    store_32(&buffer[word * 4], state->keys[word]);
+  }
+  return KEYS_SIZE;
+}
+
+static void read_keys(pg9021_state_t *state, const uint8_t *buffer) {
+  for (int word = 0; word < 8; ++word) {
+    state->keys[word] = read_32(&buffer[word * 4]);
+  }
+}
+
+static size_t PG9021_HOT store_header(uint8_t *buffer, pg9021_frame_kind_t kind,
+                                      uint8_t player, uint8_t sequence) {
+  buffer[0] = PG9021_FRAME_SYNC;
+  buffer[1] = (uint8_t)(kind << 4 | player);
+  buffer[2] = sequence;
+  return PG9021_FRAME_HEADER_SIZE;
+}
+
+static size_t PG9021_HOT store_crc(uint8_t *buffer, size_t pos) {
+  buffer[pos] = pg9021_frame_crc8(&buffer[1], pos - 1);
+  return pos + 1;
+}
+
+size_t PG9021_HOT pg9021_frame_encode_full(uint8_t *buffer, uint8_t player,
+                                           uint8_t sequence,
+                                           const pg9021_state_t *state) {
+  size_t pos = store_header(buffer, PG9021_FRAME_FULL, player, sequence);
+
+  store_32(&buffer[pos], state->buttons);
+  pos += 4;
+  buffer[pos++] = state->hat;
+  memcpy(&buffer[pos], state->axes, PG9021_STATE_AXES);
+  pos += PG9021_STATE_AXES;
+  pos += store_keys(&buffer[pos], state);
+  return store_crc(buffer, pos);
+}
+
+size_t PG9021_HOT pg9021_frame_encode_delta(uint8_t *buffer, uint8_t player,
+                                            uint8_t sequence,
+                                            const pg9021_state_t *state,
+                                            uint32_t changed) {
+  size_t pos = store_header(buffer, PG9021_FRAME_DELTA, player, sequence);
+
+  buffer[pos++] = (uint8_t)changed;
+  if (changed & PG9021_CHANGED_BUTTONS) {
+    store_32(&buffer[pos], state->buttons);
+    pos += 4;
+  }
+  if (changed & PG9021_CHANGED_HAT) buffer[pos++] = state->hat;
+  for (int i = 0; i < PG9021_STATE_AXES; ++i) {
+    if (changed & PG9021_CHANGED_AXIS(i)) buffer[pos++] = state->axes[i];
+  }
+  if (changed & PG9021_CHANGED_KEYS) pos += store_keys(&buffer[pos], state);
+  return store_crc(buffer, pos);
+}
+
+void pg9021_frame_decoder_init(pg9021_frame_decoder_t *decoder) {
+  memset(decoder, 0, sizeof(*decoder));
+  for (int i = 0; i < PG9021_MAX_PLAYERS; ++i) {
+    pg9021_state_init(&decoder->states[i]);
+  }
+}
+
+// Bytes of the frame in the buffer, 0 until known, -1 if it is no frame
+static int frame_size(const pg9021_frame_decoder_t *decoder) {
+  if (decoder->len < 2) return 0;
+  if ((decoder->buffer[1] & 0x0f) >= PG9021_MAX_PLAYERS) return -1;
+
+  switch (decoder->buffer[1] >> 4) {
+    case PG9021_FRAME_FULL:
+      return PG9021_FRAME_FULL_SIZE;
+    case PG9021_FRAME_DELTA: {
+      if (decoder->len < PG9021_FRAME_HEADER_SIZE + 1) return 0;
+      uint8_t changed = decoder->buffer[PG9021_FRAME_HEADER_SIZE];
+      return PG9021_FRAME_HEADER_SIZE + 1 +
+             (changed & PG9021_CHANGED_BUTTONS ? 4 : 0) +
+             (changed & PG9021_CHANGED_HAT ? 1 : 0) +
+             __builtin_popcount(changed & PG9021_CHANGED_AXES) +
+             (changed & PG9021_CHANGED_KEYS ? KEYS_SIZE : 0) + 1;
+    }
+    default:
+      return -1;
+  }
+}
+
+// Drops the first byte and everything up to the next sync byte
+static void decoder_resync(pg9021_frame_decoder_t *decoder) {
+  uint8_t skip = 1;
+  while (skip < decoder->len && decoder->buffer[skip] != PG9021_FRAME_SYNC) {
+    skip++;
+  }
+  decoder->stats.sync_bytes += skip;
+  decoder->len -= skip;
+  memmove(decoder->buffer, &decoder->buffer[skip], decoder->len);
+}
+
+static int decoder_apply(pg9021_frame_decoder_t *decoder) {
+  const uint8_t *frame = decoder->buffer;
+  uint8_t player = frame[1] & 0x0f;
+  uint8_t bit = 1 << player;
+  pg9021_state_t *state = &decoder->states[player];
+  size_t pos = PG9021_FRAME_HEADER_SIZE;
+
+  decoder->stats.frames++;
+  if (decoder->started && frame[2] != (uint8_t)(decoder->sequence + 1)) {
+    // Any player may have missed a delta
+    decoder->stats.lost += (uint8_t)(frame[2] - decoder->sequence - 1);
+    decoder->valid = 0;
+  }
+  decoder->started = 1;
+  decoder->sequence = frame[2];
+
+  if (frame[1] >> 4 == PG9021_FRAME_FULL) {
+    state->buttons = read_32(&frame[pos]);
+    state->hat = frame[pos + 4];
+    memcpy(state->axes, &frame[pos + 5], PG9021_STATE_AXES);
+    read_keys(state, &frame[pos + 5 + PG9021_STATE_AXES]);
+    decoder->valid |= bit;
+    return player;
+  }
+
+  if (!(decoder->valid & bit)) {
+    decoder->stats.skipped++;
+    return -1;
+  }
+  uint8_t changed = frame[pos++];
+  if (changed & PG9021_CHANGED_BUTTONS) {
+    state->buttons = read_32(&frame[pos]);
+    pos += 4;
+  }
+  if (changed & PG9021_CHANGED_HAT) state->hat = frame[pos++];
+  for (int i = 0; i < PG9021_STATE_AXES; ++i) {
+    if (changed & PG9021_CHANGED_AXIS(i)) state->axes[i] = frame[pos++];
+  }
+  if (changed & PG9021_CHANGED_KEYS) read_keys(state, &frame[pos]);
+  return player;
+}
+
+int pg9021_frame_decode(pg9021_frame_decoder_t *decoder, uint8_t byte) {
+  int player = -1;
+
+  decoder->buffer[decoder->len++] = byte;
+
+  // A resync may leave a complete frame in the buffer
+  for (;;) {
+    int size = frame_size(decoder);
+    if (decoder->len && decoder->buffer[0] != PG9021_FRAME_SYNC) size = -1;
+    if (size < 0) {
+      decoder_resync(decoder);
+      continue;
+    }
+    if (size == 0 || decoder->len < size) return player;
+
+    if (pg9021_frame_crc8(&decoder->buffer[1], size - 2) !=
+        decoder->buffer[size - 1]) {
+      decoder->stats.crc_errors++;
+      decoder_resync(decoder);
+      continue;
+    }
+    int updated = decoder_apply(decoder);
+    if (updated >= 0) player = updated;
+    decoder->len -= size;
+    memmove(decoder->buffer, &decoder->buffer[size], decoder->len);
+  }
+}
@@ -0,0 +1,75 @@
+#ifndef PG9021_FRAME_H
+#define PG9021_FRAME_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "pg9021_state.h"
+
+/*
+ * Binary state frames for a downstream microcontroller.
+ *
+ * Every frame: sync 0xa5, kind << 4 | player, sequence, body, CRC-8
+ * (polynomial 0x07, init 0) of everything after the sync byte.
+ *
+ * Full body, fixed size:  buttons (uint32 LE), hat, 4 axes, keys (32
+ *                         bytes, bit per usage of page 0x0007).
+ * Delta body:             changed mask (PG9021_CHANGED_* bits), then in
+ *                         this order the buttons, hat, each changed axis
+ *                         and keys, only the groups in the mask.
+ *
+ * The sequence counts every frame of the stream, all players together,
+ * so a gap means frames were lost. Deltas only apply to the state of the
+ * last full frame of the player, after a gap the receiver waits for the
+ * next full frame. Multi-byte fields are little endian.
+ */
+
+#define PG9021_FRAME_SYNC 0xa5
+#define PG9021_FRAME_HEADER_SIZE 3
+#define PG9021_FRAME_STATE_SIZE 41
+#define PG9021_FRAME_FULL_SIZE \
+  (PG9021_FRAME_HEADER_SIZE + PG9021_FRAME_STATE_SIZE + 1)
+#define PG9021_FRAME_MAX_SIZE (PG9021_FRAME_FULL_SIZE + 1)  // delta of all
+
+typedef enum {
+  PG9021_FRAME_FULL = 1,
+  PG9021_FRAME_DELTA = 2
+} pg9021_frame_kind_t;
+
+// Returns the frame size, PG9021_FRAME_FULL_SIZE
+size_t pg9021_frame_encode_full(uint8_t *buffer, uint8_t player,
+                                uint8_t sequence,
+                                const pg9021_state_t *state);
+
+// Only the groups in changed, returns the frame size
+size_t pg9021_frame_encode_delta(uint8_t *buffer, uint8_t player,
+                                 uint8_t sequence, const pg9021_state_t *state,
+                                 uint32_t changed);
+
+uint8_t pg9021_frame_crc8(const uint8_t *data, size_t len);
+
+typedef struct {
+  uint32_t frames;      // valid CRC
+  uint32_t lost;        // by the sequence numbers
+  uint32_t crc_errors;
+  uint32_t skipped;     // deltas without a full frame before them
+  uint32_t sync_bytes;  // dropped while looking for a frame
+} pg9021_frame_stats_t;
+
+// Stream decoder, byte by byte as they come from the UART
+typedef struct {
+  uint8_t buffer[PG9021_FRAME_MAX_SIZE];
+  uint8_t len;
+  uint8_t sequence;  // of the last frame
+  uint8_t started;   // a frame was decoded, sequence is valid
+  uint8_t valid;     // bit per player, state follows the full frames
+  pg9021_state_t states[PG9021_MAX_PLAYERS];
+  pg9021_frame_stats_t stats;
+} pg9021_frame_decoder_t;
+
+void pg9021_frame_decoder_init(pg9021_frame_decoder_t *decoder);
+
+// Returns the player whose state a complete frame updated, -1 otherwise
+int pg9021_frame_decode(pg9021_frame_decoder_t *decoder, uint8_t byte);
+
+#endif  // PG9021_FRAME_H
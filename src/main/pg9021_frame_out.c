@@ -0,0 +1,181 @@
+#include "pg9021_frame_out.h"
+
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pg9021_pipeline.h"
+#include "pg9021_port.h"
+
+#ifdef ESP_PLATFORM
+#include "driver/uart.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#endif
+
+#define OUT_MASK (PG9021_FRAME_OUT_SIZE - 1)
+#define ALL_PLAYERS ((1 << PG9021_MAX_PLAYERS) - 1)
+
+static uint8_t *out_buffer;  // on the first start, kept from then on
+static atomic_uint out_head;  // producer
+static atomic_uint out_tail;  // flush
+static atomic_int out_running;
+static pg9021_frame_out_sink_t out_sink;
+static pg9021_frame_out_mode_t out_mode;
+
+static uint8_t out_sequence;
+static uint8_t out_full_wanted;  // bit per player
+static uint8_t out_deltas[PG9021_MAX_PLAYERS];
+
+static pg9021_frame_out_stats_t out_stats;
+
+#ifdef ESP_PLATFORM
+static TaskHandle_t out_task_handle;
+#endif
+
+// Producer side, drops the whole frame if it does not fit
+static int PG9021_HOT out_write(const uint8_t *frame, size_t len) {
+  unsigned head = atomic_load_explicit(&out_head, memory_order_relaxed);
+  unsigned tail = atomic_load_explicit(&out_tail, memory_order_acquire);
+
+  if (PG9021_FRAME_OUT_SIZE - (head - tail) < len) return -1;
+
+  size_t offset = head & OUT_MASK;
+  size_t first = PG9021_FRAME_OUT_SIZE - offset;
+  if (first > len) first = len;
+  memcpy(&out_buffer[offset], frame, first);
+  memcpy(out_buffer, frame + first, len - first);
+
+  atomic_store_explicit(&out_head, head + len, memory_order_release);
+  return 0;
+}
+
+void PG9021_HOT pg9021_frame_out_report(uint8_t player,
+                                        const pg9021_state_t *state,
+                                        uint32_t changed) {
+  uint8_t frame[PG9021_FRAME_MAX_SIZE];
+  uint8_t bit = 1 << player;
+  size_t len;
+
+  if (!atomic_load_explicit(&out_running, memory_order_relaxed)) return;
+
+  int full = out_mode == PG9021_FRAME_OUT_FULL || (out_full_wanted & bit) ||
+             out_deltas[player] >= PG9021_FRAME_OUT_KEYFRAME;
+  if (full) {
+    len = pg9021_frame_encode_full(frame, player, out_sequence, state);
+  } else {
+    len = pg9021_frame_encode_delta(frame, player, out_sequence, state,
+                                    changed);
+  }
+  out_sequence++;
+
+  if (out_write(frame, len) != 0) {
+    // The receiver sees the gap, every player starts over
+    out_stats.dropped++;
+    out_full_wanted = ALL_PLAYERS;
+    return;
+  }
+  out_stats.bytes += len;
+  if (full) {
+    out_stats.full++;
+    out_full_wanted &= ~bit;
+    out_deltas[player] = 0;
+  } else {
+    out_stats.delta++;
+    out_deltas[player]++;
+  }
+#ifdef ESP_PLATFORM
+  if (out_task_handle) xTaskNotifyGive(out_task_handle);
+#endif
+}
+
+void pg9021_frame_out_flush(void) {
+  pg9021_frame_out_sink_t sink = out_sink;
+  unsigned tail = atomic_load_explicit(&out_tail, memory_order_relaxed);
+  unsigned head = atomic_load_explicit(&out_head, memory_order_acquire);
+
+  while (sink && tail != head) {
+    size_t offset = tail & OUT_MASK;
+    size_t len = head - tail;
+    if (len > PG9021_FRAME_OUT_SIZE - offset) {
+      len = PG9021_FRAME_OUT_SIZE - offset;
+    }
+    if ((*sink)(&out_buffer[offset], len) != 0) break;  // try again later
+    tail += len;
+    atomic_store_explicit(&out_tail, tail, memory_order_release);
+  }
+}
+
+#ifdef ESP_PLATFORM
+static void out_task(void *arg) {
+  for (;;) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    pg9021_frame_out_flush();
+  }
+}
+#endif
+
+int pg9021_frame_out_start(pg9021_frame_out_sink_t sink,
+                           pg9021_frame_out_mode_t mode) {
+  if (atomic_load(&out_running)) return -1;
+  if (!out_buffer) out_buffer = malloc(PG9021_FRAME_OUT_SIZE);
+  if (!out_buffer) return -1;
+
+  memset(&out_stats, 0, sizeof(out_stats));
+  memset(out_deltas, 0, sizeof(out_deltas));
+  atomic_store(&out_head, 0);
+  atomic_store(&out_tail, 0);
+  out_full_wanted = ALL_PLAYERS;
+  out_mode = mode;
+  out_sink = sink;
+  atomic_store_explicit(&out_running, 1, memory_order_release);
+
+#ifdef ESP_PLATFORM
+  if (!out_task_handle) {
+    pg9021_pipeline_create_task(PG9021_STAGE_OUTPUT, out_task,
+                                "frame_out_task", 2048, &out_task_handle);
+  }
+#endif
+  return 0;
+}
+
+// Frames in the ring still go out on the next flush
+void pg9021_frame_out_stop(void) {
+  atomic_store_explicit(&out_running, 0, memory_order_release);
+}
+
+void pg9021_frame_out_get_stats(pg9021_frame_out_stats_t *stats) {
+  *stats = out_stats;
+}
+
+#ifdef ESP_PLATFORM
+static int out_uart_port = -1;
+
+// Blocks while the driver's TX ring is full, the ISR feeds the FIFO
+static int uart_sink(const uint8_t *data, size_t len) {
+  int written = uart_write_bytes(out_uart_port, (const char *)data, len);
+  return written == (int)len ? 0 : -1;
+}
+
+int pg9021_frame_out_start_uart(int port, int tx_pin, int baud_rate,
+                                pg9021_frame_out_mode_t mode) {
+  if (out_uart_port < 0) {
+    uart_config_t config = {
+        .baud_rate = baud_rate,
+        .data_bits = UART_DATA_8_BITS,
+        .parity = UART_PARITY_DISABLE,
+        .stop_bits = UART_STOP_BITS_1,
+        .flow_ctrl = UART_HW_FLOWCTRL_DISABLE,
+    };
+    if (uart_param_config(port, &config) != ESP_OK ||
+        uart_set_pin(port, tx_pin, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE,
+                     UART_PIN_NO_CHANGE) != ESP_OK ||
+        uart_driver_install(port, 256, PG9021_FRAME_OUT_SIZE / 2, 0, NULL,
+                            0) != ESP_OK) {
+      return -1;
+    }
+    out_uart_port = port;
+  }
+  return pg9021_frame_out_start(&uart_sink, mode);
+}
+#endif
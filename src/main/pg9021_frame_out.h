@@ -0,0 +1,65 @@
+#ifndef PG9021_FRAME_OUT_H
+#define PG9021_FRAME_OUT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "pg9021_frame.h"
+#include "pg9021_state.h"
+
+/*
+ * State frames (pg9021_frame.h) for a downstream microcontroller. Frames
+ * are encoded on the BTstack run loop into a RAM ring and written to the
+ * sink by a task, so a slow UART never blocks the input path. A frame that
+ * does not fit is dropped, its sequence number is skipped so the receiver
+ * sees the gap, and the next frame of every player is a full one.
+ */
+
+#ifndef PG9021_FRAME_OUT_SIZE
+#define PG9021_FRAME_OUT_SIZE 4096  // bytes, power of two
+#endif
+
+// Delta mode: a full frame after this many deltas of a player, so a
+// receiver that started late or lost frames catches up
+#ifndef PG9021_FRAME_OUT_KEYFRAME
+#define PG9021_FRAME_OUT_KEYFRAME 64
+#endif
+
+typedef enum {
+  PG9021_FRAME_OUT_FULL,  // a full frame on every change
+  PG9021_FRAME_OUT_DELTA  // the changed fields only
+} pg9021_frame_out_mode_t;
+
+// Writes frames, returns 0 on success
+typedef int (*pg9021_frame_out_sink_t)(const uint8_t *data, size_t len);
+
+typedef struct {
+  uint32_t full;
+  uint32_t delta;
+  uint32_t bytes;    // encoded
+  uint32_t dropped;  // frames that did not fit into the ring
+} pg9021_frame_out_stats_t;
+
+// Returns -1 if the output is running or there is no memory for the ring,
+// which is allocated on the first start. Call from the BTstack run loop.
+int pg9021_frame_out_start(pg9021_frame_out_sink_t sink,
+                           pg9021_frame_out_mode_t mode);
+void pg9021_frame_out_stop(void);
+
+// From the report callback, BTstack run loop
+void pg9021_frame_out_report(uint8_t player, const pg9021_state_t *state,
+                             uint32_t changed);
+
+// Write everything buffered to the sink. Called by the output task on the
+// ESP32, by the application elsewhere.
+void pg9021_frame_out_flush(void);
+
+void pg9021_frame_out_get_stats(pg9021_frame_out_stats_t *stats);
+
+#ifdef ESP_PLATFORM
+// A UART that is not the console, TX only
+int pg9021_frame_out_start_uart(int port, int tx_pin, int baud_rate,
+                                pg9021_frame_out_mode_t mode);
+#endif
+
+#endif  // PG9021_FRAME_OUT_H
@@ -0,0 +1,112 @@
+#include "pg9021_latency.h"
+
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+
+#define SUB_BUCKET_BITS 2
+#define SUB_BUCKETS (1 << SUB_BUCKET_BITS)
+
+static pg9021_histogram_t latency_histograms[PG9021_LATENCY_STAGES];
+static atomic_int latency_reset_requested;
+
+static const char *const stage_names[PG9021_LATENCY_STAGES] = {
+    [PG9021_LATENCY_DECODE] = "decode",
+    [PG9021_LATENCY_CALLBACK] = "callback",
+    [PG9021_LATENCY_TOTAL] = "total",
+};
+
+// Values below SUB_BUCKETS have a bucket each, above that every power of two
+// is split into SUB_BUCKETS linear buckets
+static unsigned PG9021_HOT bucket_index(uint32_t value) {
+  if (value < SUB_BUCKETS) return value;
+  int msb = 31 - __builtin_clz(value);
+  return (msb - SUB_BUCKET_BITS + 1) * SUB_BUCKETS +
+         ((value >> (msb - SUB_BUCKET_BITS)) & (SUB_BUCKETS - 1));
+}
+
+static uint64_t bucket_lower(unsigned index) {
+  if (index < SUB_BUCKETS) return index;
+  unsigned shift = index / SUB_BUCKETS - 1;
+  return (uint64_t)(SUB_BUCKETS + index % SUB_BUCKETS) << shift;
+}
+
+void PG9021_HOT pg9021_histogram_add(pg9021_histogram_t *histogram,
+                                     uint32_t value) {
+  histogram->buckets[bucket_index(value)]++;
+  histogram->count++;
+  if (value > histogram->max) histogram->max = value;
+}
+
+uint32_t pg9021_histogram_percentile(const pg9021_histogram_t *histogram,
+                                     unsigned permille) {
+  if (!histogram->count) return 0;
+
+  uint64_t rank = ((uint64_t)histogram->count * permille + 999) / 1000;
+  uint64_t seen = 0;
+  for (unsigned i = 0; i < PG9021_HISTOGRAM_BUCKETS; ++i) {
+    seen += histogram->buckets[i];
+    if (seen >= rank && seen) {
+      uint64_t upper = bucket_lower(i + 1) - 1;
+      return upper < histogram->max ? (uint32_t)upper : histogram->max;
+    }
+  }
+  return histogram->max;
+}
+
+void PG9021_HOT pg9021_latency_add(pg9021_latency_stage_t stage,
+                                   uint32_t ticks) {
+  if (atomic_load_explicit(&latency_reset_requested, memory_order_relaxed)) {
+    atomic_store_explicit(&latency_reset_requested, 0, memory_order_relaxed);
+    memset(latency_histograms, 0, sizeof(latency_histograms));
+  }
+  pg9021_histogram_add(&latency_histograms[stage], ticks);
+}
+
+void pg9021_latency_get(pg9021_latency_stage_t stage,
+                        pg9021_histogram_t *histogram) {
+  if (atomic_load_explicit(&latency_reset_requested, memory_order_relaxed)) {
+    memset(histogram, 0, sizeof(*histogram));
+  } else {
+    *histogram = latency_histograms[stage];
+  }
+}
+
+void pg9021_latency_reset(void) {
+  atomic_store_explicit(&latency_reset_requested, 1, memory_order_relaxed);
+}
+
+void pg9021_latency_save(pg9021_histogram_t histograms[PG9021_LATENCY_STAGES]) {
+  for (int i = 0; i < PG9021_LATENCY_STAGES; ++i) {
+    pg9021_latency_get((pg9021_latency_stage_t)i, &histograms[i]);
+  }
+}
+
+void pg9021_latency_restore(
+    const pg9021_histogram_t histograms[PG9021_LATENCY_STAGES]) {
+  memcpy(latency_histograms, histograms, sizeof(latency_histograms));
+}
+
+const char *pg9021_latency_stage_name(pg9021_latency_stage_t stage) {
+  return stage_names[stage];
+}
+
+static void print_ticks(const char *label, uint32_t ticks) {
+  uint64_t ns = (uint64_t)ticks * 1000 / PG9021_LATENCY_TICKS_PER_US;
+  printf(" %s %" PRIu64 ".%03" PRIu64, label, ns / 1000, ns % 1000);
+}
+
+void pg9021_latency_print(void) {
+  pg9021_histogram_t histogram;
+
+  printf("Latency (us):\n");
+  for (int i = 0; i < PG9021_LATENCY_STAGES; ++i) {
+    pg9021_latency_get(i, &histogram);
+    printf("%-9s count %" PRIu32, stage_names[i], histogram.count);
+    print_ticks("p50", pg9021_histogram_percentile(&histogram, 500));
+    print_ticks("p99", pg9021_histogram_percentile(&histogram, 990));
+    print_ticks("max", histogram.max);
+    printf("\n");
+  }
+}
@@ -0,0 +1,76 @@
+#ifndef PG9021_LATENCY_H
+#define PG9021_LATENCY_H
+
+#include <stdint.h>
+
+#include "pg9021_port.h"
+
+/*
+ * Input latency per stage of an interrupt report, in pg9021_latency_now()
+ * ticks. Each stage feeds a log-linear histogram, 4 buckets per power of
+ * two, so percentiles are accurate to 25% whatever the range.
+ */
+
+// Set to 0 to compile the timestamps out of the input path
+#ifndef PG9021_LATENCY
+#define PG9021_LATENCY 1
+#endif
+
+// CCOUNT counts at the current CPU frequency. With DFS a report that wakes
+// an idle pad is stamped at the minimum frequency and would be converted at
+// the maximum one, so the timestamps come from the microsecond timer.
+#if defined(ESP_PLATFORM) && defined(CONFIG_PM_ENABLE)
+#define PG9021_LATENCY_TICKS_PER_US 1
+static inline uint32_t pg9021_latency_now(void) {
+  return (uint32_t)pg9021_port_time_us();
+}
+#else
+#define PG9021_LATENCY_TICKS_PER_US PG9021_PORT_TICKS_PER_US
+static inline uint32_t pg9021_latency_now(void) {
+  return pg9021_port_ticks();
+}
+#endif
+
+typedef enum {
+  PG9021_LATENCY_DECODE,    // L2CAP data packet to decoded state
+  PG9021_LATENCY_CALLBACK,  // the report callback
+  PG9021_LATENCY_TOTAL,     // L2CAP data packet to callback returned
+  PG9021_LATENCY_STAGES
+} pg9021_latency_stage_t;
+
+#define PG9021_HISTOGRAM_BUCKETS 128
+
+typedef struct {
+  uint32_t count;
+  uint32_t max;
+  uint32_t buckets[PG9021_HISTOGRAM_BUCKETS];
+} pg9021_histogram_t;
+
+void pg9021_histogram_add(pg9021_histogram_t *histogram, uint32_t value);
+
+// Upper bound of the bucket holding the given permille, 0 if empty
+uint32_t pg9021_histogram_percentile(const pg9021_histogram_t *histogram,
+                                     unsigned permille);
+
+// BTstack run loop
+void pg9021_latency_add(pg9021_latency_stage_t stage, uint32_t ticks);
+
+// Any task, the copy may be a few reports apart between stages
+void pg9021_latency_get(pg9021_latency_stage_t stage,
+                        pg9021_histogram_t *histogram);
+
+// Any task, the histograms are cleared before the next report is added
+void pg9021_latency_reset(void);
+
+// BTstack run loop, keeps benchmark reports out of the histograms. A reset
+// requested in between still applies.
+void pg9021_latency_save(pg9021_histogram_t histograms[PG9021_LATENCY_STAGES]);
+void pg9021_latency_restore(
+    const pg9021_histogram_t histograms[PG9021_LATENCY_STAGES]);
+
+const char *pg9021_latency_stage_name(pg9021_latency_stage_t stage);
+
+// count, p50, p99 and max per stage in microseconds
+void pg9021_latency_print(void);
+
+#endif  // PG9021_LATENCY_H
@@ -0,0 +1,208 @@
+#include "pg9021_layout.h"
+
+#include <string.h>
+
+#include "pg9021_mapping.h"
+#include "pg9021_port.h"
+
+#define KEYBOARD_MODIFIER_FIRST 0xe0
+#define KEYBOARD_MODIFIER_COUNT 8
+
+// Registry of known layouts, first match wins
+static const pg9021_layout_t PG9021_HOT_DATA layouts[] = {
+    {
+        .name = "PG-9021 gamepad",
+        .kind = PG9021_LAYOUT_GAMEPAD,
+        .min_buttons = GP_BUTTON_THUMB_R,
+        .axis_usages = {GP_THUMB_L_X, GP_THUMB_L_Y, GP_THUMB_R_X,
+                        GP_THUMB_R_Y},
+        .misc_count = 6,
+        .misc_usages = {MISC_BUTTON_HOME, MISC_BUTTON_MINUS, MISC_BUTTON_PREV,
+                        MISC_BUTTON_PLAY, MISC_BUTTON_NEXT, MISC_BUTTON_PLUS},
+    },
+    {
+        .name = "PG-9021 keyboard",
+        .kind = PG9021_LAYOUT_KEYBOARD,
+    },
+};
+
+static const int layouts_count = sizeof(layouts) / sizeof(layouts[0]);
+
+static uint32_t fnv1a(uint32_t hash, uint32_t value, int bytes) {
+  for (int i = 0; i < bytes; ++i) {
+    hash ^= (value >> (8 * i)) & 0xff;
+    hash *= 16777619UL;
+  }
+  return hash;
+}
+
+uint32_t pg9021_layout_fingerprint(const pg9021_report_table_t *table) {
+  uint32_t hash = 2166136261UL;
+  for (int r = 0; r < table->report_count; ++r) {
+    const pg9021_report_t *report = &table->reports[r];
+    hash = fnv1a(hash, report->report_id, 1);
+    hash = fnv1a(hash, report->bit_length, 2);
+    for (int i = 0; i < report->field_count; ++i) {
+      const pg9021_field_t *field = &table->fields[report->first_field + i];
+      hash = fnv1a(hash, field->bit_offset, 2);
+      hash = fnv1a(hash, field->bit_size, 1);
+      hash = fnv1a(hash, field->flags, 1);
+      hash = fnv1a(hash, field->usage_page, 2);
+      hash = fnv1a(hash, field->usage, 2);
+    }
+  }
+  return hash;
+}
+
+static int bind_gamepad(const pg9021_layout_t *layout,
+                        const pg9021_report_table_t *table,
+                        const pg9021_report_t *report,
+                        pg9021_layout_binding_t *binding) {
+  uint8_t axes_found = 0;
+  uint8_t misc_found = 0;
+  int hat_found = 0;
+
+  for (int i = 0; i < report->field_count; ++i) {
+    const pg9021_field_t *field = &table->fields[report->first_field + i];
+    if (field->flags) return -1;
+
+    if (field->usage_page == PAGE_GAMEPAD_BUTTONS && field->bit_size == 1) {
+      if (field->usage < 1 || field->usage > 32) return -1;
+      if (binding->button_count == 0 && field->usage == 1) {
+        binding->buttons_bit = field->bit_offset;
+      }
+      // Buttons 1..n in order, one bit each, without gaps
+      if (field->usage != binding->button_count + 1 ||
+          field->bit_offset != binding->buttons_bit + binding->button_count) {
+        return -1;
+      }
+      binding->button_count++;
+      continue;
+    }
+
+    if (field->usage_page == PAGE_GAMEPAD_DPAD_THUMB) {
+      if (field->usage == GP_USAGE_DPAD && field->bit_size == 4 && !hat_found) {
+        binding->hat_bit = field->bit_offset;
+        hat_found = 1;
+        continue;
+      }
+      int axis = -1;
+      for (int a = 0; a < PG9021_LAYOUT_AXES; ++a) {
+        if (layout->axis_usages[a] == field->usage) axis = a;
+      }
+      if (axis < 0 || field->bit_size != 8 || (field->bit_offset & 7) ||
+          (axes_found & (1 << axis))) {
+        return -1;
+      }
+      binding->axis_byte[axis] = (uint8_t)(field->bit_offset >> 3);
+      axes_found |= 1 << axis;
+      continue;
+    }
+
+    if (field->usage_page == PAGE_MISC_ADDITIONAL_BUTTONS &&
+        field->bit_size == 1) {
+      int misc = -1;
+      for (int m = 0; m < layout->misc_count; ++m) {
+        if (layout->misc_usages[m] == field->usage) misc = m;
+      }
+      if (misc < 0 || (misc_found & (1 << misc))) return -1;
+      binding->misc_bit[misc] = field->bit_offset;
+      misc_found |= 1 << misc;
+      continue;
+    }
+
+    return -1;
+  }
+
+  if (!hat_found || axes_found != (1 << PG9021_LAYOUT_AXES) - 1 ||
+      binding->button_count < layout->min_buttons) {
+    return -1;
+  }
+
+  // Misc buttons are either all in this report or in another one
+  if (misc_found == (1 << layout->misc_count) - 1) {
+    binding->misc_count = layout->misc_count;
+  } else if (misc_found != 0) {
+    return -1;
+  }
+  return 0;
+}
+
+static int bind_keyboard(const pg9021_report_table_t *table,
+                         const pg9021_report_t *report,
+                         pg9021_layout_binding_t *binding) {
+  uint8_t modifiers_found = 0;
+
+  for (int i = 0; i < report->field_count; ++i) {
+    const pg9021_field_t *field = &table->fields[report->first_field + i];
+    if (field->usage_page != PAGE_KEYBOARD_BUTTONS) return -1;
+
+    if (field->flags == PG9021_FIELD_ARRAY) {
+      if (field->bit_size != 8 || (field->bit_offset & 7) ||
+          field->usage != 0 || binding->key_count >= PG9021_LAYOUT_MAX_KEYS) {
+        return -1;
+      }
+      if (binding->key_count == 0) {
+        binding->keys_byte = (uint8_t)(field->bit_offset >> 3);
+      } else if (field->bit_offset >> 3 !=
+                 binding->keys_byte + binding->key_count) {
+        return -1;
+      }
+      binding->key_count++;
+      continue;
+    }
+
+    // Modifiers: usages 0xe0..0xe7 as the bits of one byte
+    uint16_t bit = field->usage - KEYBOARD_MODIFIER_FIRST;
+    if (field->flags || field->bit_size != 1 ||
+        bit != modifiers_found || bit >= KEYBOARD_MODIFIER_COUNT) {
+      return -1;
+    }
+    if (bit == 0) {
+      if (field->bit_offset & 7) return -1;
+      binding->modifiers_byte = (uint8_t)(field->bit_offset >> 3);
+    } else if (field->bit_offset != binding->modifiers_byte * 8 + bit) {
+      return -1;
+    }
+    modifiers_found++;
+  }
+
+  if (binding->key_count == 0) return -1;
+  if (modifiers_found != 0 && modifiers_found != KEYBOARD_MODIFIER_COUNT) {
+    return -1;
+  }
+  binding->has_modifiers = modifiers_found != 0;
+  return 0;
+}
+
+int pg9021_layout_bind(const pg9021_report_table_t *table,
+                       pg9021_layout_binding_t *binding) {
+  uint32_t fingerprint = pg9021_layout_fingerprint(table);
+
+  for (int l = 0; l < layouts_count; ++l) {
+    const pg9021_layout_t *layout = &layouts[l];
+    if (layout->fingerprint && layout->fingerprint != fingerprint) continue;
+
+    for (int r = 0; r < table->report_count; ++r) {
+      const pg9021_report_t *report = &table->reports[r];
+      int status;
+
+      memset(binding, 0, sizeof(*binding));
+      if (layout->kind == PG9021_LAYOUT_GAMEPAD) {
+        status = bind_gamepad(layout, table, report, binding);
+      } else {
+        status = bind_keyboard(table, report, binding);
+      }
+
+      if (status == 0) {
+        binding->layout = layout;
+        binding->report_id = report->report_id;
+        binding->report_len = (uint16_t)((report->bit_length + 7) >> 3);
+        return 0;
+      }
+    }
+  }
+
+  memset(binding, 0, sizeof(*binding));
+  return -1;
+}
@@ -0,0 +1,101 @@
+#ifndef PG9021_LAYOUT_H
+#define PG9021_LAYOUT_H
+
+#include <stdint.h>
+
+#include "pg9021_report.h"
+
+#define PG9021_LAYOUT_AXES 4
+#define PG9021_LAYOUT_MAX_MISC 8
+#define PG9021_LAYOUT_MAX_KEYS 8
+
+typedef enum {
+  PG9021_LAYOUT_GAMEPAD,
+  PG9021_LAYOUT_KEYBOARD
+} pg9021_layout_kind_t;
+
+/*
+ * Known controller report layout, see the registry in pg9021_layout.c.
+ *
+ * A layout matches a compiled report when every field of the report is one
+ * the layout decodes:
+ *   gamepad  - button usages 1..n as contiguous bits, a 4 bit hat, byte
+ *              aligned axes and optionally all misc usages as single bits
+ *   keyboard - optional modifier byte and a byte aligned key code array
+ * Set fingerprint to pin a layout to one exact descriptor.
+ */
+typedef struct {
+  const char *name;
+  pg9021_layout_kind_t kind;
+  uint32_t fingerprint;  // 0 - match by fields only
+  uint8_t min_buttons;
+  uint16_t axis_usages[PG9021_LAYOUT_AXES];
+  uint8_t misc_count;
+  uint16_t misc_usages[PG9021_LAYOUT_MAX_MISC];
+} pg9021_layout_t;
+
+// Fixed offsets of a matched layout, bits and bytes after the report ID
+typedef struct {
+  const pg9021_layout_t *layout;
+  uint8_t report_id;
+  uint16_t report_len;  // minimum report length in bytes
+
+  // Gamepad
+  uint16_t buttons_bit;
+  uint8_t button_count;
+  uint16_t hat_bit;
+  uint8_t axis_byte[PG9021_LAYOUT_AXES];
+  uint16_t misc_bit[PG9021_LAYOUT_MAX_MISC];
+  uint8_t misc_count;
+
+  // Keyboard
+  uint8_t has_modifiers;
+  uint8_t modifiers_byte;
+  uint8_t keys_byte;
+  uint8_t key_count;
+} pg9021_layout_binding_t;
+
+// Raw values of one report decoded through a binding
+typedef struct {
+  uint32_t buttons;  // bit 0 - button usage 1
+  uint8_t misc;      // bit n - misc_usages[n]
+  uint8_t hat;
+  uint8_t axes[PG9021_LAYOUT_AXES];
+  uint8_t modifiers;
+  uint8_t keys[PG9021_LAYOUT_MAX_KEYS];
+} pg9021_layout_values_t;
+
+// FNV-1a over the compiled fields, printed to pin new layouts
+uint32_t pg9021_layout_fingerprint(const pg9021_report_table_t *table);
+
+// Match the compiled descriptor against the registry. Returns 0 on match.
+int pg9021_layout_bind(const pg9021_report_table_t *table,
+                       pg9021_layout_binding_t *binding);
+
+static inline void pg9021_layout_decode_gamepad(
+    const pg9021_layout_binding_t *binding, const uint8_t *report,
+    pg9021_layout_values_t *values) {
+  values->buttons = pg9021_report_get_bits(report, binding->buttons_bit,
+                                           binding->button_count);
+  values->hat = (uint8_t)pg9021_report_get_bits(report, binding->hat_bit, 4);
+  for (int i = 0; i < PG9021_LAYOUT_AXES; ++i) {
+    values->axes[i] = report[binding->axis_byte[i]];
+  }
+  values->misc = 0;
+  for (int i = 0; i < binding->misc_count; ++i) {
+    uint16_t bit = binding->misc_bit[i];
+    values->misc |= ((report[bit >> 3] >> (bit & 7)) & 1) << i;
+  }
+}
+
+static inline void pg9021_layout_decode_keyboard(
+    const pg9021_layout_binding_t *binding, const uint8_t *report,
+    pg9021_layout_values_t *values) {
+  values->modifiers =
+      binding->has_modifiers ? report[binding->modifiers_byte] : 0;
+  for (int i = 0; i < binding->key_count; ++i) {
+    values->keys[i] = report[binding->keys_byte + i];
+  }
+}
+
+#endif  // PG9021_LAYOUT_H
@@ -0,0 +1,147 @@
+#include "pg9021_log.h"
+
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdio.h>
+
+#include "pg9021_pipeline.h"
+#include "pg9021_port.h"
+
+#ifdef ESP_PLATFORM
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#endif
+
+#define LOG_MASK (PG9021_LOG_SIZE - 1)
+
+// sequence is index + 1 once the record at index is complete, 0 while written
+typedef struct {
+  atomic_uint sequence;
+  pg9021_log_record_t record;
+} log_slot_t;
+
+static log_slot_t log_slots[PG9021_LOG_SIZE];
+static atomic_uint log_head;
+static unsigned log_tail;  // reader only
+static uint32_t log_lost;
+
+void PG9021_HOT pg9021_log_write(uint8_t level, pg9021_log_format_t format,
+                                 uint8_t player, const char *text,
+                                 uint16_t page, uint16_t usage, int32_t value) {
+  unsigned index =
+      atomic_fetch_add_explicit(&log_head, 1, memory_order_relaxed);
+  log_slot_t *slot = &log_slots[index & LOG_MASK];
+
+  atomic_store_explicit(&slot->sequence, 0, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+
+  slot->record.timestamp = (uint32_t)pg9021_port_time_us();
+  slot->record.text = text;
+  slot->record.level = level;
+  slot->record.format = (uint8_t)format;
+  slot->record.player = player;
+  slot->record.page = page;
+  slot->record.usage = usage;
+  slot->record.value = value;
+
+  atomic_store_explicit(&slot->sequence, index + 1, memory_order_release);
+}
+
+int pg9021_log_read(pg9021_log_record_t *record) {
+  for (;;) {
+    unsigned head = atomic_load_explicit(&log_head, memory_order_acquire);
+    if (log_tail == head) return 0;
+
+    // Writers lapped the reader
+    if (head - log_tail > PG9021_LOG_SIZE) {
+      log_lost += head - PG9021_LOG_SIZE - log_tail;
+      log_tail = head - PG9021_LOG_SIZE;
+    }
+
+    log_slot_t *slot = &log_slots[log_tail & LOG_MASK];
+    unsigned sequence =
+        atomic_load_explicit(&slot->sequence, memory_order_acquire);
+
+    // Still being written, read it next time
+    if (sequence == 0 || (int)(sequence - (log_tail + 1)) < 0) return 0;
+
+    if (sequence == log_tail + 1) {
+      *record = slot->record;
+      atomic_thread_fence(memory_order_acquire);
+      if (atomic_load_explicit(&slot->sequence, memory_order_relaxed) ==
+          sequence) {
+        log_tail++;
+        return 1;
+      }
+    }
+
+    // Overwritten while it was read
+    log_lost++;
+    log_tail++;
+  }
+}
+
+uint32_t pg9021_log_lost(void) { return log_lost; }
+
+// Lines start with the player number, "[1] " for player 0
+int pg9021_log_format(const pg9021_log_record_t *record, char *buffer,
+                      size_t size) {
+  unsigned player = record->player + 1;
+
+  switch (record->format) {
+    case PG9021_LOG_BUTTON:
+      if (record->value == 0) {
+        return snprintf(buffer, size, "[%u] %s released\n", player,
+                        record->text);
+      }
+      if (record->value == 1) {
+        return snprintf(buffer, size, "[%u] %s pressed", player,
+                        record->text);
+      }
+      buffer[0] = '\0';
+      return 0;
+
+    case PG9021_LOG_VALUE:
+      return snprintf(buffer, size, "[%u] %s %" PRId32, player, record->text,
+                      record->value);
+
+    default:
+      return snprintf(buffer, size,
+                      "[%u] %s: page 0x%04x, usage 0x%04x, value=%" PRId32,
+                      player, record->text, record->page, record->usage,
+                      record->value);
+  }
+}
+
+void pg9021_log_flush(void) {
+  pg9021_log_record_t record;
+  char line[96];
+  uint32_t lost = log_lost;
+
+  while (pg9021_log_read(&record)) {
+    if (log_lost != lost) {
+      printf("%" PRIu32 " log records lost\n", log_lost - lost);
+      lost = log_lost;
+    }
+    if (pg9021_log_format(&record, line, sizeof(line)) > 0) {
+      printf("%s\n", line);
+    }
+  }
+  fflush(stdout);
+}
+
+#ifdef ESP_PLATFORM
+static void log_task(void *arg) {
+  for (;;) {
+    pg9021_log_flush();
+    vTaskDelay(pdMS_TO_TICKS(PG9021_LOG_FLUSH_MS));
+  }
+}
+
+void pg9021_log_start_task(void) {
+  pg9021_pipeline_create_task(PG9021_STAGE_BACKGROUND, log_task, "log_task",
+                              3072, NULL);
+}
+#else
+void pg9021_log_start_task(void) {}
+#endif
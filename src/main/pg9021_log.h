@@ -0,0 +1,96 @@
+#ifndef PG9021_LOG_H
+#define PG9021_LOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define PG9021_LOG_LEVEL_NONE 0
+#define PG9021_LOG_LEVEL_ERROR 1
+#define PG9021_LOG_LEVEL_WARN 2
+#define PG9021_LOG_LEVEL_INFO 3
+#define PG9021_LOG_LEVEL_DEBUG 4
+
+// Log sites above this level are not compiled
+#ifndef PG9021_LOG_LEVEL
+#define PG9021_LOG_LEVEL PG9021_LOG_LEVEL_INFO
+#endif
+
+#ifndef PG9021_LOG_SIZE
+#define PG9021_LOG_SIZE 128  // records, power of two
+#endif
+
+#ifndef PG9021_LOG_FLUSH_MS
+#define PG9021_LOG_FLUSH_MS 20
+#endif
+
+// How a record is turned into text
+typedef enum {
+  PG9021_LOG_BUTTON,  // "<text> pressed" / "<text> released"
+  PG9021_LOG_VALUE,   // "<text> <value>"
+  PG9021_LOG_USAGE    // "<text>: page 0x.., usage 0x.., value=.."
+} pg9021_log_format_t;
+
+/*
+ * One log record, 20 bytes on the ESP32. Nothing is formatted when it is
+ * written, text must be a string literal.
+ */
+typedef struct {
+  uint32_t timestamp;  // microseconds since boot
+  const char *text;
+  uint8_t level;
+  uint8_t format;  // pg9021_log_format_t
+  uint8_t player;
+  uint16_t page;  // vendor pages too, fits in the padding after player
+  uint16_t usage;
+  int32_t value;
+} pg9021_log_record_t;
+
+// Any task, never blocks. The oldest records are overwritten when full.
+void pg9021_log_write(uint8_t level, pg9021_log_format_t format,
+                      uint8_t player, const char *text, uint16_t page,
+                      uint16_t usage, int32_t value);
+
+// Oldest unread record, returns 0 if there is none. One reader only.
+int pg9021_log_read(pg9021_log_record_t *record);
+
+// Records overwritten before they were read
+uint32_t pg9021_log_lost(void);
+
+int pg9021_log_format(const pg9021_log_record_t *record, char *buffer,
+                      size_t size);
+
+// Print every unread record to stdout
+void pg9021_log_flush(void);
+
+// Low priority task calling pg9021_log_flush() every PG9021_LOG_FLUSH_MS
+void pg9021_log_start_task(void);
+
+#define PG9021_LOG(level, format, player, text, page, usage, value)      \
+  pg9021_log_write(PG9021_LOG_LEVEL_##level, format, player, text, page, \
+                   usage, value)
+
+#if PG9021_LOG_LEVEL >= PG9021_LOG_LEVEL_ERROR
+#define PG9021_LOGE(...) PG9021_LOG(ERROR, __VA_ARGS__)
+#else
+#define PG9021_LOGE(...) ((void)0)
+#endif
+
+#if PG9021_LOG_LEVEL >= PG9021_LOG_LEVEL_WARN
+#define PG9021_LOGW(...) PG9021_LOG(WARN, __VA_ARGS__)
+#else
+#define PG9021_LOGW(...) ((void)0)
+#endif
+
+#if PG9021_LOG_LEVEL >= PG9021_LOG_LEVEL_INFO
+#define PG9021_LOGI(...) PG9021_LOG(INFO, __VA_ARGS__)
+#else
+#define PG9021_LOGI(...) ((void)0)
+#endif
+
+#if PG9021_LOG_LEVEL >= PG9021_LOG_LEVEL_DEBUG
+#define PG9021_LOGD(...) PG9021_LOG(DEBUG, __VA_ARGS__)
+#else
+#define PG9021_LOGD(...) ((void)0)
+#endif
+
+#endif  // PG9021_LOG_H
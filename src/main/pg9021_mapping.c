@@ -0,0 +1,23 @@
+#include "pg9021_mapping.h"
+
+#include "pg9021_port.h"
+
+_Static_assert(PG9021_EVENT_COUNT <= 256, "event IDs must fit in one byte");
+
+// A usage listed twice would silently replace the first entry
+#define EVENT_MAP_ENTRY(page, usage, event)             \
+  [PG9021_EVENT_PAGE_SLOT(page)][(usage) & 0xff] =      \
+      (uint16_t)(PG9021_EVENT_##event | ((usage) & 0xff00)),
+
+#define EVENT_NAME(event, analog) [PG9021_EVENT_##event] = #event,
+#define EVENT_ANALOG(event, analog) [PG9021_EVENT_##event] = analog,
+
+const uint16_t PG9021_HOT_DATA pg9021_event_map[PG9021_EVENT_PAGES][256] = {
+    PG9021_USAGE_LIST(EVENT_MAP_ENTRY)};
+
+// Only the pointer is read per event, the log task dereferences it later
+const char *const PG9021_HOT_DATA pg9021_event_names[PG9021_EVENT_COUNT] = {
+    [PG9021_EVENT_NONE] = "NONE", PG9021_EVENT_LIST(EVENT_NAME)};
+
+const uint8_t PG9021_HOT_DATA pg9021_event_analog[PG9021_EVENT_COUNT] = {
+    PG9021_EVENT_LIST(EVENT_ANALOG)};
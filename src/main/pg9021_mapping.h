@@ -1,7 +1,10 @@
 #ifndef PG9021_MAPPING_H
 #define PG9021_MAPPING_H
 
-typedef void (*gamepad_handler_t)(uint16_t page, uint16_t event, int32_t value);
+#include <stdint.h>
+
+typedef void (*gamepad_handler_t)(uint8_t player, uint16_t page,
+                                  uint16_t event, int32_t value);
 
 // Pages
 enum {
@@ -114,4 +117,144 @@ enum {  // Page - 0x0001, value 0-255, (0x7f) 127 - center (thumb released)
 
 enum { GP_USAGE_DPAD = 0x0039, GP_THUMB_RELEASED = 0x7f };
 
+/*
+ * CANONICAL EVENTS
+ *
+ * Keyboard and gamepad mode report the same controls with different pages
+ * and usages. Every (page, usage) above resolves to one canonical event.
+ */
+
+// X(event, analog)
+#define PG9021_EVENT_LIST(X) \
+  X(DPAD_UP, 0)              \
+  X(DPAD_DOWN, 0)            \
+  X(DPAD_RIGHT, 0)           \
+  X(DPAD_LEFT, 0)            \
+  X(BUTTON_A, 0)             \
+  X(BUTTON_B, 0)             \
+  X(BUTTON_C, 0)             \
+  X(BUTTON_X, 0)             \
+  X(BUTTON_Y, 0)             \
+  X(BUTTON_Z, 0)             \
+  X(BUTTON_SHOULDER_L, 0)    \
+  X(BUTTON_SHOULDER_R, 0)    \
+  X(BUTTON_TRIGGER_L, 0)     \
+  X(BUTTON_TRIGGER_R, 0)     \
+  X(BUTTON_UNKNOWN, 1)       \
+  X(BUTTON_THUMB_L, 0)       \
+  X(BUTTON_THUMB_R, 0)       \
+  X(MISC_BUTTON_START, 0)    \
+  X(MISC_BUTTON_SELECT, 0)   \
+  X(THUMB_L_UP, 0)           \
+  X(THUMB_L_DOWN, 0)         \
+  X(THUMB_L_RIGHT, 0)        \
+  X(THUMB_L_LEFT, 0)         \
+  X(THUMB_R_UP, 0)           \
+  X(THUMB_R_DOWN, 0)         \
+  X(THUMB_R_RIGHT, 0)        \
+  X(THUMB_R_LEFT, 0)         \
+  X(THUMB_L_X, 1)            \
+  X(THUMB_L_Y, 1)            \
+  X(THUMB_R_X, 1)            \
+  X(THUMB_R_Y, 1)            \
+  X(MISC_BUTTON_HOME, 0)     \
+  X(MISC_BUTTON_MINUS, 0)    \
+  X(MISC_BUTTON_PREV, 0)     \
+  X(MISC_BUTTON_PLAY, 0)     \
+  X(MISC_BUTTON_NEXT, 0)     \
+  X(MISC_BUTTON_PLUS, 0)
+
+// X(page, usage, event)
+#define PG9021_USAGE_LIST(X)                                               \
+  X(PAGE_KEYBOARD_BUTTONS, KB_DPAD_UP, DPAD_UP)                            \
+  X(PAGE_KEYBOARD_BUTTONS, KB_DPAD_DOWN, DPAD_DOWN)                        \
+  X(PAGE_KEYBOARD_BUTTONS, KB_DPAD_RIGHT, DPAD_RIGHT)                      \
+  X(PAGE_KEYBOARD_BUTTONS, KB_DPAD_LEFT, DPAD_LEFT)                        \
+  X(PAGE_KEYBOARD_BUTTONS, KB_BUTTON_A, BUTTON_A)                          \
+  X(PAGE_KEYBOARD_BUTTONS, KB_BUTTON_B, BUTTON_B)                          \
+  X(PAGE_KEYBOARD_BUTTONS, KB_BUTTON_X, BUTTON_X)                          \
+  X(PAGE_KEYBOARD_BUTTONS, KB_BUTTON_Y, BUTTON_Y)                          \
+  X(PAGE_KEYBOARD_BUTTONS, KB_BUTTON_SHOULDER_L, BUTTON_SHOULDER_L)        \
+  X(PAGE_KEYBOARD_BUTTONS, KB_BUTTON_SHOULDER_R, BUTTON_SHOULDER_R)        \
+  X(PAGE_KEYBOARD_BUTTONS, KB_BUTTON_TRIGGER_L, BUTTON_TRIGGER_L)          \
+  X(PAGE_KEYBOARD_BUTTONS, KB_BUTTON_TRIGGER_R, BUTTON_TRIGGER_R)          \
+  X(PAGE_KEYBOARD_BUTTONS, KB_BUTTON_THUMB_L, BUTTON_THUMB_L)              \
+  X(PAGE_KEYBOARD_BUTTONS, KB_BUTTON_THUMB_R, BUTTON_THUMB_R)              \
+  X(PAGE_KEYBOARD_BUTTONS, KB_MISC_BUTTON_START, MISC_BUTTON_START)        \
+  X(PAGE_KEYBOARD_BUTTONS, KB_MISC_BUTTON_SELECT, MISC_BUTTON_SELECT)      \
+  X(PAGE_KEYBOARD_BUTTONS, KB_THUMB_L_UP, THUMB_L_UP)                      \
+  X(PAGE_KEYBOARD_BUTTONS, KB_THUMB_L_DOWN, THUMB_L_DOWN)                  \
+  X(PAGE_KEYBOARD_BUTTONS, KB_THUMB_L_RIGHT, THUMB_L_RIGHT)                \
+  X(PAGE_KEYBOARD_BUTTONS, KB_THUMB_L_LEFT, THUMB_L_LEFT)                  \
+  X(PAGE_KEYBOARD_BUTTONS, KB_THUMB_R_UP, THUMB_R_UP)                      \
+  X(PAGE_KEYBOARD_BUTTONS, KB_THUMB_R_DOWN, THUMB_R_DOWN)                  \
+  X(PAGE_KEYBOARD_BUTTONS, KB_THUMB_R_RIGHT, THUMB_R_RIGHT)                \
+  X(PAGE_KEYBOARD_BUTTONS, KB_THUMB_R_LEFT, THUMB_R_LEFT)                  \
+  X(PAGE_MISC_ADDITIONAL_BUTTONS, MISC_BUTTON_HOME, MISC_BUTTON_HOME)      \
+  X(PAGE_MISC_ADDITIONAL_BUTTONS, MISC_BUTTON_MINUS, MISC_BUTTON_MINUS)    \
+  X(PAGE_MISC_ADDITIONAL_BUTTONS, MISC_BUTTON_PREV, MISC_BUTTON_PREV)      \
+  X(PAGE_MISC_ADDITIONAL_BUTTONS, MISC_BUTTON_PLAY, MISC_BUTTON_PLAY)      \
+  X(PAGE_MISC_ADDITIONAL_BUTTONS, MISC_BUTTON_NEXT, MISC_BUTTON_NEXT)      \
+  X(PAGE_MISC_ADDITIONAL_BUTTONS, MISC_BUTTON_PLUS, MISC_BUTTON_PLUS)      \
+  X(PAGE_GAMEPAD_BUTTONS, GP_BUTTON_A, BUTTON_A)                           \
+  X(PAGE_GAMEPAD_BUTTONS, GP_BUTTON_B, BUTTON_B)                           \
+  X(PAGE_GAMEPAD_BUTTONS, GP_BUTTON_C, BUTTON_C)                           \
+  X(PAGE_GAMEPAD_BUTTONS, GP_BUTTON_X, BUTTON_X)                           \
+  X(PAGE_GAMEPAD_BUTTONS, GP_BUTTON_Y, BUTTON_Y)                           \
+  X(PAGE_GAMEPAD_BUTTONS, GP_BUTTON_Z, BUTTON_Z)                           \
+  X(PAGE_GAMEPAD_BUTTONS, GP_BUTTON_SHOULDER_L, BUTTON_SHOULDER_L)         \
+  X(PAGE_GAMEPAD_BUTTONS, GP_BUTTON_SHOULDER_R, BUTTON_SHOULDER_R)         \
+  X(PAGE_GAMEPAD_BUTTONS, GP_BUTTON_TRIGGER_L, BUTTON_TRIGGER_L)           \
+  X(PAGE_GAMEPAD_BUTTONS, GP_BUTTON_TRIGGER_R, BUTTON_TRIGGER_R)           \
+  X(PAGE_GAMEPAD_BUTTONS, GP_BUTTON_UNKNOWN, BUTTON_UNKNOWN)               \
+  X(PAGE_GAMEPAD_BUTTONS, GP_BUTTON_THUMB_L, BUTTON_THUMB_L)               \
+  X(PAGE_GAMEPAD_BUTTONS, GP_BUTTON_THUMB_R, BUTTON_THUMB_R)               \
+  X(PAGE_GAMEPAD_BUTTONS, GP_MISC_BUTTON_START, MISC_BUTTON_START)         \
+  X(PAGE_GAMEPAD_BUTTONS, GP_MISC_BUTTON_SELECT, MISC_BUTTON_SELECT)       \
+  X(PAGE_GAMEPAD_DPAD_THUMB, GP_DPAD_UP, DPAD_UP)                          \
+  X(PAGE_GAMEPAD_DPAD_THUMB, GP_DPAD_DOWN, DPAD_DOWN)                      \
+  X(PAGE_GAMEPAD_DPAD_THUMB, GP_DPAD_RIGHT, DPAD_RIGHT)                    \
+  X(PAGE_GAMEPAD_DPAD_THUMB, GP_DPAD_LEFT, DPAD_LEFT)                      \
+  X(PAGE_GAMEPAD_DPAD_THUMB, GP_THUMB_L_X, THUMB_L_X)                      \
+  X(PAGE_GAMEPAD_DPAD_THUMB, GP_THUMB_L_Y, THUMB_L_Y)                      \
+  X(PAGE_GAMEPAD_DPAD_THUMB, GP_THUMB_R_X, THUMB_R_X)                      \
+  X(PAGE_GAMEPAD_DPAD_THUMB, GP_THUMB_R_Y, THUMB_R_Y)
+
+#define PG9021_EVENT_ENUM(event, analog) PG9021_EVENT_##event,
+
+typedef enum {
+  PG9021_EVENT_NONE = 0,  // (page, usage) without a canonical event
+  PG9021_EVENT_LIST(PG9021_EVENT_ENUM) PG9021_EVENT_COUNT
+} pg9021_event_id_t;
+
+#undef PG9021_EVENT_ENUM
+
+// Slot of a page in pg9021_event_map, -1 for other pages
+#define PG9021_EVENT_PAGE_SLOT(page)                   \
+  ((page) == PAGE_GAMEPAD_DPAD_THUMB        ? 0        \
+   : (page) == PAGE_KEYBOARD_BUTTONS        ? 1        \
+   : (page) == PAGE_GAMEPAD_BUTTONS         ? 2        \
+   : (page) == PAGE_MISC_ADDITIONAL_BUTTONS ? 3        \
+                                            : -1)
+
+#define PG9021_EVENT_PAGES 4
+
+/*
+ * Indexed by page slot and the low byte of the usage. Every entry is the
+ * event ID in the low byte and the high byte of the usage in the high one.
+ */
+extern const uint16_t pg9021_event_map[PG9021_EVENT_PAGES][256];
+extern const char *const pg9021_event_names[PG9021_EVENT_COUNT];
+extern const uint8_t pg9021_event_analog[PG9021_EVENT_COUNT];
+
+static inline pg9021_event_id_t pg9021_event_id(uint16_t page,
+                                                uint16_t usage) {
+  int slot = PG9021_EVENT_PAGE_SLOT(page);
+  if (slot < 0) return PG9021_EVENT_NONE;
+
+  uint16_t entry = pg9021_event_map[slot][usage & 0xff];
+  if ((entry >> 8) != (usage >> 8)) return PG9021_EVENT_NONE;
+  return (pg9021_event_id_t)(entry & 0xff);
+}
+
 #endif  // PG9021_MAPPING_H
\ No newline at end of file
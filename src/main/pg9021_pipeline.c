@@ -0,0 +1,164 @@
+#include "pg9021_pipeline.h"
+
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "pg9021_port.h"
+
+#ifdef ESP_PLATFORM
+#include "sdkconfig.h"
+#endif
+
+static const pg9021_pipeline_layout_t layouts[PG9021_PIPELINE_LAYOUTS] = {
+    [PG9021_PIPELINE_SHARED] = {"shared", {{0, 1}, {0, 5}, {0, 4}, {0, 10},
+                                           {0, 1}}},
+    [PG9021_PIPELINE_PRIORITY] = {"priority", {{0, 12}, {0, 11}, {0, 4},
+                                               {0, 3}, {0, 1}}},
+    [PG9021_PIPELINE_SPLIT] = {"split", {{0, 12}, {1, 11}, {1, 4}, {1, 3},
+                                         {1, 1}}},
+};
+
+static const char *const stage_names[PG9021_STAGES] = {
+    [PG9021_STAGE_BTSTACK] = "btstack",
+    [PG9021_STAGE_DISPATCH] = "dispatch",
+    [PG9021_STAGE_OUTPUT] = "output",
+    [PG9021_STAGE_BUTTON] = "button",
+    [PG9021_STAGE_BACKGROUND] = "background",
+};
+
+static atomic_uint probe_notified_us;  // 0 while the dispatch task runs
+static atomic_int probe_reset_requested;
+static pg9021_pipeline_probe_t probe;
+static uint32_t probe_last_wake_us;
+
+const pg9021_pipeline_layout_t *pg9021_pipeline_layout(int layout) {
+  if (layout < 0 || layout >= PG9021_PIPELINE_LAYOUTS) return NULL;
+  return &layouts[layout];
+}
+
+const char *pg9021_pipeline_stage_name(pg9021_stage_t stage) {
+  return stage_names[stage];
+}
+
+int pg9021_pipeline_core(pg9021_stage_t stage) {
+#ifdef CONFIG_FREERTOS_UNICORE
+  (void)stage;
+  return 0;
+#else
+  return layouts[PG9021_PIPELINE_LAYOUT].stages[stage].core;
+#endif
+}
+
+#ifdef ESP_PLATFORM
+int pg9021_pipeline_create_task(pg9021_stage_t stage, TaskFunction_t task,
+                                const char *name, uint32_t stack_size,
+                                TaskHandle_t *handle) {
+  const pg9021_stage_config_t *config =
+      &layouts[PG9021_PIPELINE_LAYOUT].stages[stage];
+  return xTaskCreatePinnedToCore(task, name, stack_size, NULL,
+                                 config->priority, handle,
+                                 pg9021_pipeline_core(stage)) == pdPASS
+             ? 0
+             : -1;
+}
+#endif
+
+// Microseconds, the same clock on both cores unlike the cycle counter
+static uint32_t PG9021_HOT probe_now_us(void) {
+  uint32_t now = (uint32_t)pg9021_port_time_us();
+  return now ? now : 1;
+}
+
+void PG9021_HOT pg9021_pipeline_notified(void) {
+  unsigned expected = 0;
+  // The first report since the last wake-up, later ones wait less
+  atomic_compare_exchange_strong_explicit(&probe_notified_us, &expected,
+                                          probe_now_us(), memory_order_relaxed,
+                                          memory_order_relaxed);
+}
+
+void PG9021_HOT pg9021_pipeline_woke(void) {
+  uint32_t notified =
+      atomic_exchange_explicit(&probe_notified_us, 0, memory_order_relaxed);
+  uint32_t now = probe_now_us();
+
+  if (atomic_load_explicit(&probe_reset_requested, memory_order_relaxed)) {
+    atomic_store_explicit(&probe_reset_requested, 0, memory_order_relaxed);
+    memset(&probe, 0, sizeof(probe));
+    probe_last_wake_us = 0;
+  }
+  if (!notified) return;  // a notification of an earlier pass
+
+  pg9021_histogram_add(&probe.wake, now - notified);
+  uint32_t interval = now - probe_last_wake_us;
+  if (probe_last_wake_us && interval <= PG9021_PIPELINE_MAX_INTERVAL_US) {
+    pg9021_histogram_add(&probe.interval, interval);
+    probe.interval_sum += interval;
+    probe.interval_squares += (uint64_t)interval * interval;
+  }
+  probe_last_wake_us = now;
+}
+
+void pg9021_pipeline_get_probe(pg9021_pipeline_probe_t *copy) {
+  if (atomic_load_explicit(&probe_reset_requested, memory_order_relaxed)) {
+    memset(copy, 0, sizeof(*copy));
+  } else {
+    *copy = probe;
+  }
+}
+
+void pg9021_pipeline_reset_probe(void) {
+  atomic_store_explicit(&probe_reset_requested, 1, memory_order_relaxed);
+}
+
+static uint32_t square_root(uint64_t value) {
+  uint64_t root = 0;
+  for (uint64_t bit = 1ULL << 62; bit; bit >>= 2) {
+    if (value >= root + bit) {
+      value -= root + bit;
+      root = (root >> 1) + bit;
+    } else {
+      root >>= 1;
+    }
+  }
+  return (uint32_t)root;
+}
+
+static void print_histogram(const char *label,
+                            const pg9021_histogram_t *histogram) {
+  printf("%-9s count %" PRIu32 " p50 %" PRIu32 " p99 %" PRIu32
+         " max %" PRIu32 "\n",
+         label, histogram->count,
+         pg9021_histogram_percentile(histogram, 500),
+         pg9021_histogram_percentile(histogram, 990), histogram->max);
+}
+
+void pg9021_pipeline_print(void) {
+  const pg9021_pipeline_layout_t *layout = &layouts[PG9021_PIPELINE_LAYOUT];
+  pg9021_pipeline_probe_t copy;
+
+  printf("Layout: %s", layout->name);
+#ifdef CONFIG_BTDM_CTRL_PINNED_TO_CORE
+  printf(", controller on core %d", CONFIG_BTDM_CTRL_PINNED_TO_CORE);
+#endif
+  printf("\nstage      core priority\n");
+  for (int i = 0; i < PG9021_STAGES; ++i) {
+    printf("%-10s %4d %8u\n", stage_names[i], pg9021_pipeline_core(i),
+           layout->stages[i].priority);
+  }
+
+  pg9021_pipeline_get_probe(&copy);
+  printf("Dispatch (us):\n");
+  print_histogram("wake", &copy.wake);
+  print_histogram("interval", &copy.interval);
+  uint32_t count = copy.interval.count;
+  if (count) {
+    uint64_t mean = copy.interval_sum / count;
+    uint64_t mean_square = copy.interval_squares / count;
+    printf("interval mean %" PRIu64 " deviation %" PRIu32 "\n", mean,
+           square_root(mean_square > mean * mean ? mean_square - mean * mean
+                                                 : 0));
+  }
+}
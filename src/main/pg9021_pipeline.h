@@ -0,0 +1,90 @@
+#ifndef PG9021_PIPELINE_H
+#define PG9021_PIPELINE_H
+
+#include <stdint.h>
+
+#include "pg9021_latency.h"
+
+/*
+ * Core and priority of every task on the input path. The Bluetooth
+ * controller task is pinned by CONFIG_BTDM_CTRL_PINNED_TO_CORE, the
+ * BTstack run loop decodes the reports next to it and the report callback
+ * hands them to the dispatch task. A layout says where the run loop, the
+ * dispatch task and the sinks run, the jitter probe measures how long the
+ * dispatch task takes to wake up on each layout.
+ */
+
+typedef enum {
+  PG9021_STAGE_BTSTACK,     // run loop: L2CAP, decoding, report callback
+  PG9021_STAGE_DISPATCH,    // event_task, gamepad actions
+  PG9021_STAGE_OUTPUT,      // frame and UDP sinks
+  PG9021_STAGE_BUTTON,      // connect button
+  PG9021_STAGE_BACKGROUND,  // log, console, capture
+  PG9021_STAGES
+} pg9021_stage_t;
+
+typedef enum {
+  PG9021_PIPELINE_SHARED,    // one core, the priorities of the old build
+  PG9021_PIPELINE_PRIORITY,  // one core, input path above everything else
+  PG9021_PIPELINE_SPLIT,     // Bluetooth on core 0, the rest on core 1
+  PG9021_PIPELINE_LAYOUTS
+} pg9021_pipeline_layout_id_t;
+
+// Tasks are created with it, so changing it needs a rebuild
+#ifndef PG9021_PIPELINE_LAYOUT
+#define PG9021_PIPELINE_LAYOUT PG9021_PIPELINE_SPLIT
+#endif
+
+typedef struct {
+  uint8_t core;  // 1 falls back to 0 on CONFIG_FREERTOS_UNICORE
+  uint8_t priority;
+} pg9021_stage_config_t;
+
+typedef struct {
+  const char *name;
+  pg9021_stage_config_t stages[PG9021_STAGES];
+} pg9021_pipeline_layout_t;
+
+// NULL if out of range
+const pg9021_pipeline_layout_t *pg9021_pipeline_layout(int layout);
+const char *pg9021_pipeline_stage_name(pg9021_stage_t stage);
+
+// Core the stage really runs on
+int pg9021_pipeline_core(pg9021_stage_t stage);
+
+#ifdef ESP_PLATFORM
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+// xTaskCreatePinnedToCore() with the core and priority of the stage
+int pg9021_pipeline_create_task(pg9021_stage_t stage, TaskFunction_t task,
+                                const char *name, uint32_t stack_size,
+                                TaskHandle_t *handle);
+#endif
+
+// Wake-ups of the dispatch task longer apart than this start over
+#ifndef PG9021_PIPELINE_MAX_INTERVAL_US
+#define PG9021_PIPELINE_MAX_INTERVAL_US 100000
+#endif
+
+typedef struct {
+  pg9021_histogram_t wake;      // notified to running, us
+  pg9021_histogram_t interval;  // between wake-ups, us
+  uint64_t interval_sum;
+  uint64_t interval_squares;
+} pg9021_pipeline_probe_t;
+
+// Report callback, right before it notifies the dispatch task
+void pg9021_pipeline_notified(void);
+
+// Dispatch task, when the notification woke it up
+void pg9021_pipeline_woke(void);
+
+// Any task, the histograms are cleared on the next wake-up
+void pg9021_pipeline_get_probe(pg9021_pipeline_probe_t *probe);
+void pg9021_pipeline_reset_probe(void);
+
+// Layout, tasks and the probe with the mean and deviation of the interval
+void pg9021_pipeline_print(void);
+
+#endif  // PG9021_PIPELINE_H
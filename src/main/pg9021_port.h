@@ -0,0 +1,61 @@
+#ifndef PG9021_PORT_H
+#define PG9021_PORT_H
+
+#include <stdint.h>
+
+#ifdef ESP_PLATFORM
+#include "esp_attr.h"
+#include "esp_timer.h"
+#include "sdkconfig.h"
+#include "xtensa/hal.h"
+#else
+#include <time.h>
+#endif
+
+// Platform services for code that also builds on the host (src/host)
+
+// Set to 0 to leave the input path in flash. With 1 its functions
+// (PG9021_HOT) run from IRAM and its lookup tables (PG9021_HOT_DATA) sit in
+// DRAM, so a flash write or another task thrashing the cache does not stall
+// a report on cache misses. Costs IRAM, see "bench flash".
+#ifndef PG9021_HOT_PATH
+#define PG9021_HOT_PATH 1
+#endif
+
+#if defined(ESP_PLATFORM) && PG9021_HOT_PATH
+#define PG9021_HOT IRAM_ATTR
+#define PG9021_HOT_DATA DRAM_ATTR
+#else
+#define PG9021_HOT
+#define PG9021_HOT_DATA
+#endif
+
+// Microseconds since boot
+static inline int64_t pg9021_port_time_us(void) {
+#ifdef ESP_PLATFORM
+  return esp_timer_get_time();
+#else
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (int64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+#endif
+}
+
+// Free running cycle counter for short intervals, wraps
+#ifdef ESP_PLATFORM
+#define PG9021_PORT_TICKS_PER_US CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ
+#else
+#define PG9021_PORT_TICKS_PER_US 1000
+#endif
+
+static inline uint32_t pg9021_port_ticks(void) {
+#ifdef ESP_PLATFORM
+  return xthal_get_ccount();
+#else
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint32_t)now.tv_sec * 1000000000u + (uint32_t)now.tv_nsec;
+#endif
+}
+
+#endif  // PG9021_PORT_H
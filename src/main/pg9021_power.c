@@ -0,0 +1,139 @@
+#include "pg9021_power.h"
+
+#include <stdio.h>
+
+#include "pg9021_port.h"
+
+#ifdef ESP_PLATFORM
+#include "sdkconfig.h"
+#endif
+
+#if defined(ESP_PLATFORM) && defined(CONFIG_PM_ENABLE)
+#include "esp_pm.h"
+#define POWER_PM 1
+#else
+#define POWER_PM 0
+#endif
+
+static const pg9021_power_profile_t profiles[PG9021_POWER_PROFILES] = {
+    [PG9021_POWER_PERFORMANCE] = {"performance", 0, 0, 0, 0, 0, 0, 0},
+    [PG9021_POWER_BALANCED] = {"balanced", 3000, 15, 30, 2, 1, 80, 0},
+    [PG9021_POWER_SAVER] = {"saver", 1000, 50, 100, 4, 2, 40, 1},
+};
+
+static int profile_id = PG9021_POWER_PROFILE;
+static pg9021_power_stats_t power_stats;
+static int power_active;  // gamepads holding the locks
+
+#if POWER_PM
+static esp_pm_lock_handle_t cpu_lock;
+static esp_pm_lock_handle_t sleep_lock;
+
+static void power_configure(const pg9021_power_profile_t *profile) {
+  esp_pm_config_esp32_t config = {
+      .max_freq_mhz = CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ,
+      .min_freq_mhz = profile->cpu_min_mhz ? profile->cpu_min_mhz
+                                           : CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ,
+      .light_sleep_enable = profile->light_sleep,
+  };
+  if (esp_pm_configure(&config) != ESP_OK) {
+    printf("Power management not configured for %s\n", profile->name);
+  }
+}
+
+void pg9021_power_init(void) {
+  if (esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "pg9021", &cpu_lock) !=
+          ESP_OK ||
+      esp_pm_lock_create(ESP_PM_NO_LIGHT_SLEEP, 0, "pg9021", &sleep_lock) !=
+          ESP_OK) {
+    printf("Power management locks not available\n");
+  }
+  power_configure(&profiles[profile_id]);
+}
+
+// Locks count, one acquisition per active gamepad
+static void power_hold(int hold) {
+  if (!cpu_lock || !sleep_lock) return;
+  if (hold) {
+    esp_pm_lock_acquire(cpu_lock);
+    esp_pm_lock_acquire(sleep_lock);
+  } else {
+    esp_pm_lock_release(sleep_lock);
+    esp_pm_lock_release(cpu_lock);
+  }
+}
+#else
+static void power_configure(const pg9021_power_profile_t *profile) {
+  (void)profile;
+}
+
+void pg9021_power_init(void) {}
+
+static void power_hold(int hold) { (void)hold; }
+#endif
+
+int pg9021_power_set_profile(int profile) {
+  if (profile < 0 || profile >= PG9021_POWER_PROFILES) return -1;
+  profile_id = profile;
+  power_configure(&profiles[profile]);
+  return 0;
+}
+
+int pg9021_power_get_profile(void) { return profile_id; }
+
+const pg9021_power_profile_t *pg9021_power_profile(int profile) {
+  if (profile < 0 || profile >= PG9021_POWER_PROFILES) return NULL;
+  return &profiles[profile];
+}
+
+void pg9021_power_get_stats(pg9021_power_stats_t *stats) {
+  *stats = power_stats;
+}
+
+int pg9021_power_active(void) { return power_active; }
+
+void pg9021_power_connected(pg9021_power_t *power, uint32_t now_ms) {
+  if (power->connected) return;
+  power->connected = 1;
+  power->idle = 0;
+  power->activity_ms = now_ms;
+  power_active++;
+  power_hold(1);
+}
+
+void pg9021_power_disconnected(pg9021_power_t *power) {
+  if (!power->connected) return;
+  power->connected = 0;
+  if (power->idle) {
+    power->idle = 0;
+    return;
+  }
+  power_active--;
+  power_hold(0);
+}
+
+int PG9021_HOT pg9021_power_activity(pg9021_power_t *power, uint32_t now_ms) {
+  power->activity_ms = now_ms;
+  if (!power->idle) return 0;
+  power->idle = 0;
+  power_stats.wakeups++;
+  power_active++;
+  power_hold(1);
+  return 1;
+}
+
+int pg9021_power_check(pg9021_power_t *power, uint32_t now_ms) {
+  if (pg9021_power_next(power, now_ms) != 0) return 0;
+  power->idle = 1;
+  power_stats.idle++;
+  power_active--;
+  power_hold(0);
+  return 1;
+}
+
+int32_t pg9021_power_next(const pg9021_power_t *power, uint32_t now_ms) {
+  uint16_t idle_ms = profiles[profile_id].idle_ms;
+  if (!power->connected || power->idle || !idle_ms) return -1;
+  int32_t left = (int32_t)(power->activity_ms + idle_ms - now_ms);
+  return left > 0 ? left : 0;
+}
@@ -0,0 +1,81 @@
+#ifndef PG9021_POWER_H
+#define PG9021_POWER_H
+
+#include <stdint.h>
+
+/*
+ * Activity governor. A connected gamepad whose reports did not change the
+ * state for idle_ms of the profile is idle: its link is put in sniff mode
+ * and it stops holding the CPU at full clock and out of light sleep. The
+ * first report that changes the state makes it active again.
+ *
+ * Profiles trade current for wake latency. In sniff mode the first report
+ * after an idle period waits for the next sniff anchor, up to
+ * sniff_max_ms, and the CPU may have to come back from light sleep or a
+ * lower clock. Frequency scaling and light sleep need CONFIG_PM_ENABLE,
+ * without it only sniff mode is used.
+ */
+
+typedef enum {
+  PG9021_POWER_PERFORMANCE,  // never idle, full clock
+  PG9021_POWER_BALANCED,
+  PG9021_POWER_SAVER,
+  PG9021_POWER_PROFILES
+} pg9021_power_profile_id_t;
+
+#ifndef PG9021_POWER_PROFILE
+#define PG9021_POWER_PROFILE PG9021_POWER_BALANCED
+#endif
+
+typedef struct {
+  const char *name;
+  uint16_t idle_ms;       // without a changed report, 0 - never idle
+  uint16_t sniff_min_ms;  // sent as 0.625 ms slots, 0 - no sniff mode
+  uint16_t sniff_max_ms;
+  uint8_t sniff_attempt;  // slots
+  uint8_t sniff_timeout;  // slots
+  uint16_t cpu_min_mhz;   // while no gamepad is active, 0 - full clock
+  uint8_t light_sleep;
+} pg9021_power_profile_t;
+
+typedef struct {
+  uint32_t idle;     // gamepads that went idle
+  uint32_t wakeups;  // and came back on a changed report
+} pg9021_power_stats_t;
+
+// Per gamepad
+typedef struct {
+  uint32_t activity_ms;  // of the last changed report
+  uint8_t connected;
+  uint8_t idle;
+} pg9021_power_t;
+
+// Once, applies PG9021_POWER_PROFILE
+void pg9021_power_init(void);
+
+// Returns -1 for an invalid profile. BTstack thread.
+int pg9021_power_set_profile(int profile);
+int pg9021_power_get_profile(void);
+
+// NULL for an invalid profile
+const pg9021_power_profile_t *pg9021_power_profile(int profile);
+
+void pg9021_power_get_stats(pg9021_power_stats_t *stats);
+
+// Gamepads that hold the CPU at full clock
+int pg9021_power_active(void);
+
+// The gamepad connected, it is active from now
+void pg9021_power_connected(pg9021_power_t *power, uint32_t now_ms);
+void pg9021_power_disconnected(pg9021_power_t *power);
+
+// A report changed the state, returns 1 if the gamepad was idle
+int pg9021_power_activity(pg9021_power_t *power, uint32_t now_ms);
+
+// Returns 1 if the gamepad went idle now
+int pg9021_power_check(pg9021_power_t *power, uint32_t now_ms);
+
+// Milliseconds until the gamepad goes idle, -1 if it will not
+int32_t pg9021_power_next(const pg9021_power_t *power, uint32_t now_ms);
+
+#endif  // PG9021_POWER_H
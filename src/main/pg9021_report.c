@@ -0,0 +1,266 @@
+#include "pg9021_report.h"
+
+#include <string.h>
+
+#include "pg9021_port.h"
+
+// HID short item types and tags (HID 1.11, 6.2.2)
+enum { ITEM_TYPE_MAIN = 0, ITEM_TYPE_GLOBAL = 1, ITEM_TYPE_LOCAL = 2 };
+
+enum { MAIN_INPUT = 0x8, MAIN_COLLECTION = 0xa, MAIN_END_COLLECTION = 0xc };
+
+enum {
+  GLOBAL_USAGE_PAGE = 0x0,
+  GLOBAL_LOGICAL_MINIMUM = 0x1,
+  GLOBAL_REPORT_SIZE = 0x7,
+  GLOBAL_REPORT_ID = 0x8,
+  GLOBAL_REPORT_COUNT = 0x9,
+  GLOBAL_PUSH = 0xa,
+  GLOBAL_POP = 0xb
+};
+
+enum {
+  LOCAL_USAGE = 0x0,
+  LOCAL_USAGE_MINIMUM = 0x1,
+  LOCAL_USAGE_MAXIMUM = 0x2
+};
+
+enum { INPUT_CONSTANT = 0x01, INPUT_VARIABLE = 0x02 };
+
+#define LONG_ITEM_PREFIX 0xfe
+
+typedef struct {
+  // Global items
+  uint16_t usage_page;
+  int32_t logical_minimum;
+  uint32_t report_size;
+  uint32_t report_count;
+  uint8_t report_id;
+
+  // Local items, cleared after every main item
+  uint32_t usages[PG9021_REPORT_MAX_USAGES];
+  uint8_t usage_count;
+  uint32_t usage_minimum;
+  uint32_t usage_maximum;
+  uint8_t has_usage_minimum;
+  uint8_t has_usage_maximum;
+} compile_state_t;
+
+static void clear_local_items(compile_state_t *state) {
+  state->usage_count = 0;
+  state->has_usage_minimum = 0;
+  state->has_usage_maximum = 0;
+}
+
+static uint32_t read_item_data(const uint8_t *data, uint8_t size) {
+  uint32_t value = 0;
+  for (int i = size - 1; i >= 0; --i) {
+    value = (value << 8) | data[i];
+  }
+  return value;
+}
+
+static int32_t sign_extend(uint32_t value, uint8_t size) {
+  if (size == 1) return (int8_t)value;
+  if (size == 2) return (int16_t)value;
+  return (int32_t)value;
+}
+
+// Extended usages (4 byte Usage items) carry their own usage page
+static void split_usage(const compile_state_t *state, uint32_t usage,
+                        uint16_t *usage_page, uint16_t *usage_id) {
+  *usage_page = (usage > 0xffff) ? (uint16_t)(usage >> 16) : state->usage_page;
+  *usage_id = (uint16_t)usage;
+}
+
+static pg9021_report_t *get_report(pg9021_report_table_t *table,
+                                   uint8_t report_id) {
+  for (int i = 0; i < table->report_count; ++i) {
+    if (table->reports[i].report_id == report_id) {
+      return &table->reports[i];
+    }
+  }
+
+  if (table->report_count >= PG9021_REPORT_MAX_REPORTS) {
+    return NULL;
+  }
+
+  pg9021_report_t *report = &table->reports[table->report_count++];
+  report->report_id = report_id;
+  return report;
+}
+
+static int add_input_fields(pg9021_report_table_t *table,
+                            const compile_state_t *state, uint32_t flags) {
+  pg9021_report_t *report = get_report(table, state->report_id);
+  if (!report) return -1;
+
+  if (state->report_size > 32) return -1;
+
+  uint32_t bit_length =
+      report->bit_length + state->report_size * state->report_count;
+  if (bit_length > 0xffff) return -1;
+
+  // Padding
+  if ((flags & INPUT_CONSTANT) || state->report_size == 0) {
+    report->bit_length = (uint16_t)bit_length;
+    return 0;
+  }
+
+  // Fields of one report must stay contiguous in the table
+  if (report->field_count == 0) {
+    report->first_field = table->field_count;
+  } else if (report->first_field + report->field_count != table->field_count) {
+    return -1;
+  }
+
+  uint8_t field_flags = 0;
+  if (state->logical_minimum < 0) field_flags |= PG9021_FIELD_SIGNED;
+  if (!(flags & INPUT_VARIABLE)) field_flags |= PG9021_FIELD_ARRAY;
+
+  for (uint32_t i = 0; i < state->report_count; ++i) {
+    if (table->field_count >= PG9021_REPORT_MAX_FIELDS) return -1;
+
+    uint32_t usage = 0;
+    if (field_flags & PG9021_FIELD_ARRAY) {
+      usage = state->has_usage_minimum ? state->usage_minimum
+              : state->usage_count     ? state->usages[0]
+                                       : 0;
+    } else if (i < state->usage_count) {
+      usage = state->usages[i];
+    } else if (state->has_usage_minimum) {
+      usage = state->usage_minimum + (i - state->usage_count);
+      if (state->has_usage_maximum && usage > state->usage_maximum) {
+        usage = state->usage_maximum;
+      }
+    } else if (state->usage_count) {
+      usage = state->usages[state->usage_count - 1];
+    }
+
+    pg9021_field_t *field = &table->fields[table->field_count++];
+    field->bit_offset = (uint16_t)(report->bit_length + i * state->report_size);
+    field->bit_size = (uint8_t)state->report_size;
+    field->flags = field_flags;
+    split_usage(state, usage, &field->usage_page, &field->usage);
+    report->field_count++;
+  }
+
+  report->bit_length = (uint16_t)bit_length;
+  return 0;
+}
+
+int pg9021_report_table_compile(pg9021_report_table_t *table,
+                                const uint8_t *descriptor,
+                                uint16_t descriptor_len) {
+  compile_state_t state;
+  memset(&state, 0, sizeof(state));
+  memset(table, 0, sizeof(*table));
+
+  uint16_t pos = 0;
+  while (pos < descriptor_len) {
+    uint8_t prefix = descriptor[pos++];
+
+    if (prefix == LONG_ITEM_PREFIX) {
+      if (pos + 2 > descriptor_len) return -1;
+      pos += 2 + descriptor[pos];
+      continue;
+    }
+
+    uint8_t size = prefix & 0x03;
+    if (size == 3) size = 4;
+    uint8_t type = (prefix >> 2) & 0x03;
+    uint8_t tag = prefix >> 4;
+
+    if (pos + size > descriptor_len) return -1;
+    uint32_t data = read_item_data(&descriptor[pos], size);
+    pos += size;
+
+    switch (type) {
+      case ITEM_TYPE_MAIN:
+        if (tag == MAIN_INPUT) {
+          if (add_input_fields(table, &state, data)) return -1;
+        }
+        // Output, Feature and collections only reset the local items
+        clear_local_items(&state);
+        break;
+
+      case ITEM_TYPE_GLOBAL:
+        switch (tag) {
+          case GLOBAL_USAGE_PAGE:
+            state.usage_page = (uint16_t)data;
+            break;
+          case GLOBAL_LOGICAL_MINIMUM:
+            state.logical_minimum = sign_extend(data, size);
+            break;
+          case GLOBAL_REPORT_SIZE:
+            state.report_size = data;
+            break;
+          case GLOBAL_REPORT_ID:
+            if (data == 0 || data > 0xff) return -1;
+            state.report_id = (uint8_t)data;
+            table->has_report_ids = 1;
+            break;
+          case GLOBAL_REPORT_COUNT:
+            state.report_count = data;
+            break;
+          case GLOBAL_PUSH:
+          case GLOBAL_POP:
+            return -1;
+          default:
+            break;
+        }
+        break;
+
+      case ITEM_TYPE_LOCAL:
+        switch (tag) {
+          case LOCAL_USAGE:
+            if (state.usage_count < PG9021_REPORT_MAX_USAGES) {
+              state.usages[state.usage_count++] = data;
+            }
+            break;
+          case LOCAL_USAGE_MINIMUM:
+            state.usage_minimum = data;
+            state.has_usage_minimum = 1;
+            break;
+          case LOCAL_USAGE_MAXIMUM:
+            state.usage_maximum = data;
+            state.has_usage_maximum = 1;
+            break;
+          default:
+            break;
+        }
+        break;
+
+      default:
+        break;
+    }
+  }
+
+  // Mixing reports with and without report ID is not valid HID
+  if (table->has_report_ids) {
+    for (int i = 0; i < table->report_count; ++i) {
+      if (table->reports[i].report_id == 0) return -1;
+    }
+  }
+
+  return 0;
+}
+
+PG9021_HOT const pg9021_report_t *pg9021_report_table_select(
+    const pg9021_report_table_t *table, const uint8_t **report,
+    uint16_t *report_len) {
+  if (!table->has_report_ids) {
+    return table->report_count ? &table->reports[0] : NULL;
+  }
+
+  if (*report_len < 1) return NULL;
+  uint8_t report_id = **report;
+  for (int i = 0; i < table->report_count; ++i) {
+    if (table->reports[i].report_id == report_id) {
+      (*report)++;
+      (*report_len)--;
+      return &table->reports[i];
+    }
+  }
+  return NULL;
+}
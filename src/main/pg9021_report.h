@@ -0,0 +1,127 @@
+#ifndef PG9021_REPORT_H
+#define PG9021_REPORT_H
+
+#include <stdint.h>
+
+#define PG9021_REPORT_MAX_FIELDS 64
+#define PG9021_REPORT_MAX_REPORTS 8
+#define PG9021_REPORT_MAX_USAGES 16
+
+// Largest HID descriptor kept per gamepad
+#ifndef PG9021_REPORT_MAX_DESCRIPTOR
+#define PG9021_REPORT_MAX_DESCRIPTOR 512
+#endif
+
+// Field flags
+enum {
+  PG9021_FIELD_SIGNED = 0x01,  // logical minimum < 0, value is sign extended
+  PG9021_FIELD_ARRAY = 0x02    // value selects a usage (keyboard key codes)
+};
+
+// One Input field, resolved from the HID descriptor
+typedef struct {
+  uint16_t bit_offset;  // from the first byte after the report ID
+  uint8_t bit_size;
+  uint8_t flags;
+  uint16_t usage_page;
+  uint16_t usage;  // usage minimum for array fields
+} pg9021_field_t;
+
+// Input fields of one report ID
+typedef struct {
+  uint8_t report_id;  // 0 - descriptor does not use report IDs
+  uint8_t first_field;
+  uint8_t field_count;
+  uint16_t bit_length;
+} pg9021_report_t;
+
+typedef struct {
+  pg9021_field_t fields[PG9021_REPORT_MAX_FIELDS];
+  pg9021_report_t reports[PG9021_REPORT_MAX_REPORTS];
+  uint8_t field_count;
+  uint8_t report_count;
+  uint8_t has_report_ids;
+} pg9021_report_table_t;
+
+/*
+ * Compile the Input items of a HID descriptor into a flat table.
+ * Returns 0 on success, -1 if the descriptor uses something the table can not
+ * express (Push/Pop, fields wider than 32 bits, too many fields). The caller
+ * should fall back to btstack_hid_parser in this case.
+ */
+int pg9021_report_table_compile(pg9021_report_table_t *table,
+                                const uint8_t *descriptor,
+                                uint16_t descriptor_len);
+
+/*
+ * Find the report for an input report (without the 0xa1 header). Strips the
+ * report ID byte from report / report_len if the descriptor uses report IDs.
+ */
+const pg9021_report_t *pg9021_report_table_select(
+    const pg9021_report_table_t *table, const uint8_t **report,
+    uint16_t *report_len);
+
+static inline uint32_t pg9021_report_get_bits(const uint8_t *report,
+                                              uint16_t bit_offset,
+                                              uint8_t bit_size) {
+  const uint8_t *data = report + (bit_offset >> 3);
+  uint8_t shift = bit_offset & 7;
+
+  if (shift == 0 && bit_size == 8) {
+    return data[0];
+  }
+
+  uint32_t bits = 0;
+  uint8_t bytes = (uint8_t)((shift + bit_size + 7) >> 3);
+  if (bytes > 4) {
+    uint64_t wide = 0;
+    for (int i = bytes - 1; i >= 0; --i) {
+      wide = (wide << 8) | data[i];
+    }
+    bits = (uint32_t)(wide >> shift);
+  } else {
+    for (int i = bytes - 1; i >= 0; --i) {
+      bits = (bits << 8) | data[i];
+    }
+    bits >>= shift;
+  }
+
+  if (bit_size < 32) {
+    bits &= (1UL << bit_size) - 1;
+  }
+  return bits;
+}
+
+/*
+ * Extract one field. Returns 0 if the report is too short for the field.
+ * Array fields are returned like btstack_hid_parser does: usage is the
+ * selected usage and value is 1.
+ */
+static inline int pg9021_field_get(const pg9021_field_t *field,
+                                   const uint8_t *report, uint16_t report_len,
+                                   uint16_t *usage, int32_t *value) {
+  if ((uint32_t)field->bit_offset + field->bit_size >
+      (uint32_t)report_len * 8) {
+    return 0;
+  }
+
+  uint32_t bits =
+      pg9021_report_get_bits(report, field->bit_offset, field->bit_size);
+
+  if (field->flags & PG9021_FIELD_ARRAY) {
+    *usage = (uint16_t)(field->usage + bits);
+    *value = 1;
+    return 1;
+  }
+
+  if ((field->flags & PG9021_FIELD_SIGNED) && field->bit_size < 32 &&
+      (bits & (1UL << (field->bit_size - 1)))) {
+    bits |= ~((1UL << field->bit_size) - 1);
+  }
+
+  *usage = field->usage;
+  *value = (int32_t)bits;
+  return 1;
+}
+
+#endif  // PG9021_REPORT_H
@@ -0,0 +1,152 @@
+#include "pg9021_ring.h"
+
+#include <string.h>
+
+#include "pg9021_port.h"
+
+#define RING_MASK (PG9021_RING_SIZE - 1)
+
+_Static_assert(PG9021_MAX_PLAYERS * PG9021_STATE_AXES <= 32,
+               "axes_pending has a bit per player and axis");
+
+static int PG9021_HOT event_axis(const pg9021_event_t *event) {
+  if (event->page != PAGE_GAMEPAD_DPAD_THUMB) return -1;
+  if (event->player >= PG9021_MAX_PLAYERS) return -1;
+  return pg9021_state_axis(event->usage);
+}
+
+void pg9021_ring_init(pg9021_ring_t *ring, pg9021_ring_policy_t policy) {
+  memset(ring, 0, sizeof(*ring));
+  atomic_init(&ring->head, 0);
+  atomic_init(&ring->tail, 0);
+  atomic_init(&ring->depth_high_water, 0);
+  atomic_init(&ring->dropped, 0);
+  atomic_init(&ring->coalesced, 0);
+  for (int i = 0; i < PG9021_MAX_PLAYERS; ++i) {
+    atomic_init(&ring->axes[i], 0);
+  }
+  atomic_init(&ring->axes_pending, 0);
+  atomic_init(&ring->axes_draining, 0);
+  ring->policy = policy;
+}
+
+void PG9021_HOT pg9021_ring_push(pg9021_ring_t *ring,
+                                 const pg9021_event_t *event) {
+  unsigned head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  unsigned tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+  int axis = event_axis(event);
+
+  if (head - tail >= PG9021_RING_SIZE) {
+    if (ring->policy == PG9021_RING_COALESCE && axis >= 0) {
+      // Only the producer writes axes, the consumer reads it when pending
+      atomic_uint *player_axes = &ring->axes[event->player];
+      unsigned shift = 8 * axis;
+      unsigned axes = atomic_load_explicit(player_axes, memory_order_relaxed);
+      axes = (axes & ~(0xffU << shift)) | ((unsigned)(uint8_t)event->value
+                                           << shift);
+      atomic_store_explicit(player_axes, axes, memory_order_relaxed);
+      atomic_fetch_or_explicit(&ring->axes_pending,
+                               PG9021_RING_AXIS_BIT(event->player, axis),
+                               memory_order_release);
+      atomic_fetch_add_explicit(&ring->coalesced, 1, memory_order_relaxed);
+      return;
+    }
+
+    // Drop the oldest event. If the consumer took it first there is room.
+    if (atomic_compare_exchange_strong_explicit(&ring->tail, &tail, tail + 1,
+                                                memory_order_acq_rel,
+                                                memory_order_acquire)) {
+      atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+    }
+  }
+
+  // A newer value in the ring replaces a coalesced one
+  if (axis >= 0) {
+    atomic_fetch_and_explicit(&ring->axes_pending,
+                              ~PG9021_RING_AXIS_BIT(event->player, axis),
+                              memory_order_relaxed);
+  }
+
+  ring->events[head & RING_MASK] = *event;
+  atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+
+  unsigned depth =
+      head + 1 - atomic_load_explicit(&ring->tail, memory_order_relaxed);
+  if (depth >
+      atomic_load_explicit(&ring->depth_high_water, memory_order_relaxed)) {
+    atomic_store_explicit(&ring->depth_high_water, depth,
+                          memory_order_relaxed);
+  }
+}
+
+// Coalesced axes are delivered after everything queued before them
+static int PG9021_HOT pop_coalesced_axis(pg9021_ring_t *ring,
+                                         pg9021_event_t *event) {
+  unsigned draining =
+      atomic_load_explicit(&ring->axes_draining, memory_order_relaxed);
+  if (!draining) {
+    draining = atomic_exchange_explicit(&ring->axes_pending, 0,
+                                        memory_order_acquire);
+    if (!draining) return 0;
+  }
+
+  int bit = __builtin_ctz(draining);
+  int player = bit / PG9021_STATE_AXES;
+  int axis = bit % PG9021_STATE_AXES;
+  atomic_store_explicit(&ring->axes_draining, draining & (draining - 1),
+                        memory_order_relaxed);
+
+  unsigned axes =
+      atomic_load_explicit(&ring->axes[player], memory_order_relaxed);
+  event->player = (uint8_t)player;
+  event->page = PAGE_GAMEPAD_DPAD_THUMB;
+  event->usage = pg9021_state_axis_usage(axis);
+  event->value = (axes >> (8 * axis)) & 0xff;
+  return 1;
+}
+
+int PG9021_HOT pg9021_ring_pop(pg9021_ring_t *ring, pg9021_event_t *event) {
+  for (;;) {
+    unsigned tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    unsigned head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    if (tail == head) {
+      return pop_coalesced_axis(ring, event);
+    }
+
+    *event = ring->events[tail & RING_MASK];
+
+    // Fails if the producer dropped this event while it was copied
+    if (!atomic_compare_exchange_weak_explicit(&ring->tail, &tail, tail + 1,
+                                               memory_order_acq_rel,
+                                               memory_order_relaxed)) {
+      continue;
+    }
+
+    // Queued after the drain started, so newer than the coalesced value. A
+    // value coalesced since is pending again and still delivered.
+    int axis = event_axis(event);
+    if (axis >= 0) {
+      unsigned draining =
+          atomic_load_explicit(&ring->axes_draining, memory_order_relaxed);
+      atomic_store_explicit(
+          &ring->axes_draining,
+          draining & ~PG9021_RING_AXIS_BIT(event->player, axis),
+          memory_order_relaxed);
+    }
+    return 1;
+  }
+}
+
+void pg9021_ring_get_stats(pg9021_ring_t *ring, pg9021_ring_stats_t *stats) {
+  stats->depth_high_water =
+      atomic_load_explicit(&ring->depth_high_water, memory_order_relaxed);
+  stats->dropped = atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+  stats->coalesced =
+      atomic_load_explicit(&ring->coalesced, memory_order_relaxed);
+}
+
+void pg9021_ring_reset_stats(pg9021_ring_t *ring) {
+  atomic_store_explicit(&ring->depth_high_water, 0, memory_order_relaxed);
+  atomic_store_explicit(&ring->dropped, 0, memory_order_relaxed);
+  atomic_store_explicit(&ring->coalesced, 0, memory_order_relaxed);
+}
@@ -0,0 +1,75 @@
+#ifndef PG9021_RING_H
+#define PG9021_RING_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include "pg9021_state.h"
+
+#define PG9021_RING_SIZE 64  // power of two
+
+#ifdef ESP_PLATFORM
+#define PG9021_CACHE_LINE 32
+#else
+#define PG9021_CACHE_LINE 64
+#endif
+
+// One gamepad_handler_t call
+typedef struct {
+  uint8_t player;
+  uint8_t page;  // every PAGE_* fits
+  uint16_t usage;
+  int32_t value;
+} pg9021_event_t;
+
+// Bit of axes_pending
+#define PG9021_RING_AXIS_BIT(player, axis) \
+  (1U << ((player)*PG9021_STATE_AXES + (axis)))
+
+// What a push does when the ring is full
+typedef enum {
+  PG9021_RING_DROP_OLDEST,  // the oldest queued event is dropped
+  PG9021_RING_COALESCE      // axis events only keep the latest value,
+                            // other events drop the oldest
+} pg9021_ring_policy_t;
+
+typedef struct {
+  uint32_t depth_high_water;
+  uint32_t dropped;
+  uint32_t coalesced;
+} pg9021_ring_stats_t;
+
+/*
+ * Lock-free single producer / single consumer event queue.
+ * pg9021_ring_push() must only be called from one task (the BTstack run
+ * loop) and pg9021_ring_pop() from one other task.
+ */
+typedef struct {
+  // Producer
+  _Alignas(PG9021_CACHE_LINE) atomic_uint head;
+  atomic_uint depth_high_water;
+  atomic_uint dropped;
+  atomic_uint coalesced;
+  // Latest coalesced value of every axis per player, one byte each
+  atomic_uint axes[PG9021_MAX_PLAYERS];
+  atomic_uint axes_pending;  // PG9021_RING_AXIS_BIT()
+
+  // Consumer
+  _Alignas(PG9021_CACHE_LINE) atomic_uint tail;
+  atomic_uint axes_draining;  // pending axes taken but not popped yet
+
+  _Alignas(PG9021_CACHE_LINE) pg9021_event_t events[PG9021_RING_SIZE];
+  pg9021_ring_policy_t policy;
+} pg9021_ring_t;
+
+void pg9021_ring_init(pg9021_ring_t *ring, pg9021_ring_policy_t policy);
+
+void pg9021_ring_push(pg9021_ring_t *ring, const pg9021_event_t *event);
+
+// Returns 0 if the ring is empty
+int pg9021_ring_pop(pg9021_ring_t *ring, pg9021_event_t *event);
+
+void pg9021_ring_get_stats(pg9021_ring_t *ring, pg9021_ring_stats_t *stats);
+void pg9021_ring_reset_stats(pg9021_ring_t *ring);
+
+#endif  // PG9021_RING_H
@@ -0,0 +1,136 @@
+#include "pg9021_sdp.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "bluetooth_sdp.h"
+#include "sdp_util.h"
+
+#define MAX_DEPTH 4
+#define REPORT_DESCRIPTOR_TYPE 0x22
+
+static int attribute_wanted(uint16_t attribute_id) {
+  switch (attribute_id) {
+    case BLUETOOTH_ATTRIBUTE_PROTOCOL_DESCRIPTOR_LIST:
+    case BLUETOOTH_ATTRIBUTE_ADDITIONAL_PROTOCOL_DESCRIPTOR_LISTS:
+    case BLUETOOTH_ATTRIBUTE_HID_DESCRIPTOR_LIST:
+      return 1;
+    default:
+      return 0;
+  }
+}
+
+void pg9021_sdp_reset(pg9021_sdp_assembler_t *assembler) {
+  pg9021_sdp_release(assembler);
+  assembler->arena = malloc(PG9021_SDP_ARENA_SIZE);
+}
+
+void pg9021_sdp_release(pg9021_sdp_assembler_t *assembler) {
+  free(assembler->arena);
+  memset(assembler, 0, sizeof(*assembler));
+}
+
+uint16_t pg9021_sdp_add_byte(pg9021_sdp_assembler_t *assembler,
+                             uint16_t attribute_id, uint16_t attribute_len,
+                             uint16_t offset, uint8_t data) {
+  if (offset == 0) {
+    assembler->value = NULL;
+    assembler->attribute_id = attribute_id;
+    assembler->len = attribute_len;
+    if (!attribute_wanted(attribute_id) || !attribute_len) return 0;
+    if (!assembler->arena ||
+        attribute_len > PG9021_SDP_ARENA_SIZE - assembler->arena_used) {
+      assembler->overflows++;
+      return 0;
+    }
+    assembler->value = &assembler->arena[assembler->arena_used];
+    assembler->arena_used += attribute_len;
+  }
+  if (!assembler->value || attribute_id != assembler->attribute_id ||
+      offset >= assembler->len) {
+    return 0;
+  }
+
+  assembler->value[offset] = data;
+  if (offset + 1 != assembler->len) return 0;
+
+  pg9021_sdp_parse(attribute_id, assembler->value, assembler->len,
+                   &assembler->record);
+  assembler->value = NULL;
+  return attribute_id;
+}
+
+// End of the element, NULL if it does not fit before end
+static const uint8_t *element_end(const uint8_t *element, const uint8_t *end) {
+  if (element >= end ||
+      (uint32_t)(end - element) < de_get_header_size(element)) {
+    return NULL;
+  }
+  uint32_t len = de_get_len(element);
+  return len <= (uint32_t)(end - element) ? element + len : NULL;
+}
+
+// First two values of a sequence, {UUID, PSM} or {type, descriptor}
+static void parse_values(uint16_t attribute_id, const uint8_t *first,
+                         const uint8_t *second, pg9021_sdp_record_t *record) {
+  uint16_t psm;
+
+  switch (attribute_id) {
+    case BLUETOOTH_ATTRIBUTE_PROTOCOL_DESCRIPTOR_LIST:
+    case BLUETOOTH_ATTRIBUTE_ADDITIONAL_PROTOCOL_DESCRIPTOR_LISTS:
+      if (de_get_element_type(first) != DE_UUID ||
+          de_get_uuid32(first) != BLUETOOTH_PROTOCOL_L2CAP ||
+          !de_element_get_uint16(second, &psm)) {
+        return;
+      }
+      if (attribute_id == BLUETOOTH_ATTRIBUTE_PROTOCOL_DESCRIPTOR_LIST) {
+        record->control_psm = psm;
+      } else {
+        record->interrupt_psm = psm;
+      }
+      break;
+    case BLUETOOTH_ATTRIBUTE_HID_DESCRIPTOR_LIST:
+      if (de_get_element_type(first) != DE_UINT ||
+          de_get_size_type(first) != DE_SIZE_8 ||
+          first[1] != REPORT_DESCRIPTOR_TYPE ||
+          de_get_element_type(second) != DE_STRING) {
+        return;
+      }
+      record->descriptor = de_get_string(second);
+      record->descriptor_len = (uint16_t)de_get_data_size(second);
+      break;
+    default:
+      break;
+  }
+}
+
+// Nested sequences are descended into, the values of a sequence are
+// parsed once it ends. end is the end of the sequence.
+static void parse_sequence(uint16_t attribute_id, const uint8_t *sequence,
+                           const uint8_t *end, int depth,
+                           pg9021_sdp_record_t *record) {
+  const uint8_t *values[2];
+  int count = 0;
+
+  for (const uint8_t *element = sequence + de_get_header_size(sequence),
+                     *next;
+       element < end; element = next) {
+    next = element_end(element, end);
+    if (!next) return;
+    if (de_get_element_type(element) == DE_DES) {
+      if (depth < MAX_DEPTH) {
+        parse_sequence(attribute_id, element, next, depth + 1, record);
+      }
+    } else if (count < 2) {
+      values[count++] = element;
+    }
+  }
+  if (count == 2) parse_values(attribute_id, values[0], values[1], record);
+}
+
+void pg9021_sdp_parse(uint16_t attribute_id, const uint8_t *value,
+                      uint16_t len, pg9021_sdp_record_t *record) {
+  const uint8_t *end = element_end(value, value + len);
+  if (!end || de_get_element_type(value) != DE_DES) return;
+  parse_sequence(attribute_id, value, end, 0, record);
+}
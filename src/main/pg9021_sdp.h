@@ -0,0 +1,57 @@
+#ifndef PG9021_SDP_H
+#define PG9021_SDP_H
+
+#include <stdint.h>
+
+#include "pg9021_report.h"
+
+/*
+ * HID record from an SDP query. The SDP client hands over attribute values
+ * a byte per event; the assembler takes a buffer of the announced length
+ * from an arena for the attributes pg9021 reads and skips the rest. The
+ * arena lives on the heap for the length of a query only. Each
+ * complete attribute is parsed in one pass over its nested sequences:
+ * protocol descriptors {L2CAP UUID, PSM, ...} give the PSMs, class
+ * descriptors {0x22, string} the HID report descriptor.
+ */
+
+// Attributes of one query, the HID descriptor list is the largest
+#ifndef PG9021_SDP_ARENA_SIZE
+#define PG9021_SDP_ARENA_SIZE (PG9021_REPORT_MAX_DESCRIPTOR + 128)
+#endif
+
+typedef struct {
+  uint16_t control_psm;       // 0 - not in the record
+  uint16_t interrupt_psm;     // 0 - not in the record
+  const uint8_t *descriptor;  // in the arena until the next query
+  uint16_t descriptor_len;
+} pg9021_sdp_record_t;
+
+typedef struct {
+  uint8_t *arena;  // allocated for the query, NULL - none
+  uint8_t *value;  // of the attribute being received, NULL - skipped
+  uint16_t attribute_id;
+  uint16_t len;
+  uint16_t arena_used;
+  uint16_t overflows;  // attributes that did not fit into the arena
+  pg9021_sdp_record_t record;
+} pg9021_sdp_assembler_t;
+
+// Before each query, allocates a fresh arena. Attributes are counted as
+// overflows without one.
+void pg9021_sdp_reset(pg9021_sdp_assembler_t *assembler);
+
+// After the query, the record's descriptor goes with the arena
+void pg9021_sdp_release(pg9021_sdp_assembler_t *assembler);
+
+// One SDP_EVENT_QUERY_ATTRIBUTE_VALUE. Returns the attribute ID when an
+// attribute completed and was parsed into the record, 0 otherwise.
+uint16_t pg9021_sdp_add_byte(pg9021_sdp_assembler_t *assembler,
+                             uint16_t attribute_id, uint16_t attribute_len,
+                             uint16_t offset, uint8_t data);
+
+// Parses a complete attribute value into the record, for tests and replays
+void pg9021_sdp_parse(uint16_t attribute_id, const uint8_t *value,
+                      uint16_t len, pg9021_sdp_record_t *record);
+
+#endif  // PG9021_SDP_H
@@ -0,0 +1,170 @@
+#ifndef PG9021_STATE_H
+#define PG9021_STATE_H
+
+#include <stdint.h>
+#include <string.h>
+
+#include "pg9021_mapping.h"
+
+#define PG9021_STATE_AXES 4
+
+// Controllers connected at once, events carry the index as player
+#ifndef PG9021_MAX_PLAYERS
+#define PG9021_MAX_PLAYERS 4
+#endif
+#define PG9021_STATE_GAMEPAD_BUTTONS 16
+#define PG9021_STATE_MISC_BUTTONS 6
+
+// Bits of pg9021_state_t.buttons
+enum {
+  PG9021_STATE_GAMEPAD_SHIFT = 0,  // page 0x0009, usage n at bit n - 1
+  PG9021_STATE_MISC_SHIFT = 16     // page 0x000c, see pg9021_state_misc()
+};
+
+// Indexes of pg9021_state_t.axes
+enum {
+  PG9021_AXIS_L_X = 0,
+  PG9021_AXIS_L_Y = 1,
+  PG9021_AXIS_R_X = 2,
+  PG9021_AXIS_R_Y = 3
+};
+
+// Bits of the changed mask passed to gamepad_report_handler_t
+enum {
+  PG9021_CHANGED_BUTTONS = 0x01,
+  PG9021_CHANGED_HAT = 0x02,
+  PG9021_CHANGED_KEYS = 0x04,
+  PG9021_CHANGED_AXES = 0xf0  // PG9021_CHANGED_AXIS(n) for one axis
+};
+
+#define PG9021_CHANGED_AXIS(axis) (0x10 << (axis))
+
+/*
+ * Whole controller state. Every usage of every page has its own slot, so
+ * states can be compared, copied and snapshotted as plain memory.
+ */
+typedef struct {
+  uint32_t buttons;
+  uint8_t hat;  // GP_DPAD_* value, 4 bits
+  uint8_t axes[PG9021_STATE_AXES];
+  uint8_t reserved[3];
+  uint32_t keys[8];  // page 0x0007, bit per usage
+} pg9021_state_t;
+
+static inline void pg9021_state_init(pg9021_state_t *state) {
+  memset(state, 0, sizeof(*state));
+  state->hat = GP_DPAD_RELEASED;
+  for (int i = 0; i < PG9021_STATE_AXES; ++i) {
+    state->axes[i] = GP_THUMB_RELEASED;
+  }
+}
+
+static inline int pg9021_state_equal(const pg9021_state_t *a,
+                                     const pg9021_state_t *b) {
+  return memcmp(a, b, sizeof(*a)) == 0;
+}
+
+// Axis index of a page 0x0001 usage, -1 if it is not a thumb axis
+static inline int pg9021_state_axis(uint16_t usage) {
+  switch (usage) {
+    case GP_THUMB_L_X:
+      return PG9021_AXIS_L_X;
+    case GP_THUMB_L_Y:
+      return PG9021_AXIS_L_Y;
+    case GP_THUMB_R_X:
+      return PG9021_AXIS_R_X;
+    case GP_THUMB_R_Y:
+      return PG9021_AXIS_R_Y;
+    default:
+      return -1;
+  }
+}
+
+static inline uint16_t pg9021_state_axis_usage(int axis) {
+  switch (axis) {
+    case PG9021_AXIS_L_X:
+      return GP_THUMB_L_X;
+    case PG9021_AXIS_L_Y:
+      return GP_THUMB_L_Y;
+    case PG9021_AXIS_R_X:
+      return GP_THUMB_R_X;
+    default:
+      return GP_THUMB_R_Y;
+  }
+}
+
+// Button bit of a page 0x0009 usage, -1 if it has no slot
+static inline int pg9021_state_gamepad(uint16_t usage) {
+  if (usage < 1 || usage > PG9021_STATE_GAMEPAD_BUTTONS) return -1;
+  return PG9021_STATE_GAMEPAD_SHIFT + usage - 1;
+}
+
+// Button bit of a page 0x000c usage, -1 if it has no slot
+static inline int pg9021_state_misc(uint16_t usage) {
+  switch (usage) {
+    case MISC_BUTTON_HOME:
+      return PG9021_STATE_MISC_SHIFT + 0;
+    case MISC_BUTTON_MINUS:
+      return PG9021_STATE_MISC_SHIFT + 1;
+    case MISC_BUTTON_PREV:
+      return PG9021_STATE_MISC_SHIFT + 2;
+    case MISC_BUTTON_PLAY:
+      return PG9021_STATE_MISC_SHIFT + 3;
+    case MISC_BUTTON_NEXT:
+      return PG9021_STATE_MISC_SHIFT + 4;
+    case MISC_BUTTON_PLUS:
+      return PG9021_STATE_MISC_SHIFT + 5;
+    default:
+      return -1;
+  }
+}
+
+// Page 0x000c usage of a misc button index (bit - PG9021_STATE_MISC_SHIFT)
+static inline uint16_t pg9021_state_misc_usage(int index) {
+  switch (index) {
+    case 0:
+      return MISC_BUTTON_HOME;
+    case 1:
+      return MISC_BUTTON_MINUS;
+    case 2:
+      return MISC_BUTTON_PREV;
+    case 3:
+      return MISC_BUTTON_PLAY;
+    case 4:
+      return MISC_BUTTON_NEXT;
+    default:
+      return MISC_BUTTON_PLUS;
+  }
+}
+
+static inline int pg9021_state_key(const pg9021_state_t *state,
+                                   uint8_t usage) {
+  return (state->keys[usage >> 5] >> (usage & 31)) & 1;
+}
+
+static inline void pg9021_state_set_key(pg9021_state_t *state, uint8_t usage,
+                                        int pressed) {
+  if (pressed) {
+    state->keys[usage >> 5] |= 1UL << (usage & 31);
+  } else {
+    state->keys[usage >> 5] &= ~(1UL << (usage & 31));
+  }
+}
+
+// PG9021_CHANGED_* mask of the fields that differ between two states
+static inline uint32_t pg9021_state_changes(const pg9021_state_t *a,
+                                            const pg9021_state_t *b) {
+  uint32_t changed = 0;
+
+  if (a->buttons != b->buttons) changed |= PG9021_CHANGED_BUTTONS;
+  if (a->hat != b->hat) changed |= PG9021_CHANGED_HAT;
+  for (int i = 0; i < PG9021_STATE_AXES; ++i) {
+    if (a->axes[i] != b->axes[i]) changed |= PG9021_CHANGED_AXIS(i);
+  }
+  if (memcmp(a->keys, b->keys, sizeof(a->keys)) != 0) {
+    changed |= PG9021_CHANGED_KEYS;
+  }
+  return changed;
+}
+
+#endif  // PG9021_STATE_H
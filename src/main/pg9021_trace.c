@@ -0,0 +1,95 @@
+#include "pg9021_trace.h"
+
+#include <string.h>
+
+static const uint8_t trace_magic[4] = {'P', 'G', '9', 'T'};
+
+static size_t store_varint(uint8_t *buffer, uint32_t value) {
+  size_t len = 0;
+  while (value >= 0x80) {
+    buffer[len++] = (uint8_t)(value | 0x80);
+    value >>= 7;
+  }
+  buffer[len++] = (uint8_t)value;
+  return len;
+}
+
+size_t pg9021_trace_encode_header(uint8_t *buffer, uint32_t start_time) {
+  memcpy(buffer, trace_magic, sizeof(trace_magic));
+  buffer[4] = PG9021_TRACE_VERSION;
+  buffer[5] = 0;
+  buffer[6] = (uint8_t)start_time;
+  buffer[7] = (uint8_t)(start_time >> 8);
+  buffer[8] = (uint8_t)(start_time >> 16);
+  buffer[9] = (uint8_t)(start_time >> 24);
+  return PG9021_TRACE_HEADER_SIZE;
+}
+
+size_t pg9021_trace_encode_record(uint8_t *buffer,
+                                  pg9021_trace_record_type_t type,
+                                  uint32_t delta, uint16_t len) {
+  size_t pos = 1;
+
+  if (type == PG9021_TRACE_RECORD_DESCRIPTOR) {
+    buffer[0] = PG9021_TRACE_DESCRIPTOR;
+    pos += store_varint(&buffer[pos], delta);
+    buffer[pos++] = (uint8_t)len;
+    buffer[pos++] = (uint8_t)(len >> 8);
+  } else {
+    buffer[0] = (uint8_t)len;
+    pos += store_varint(&buffer[pos], delta);
+  }
+  return pos;
+}
+
+int pg9021_trace_reader_init(pg9021_trace_reader_t *reader,
+                             const uint8_t *data, size_t len) {
+  if (len < PG9021_TRACE_HEADER_SIZE ||
+      memcmp(data, trace_magic, sizeof(trace_magic)) != 0 ||
+      data[4] != PG9021_TRACE_VERSION) {
+    return -1;
+  }
+
+  reader->data = data;
+  reader->len = len;
+  reader->pos = PG9021_TRACE_HEADER_SIZE;
+  reader->timestamp = data[6] | (data[7] << 8) | (data[8] << 16) |
+                      ((uint32_t)data[9] << 24);
+  return 0;
+}
+
+int pg9021_trace_read(pg9021_trace_reader_t *reader,
+                      pg9021_trace_record_t *record) {
+  const uint8_t *data = reader->data;
+  size_t pos = reader->pos;
+  uint32_t delta = 0;
+  uint16_t len;
+
+  if (pos == reader->len || data[pos] == PG9021_TRACE_END) return 0;
+
+  uint8_t kind = data[pos++];
+  for (int shift = 0;; shift += 7) {
+    if (pos == reader->len || shift > 28) return -1;
+    uint8_t byte = data[pos++];
+    delta |= (uint32_t)(byte & 0x7f) << shift;
+    if (!(byte & 0x80)) break;
+  }
+
+  if (kind == PG9021_TRACE_DESCRIPTOR) {
+    if (reader->len - pos < 2) return -1;
+    len = data[pos] | (data[pos + 1] << 8);
+    pos += 2;
+    record->type = PG9021_TRACE_RECORD_DESCRIPTOR;
+  } else {
+    len = kind;
+    record->type = PG9021_TRACE_RECORD_REPORT;
+  }
+  if (reader->len - pos < len) return -1;
+
+  reader->timestamp += delta;
+  record->timestamp = reader->timestamp;
+  record->data = &data[pos];
+  record->len = len;
+  reader->pos = pos + len;
+  return 1;
+}
@@ -0,0 +1,63 @@
+#ifndef PG9021_TRACE_H
+#define PG9021_TRACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Binary trace of raw HID interrupt reports.
+ *
+ * Header:  "PG9T", version, 0, start time (uint32 LE, microseconds)
+ * Records: length, time since the previous record (LEB128 varint, us),
+ *          length bytes of the L2CAP packet (0xa1 header included).
+ *          Length 0xfe is a HID descriptor record instead, followed by
+ *          the time, a uint16 LE length and the descriptor. 0xff ends the
+ *          trace, so the rest of an erased flash partition reads as the end.
+ *
+ * Every trace starts with a descriptor record, a new one follows when the
+ * controller reconnects.
+ */
+
+#define PG9021_TRACE_VERSION 1
+#define PG9021_TRACE_HEADER_SIZE 10
+#define PG9021_TRACE_DESCRIPTOR 0xfe
+#define PG9021_TRACE_END 0xff
+#define PG9021_TRACE_MAX_REPORT 0xfd
+
+// Largest encoding of a record without its data
+#define PG9021_TRACE_MAX_RECORD_HEADER 8
+
+typedef enum {
+  PG9021_TRACE_RECORD_REPORT,
+  PG9021_TRACE_RECORD_DESCRIPTOR
+} pg9021_trace_record_type_t;
+
+typedef struct {
+  pg9021_trace_record_type_t type;
+  uint32_t timestamp;  // microseconds, same clock as the header
+  const uint8_t *data;
+  uint16_t len;
+} pg9021_trace_record_t;
+
+typedef struct {
+  const uint8_t *data;
+  size_t len;
+  size_t pos;
+  uint32_t timestamp;
+} pg9021_trace_reader_t;
+
+// Return the number of bytes written to buffer
+size_t pg9021_trace_encode_header(uint8_t *buffer, uint32_t start_time);
+size_t pg9021_trace_encode_record(uint8_t *buffer,
+                                  pg9021_trace_record_type_t type,
+                                  uint32_t delta, uint16_t len);
+
+// Returns -1 if data does not start with a trace header
+int pg9021_trace_reader_init(pg9021_trace_reader_t *reader,
+                             const uint8_t *data, size_t len);
+
+// 1 - record read, 0 - end of trace, -1 - truncated or corrupt record
+int pg9021_trace_read(pg9021_trace_reader_t *reader,
+                      pg9021_trace_record_t *record);
+
+#endif  // PG9021_TRACE_H
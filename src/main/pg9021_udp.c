@@ -0,0 +1,196 @@
+#include "pg9021_udp.h"
+
+#include <stdatomic.h>
+#include <string.h>
+
+#include "pg9021_pipeline.h"
+#include "pg9021_port.h"
+
+#ifdef ESP_PLATFORM
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "lwip/sockets.h"
+#else
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#endif
+
+#define SNAPSHOT_TRIES 4
+
+// Written by the run loop even while stopped, so the first keyframe has
+// every gamepad. The sequence is odd while the state is copied.
+typedef struct {
+  atomic_uint sequence;
+  pg9021_state_t state;
+} udp_slot_t;
+
+static udp_slot_t udp_slots[PG9021_MAX_PLAYERS];
+static atomic_uint udp_present;  // bit per player that reported
+static atomic_int udp_running;
+static pg9021_udp_sink_t udp_sink;
+// Set from the console task, read by the UDP task
+static atomic_uint udp_interval_ms = PG9021_UDP_INTERVAL_MS;
+static atomic_uint udp_keyframe_ms = PG9021_UDP_KEYFRAME_MS;
+
+// Sender side
+static pg9021_state_t udp_sent[PG9021_MAX_PLAYERS];
+static uint8_t udp_sequence;
+static uint8_t udp_keyframe_due;
+static uint32_t udp_keyframe_time_ms;
+static uint8_t udp_datagram[PG9021_UDP_DATAGRAM_SIZE];
+static pg9021_udp_stats_t udp_stats;
+
+void PG9021_HOT pg9021_udp_report(uint8_t player, const pg9021_state_t *state) {
+  udp_slot_t *slot = &udp_slots[player];
+  unsigned sequence =
+      atomic_load_explicit(&slot->sequence, memory_order_relaxed);
+
+  atomic_store_explicit(&slot->sequence, sequence + 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  slot->state = *state;
+  atomic_store_explicit(&slot->sequence, sequence + 2, memory_order_release);
+  atomic_fetch_or_explicit(&udp_present, 1u << player, memory_order_release);
+}
+
+// Returns -1 if the run loop kept writing
+static int udp_snapshot(uint8_t player, pg9021_state_t *state) {
+  udp_slot_t *slot = &udp_slots[player];
+
+  for (int i = 0; i < SNAPSHOT_TRIES; ++i) {
+    unsigned before =
+        atomic_load_explicit(&slot->sequence, memory_order_acquire);
+    if (!(before & 1)) {
+      *state = slot->state;
+      atomic_thread_fence(memory_order_acquire);
+      if (atomic_load_explicit(&slot->sequence, memory_order_relaxed) ==
+          before) {
+        return 0;
+      }
+    }
+    udp_stats.torn++;
+  }
+  return -1;
+}
+
+void pg9021_udp_poll(uint32_t now_ms) {
+  pg9021_udp_sink_t sink = udp_sink;
+  unsigned present = atomic_load_explicit(&udp_present, memory_order_acquire);
+  pg9021_state_t state;
+  size_t len = 0;
+
+  if (!sink || !atomic_load_explicit(&udp_running, memory_order_acquire)) {
+    return;
+  }
+
+  unsigned keyframe_ms =
+      atomic_load_explicit(&udp_keyframe_ms, memory_order_relaxed);
+  int keyframe = udp_keyframe_due || !keyframe_ms ||
+                 (uint32_t)(now_ms - udp_keyframe_time_ms) >= keyframe_ms;
+  for (uint8_t player = 0; player < PG9021_MAX_PLAYERS; ++player) {
+    if (!(present & (1u << player)) || udp_snapshot(player, &state) != 0) {
+      continue;
+    }
+    if (keyframe) {
+      len += pg9021_frame_encode_full(&udp_datagram[len], player,
+                                      udp_sequence++, &state);
+      udp_stats.full++;
+    } else {
+      uint32_t changed = pg9021_state_changes(&udp_sent[player], &state);
+      if (!changed) continue;
+      len += pg9021_frame_encode_delta(&udp_datagram[len], player,
+                                       udp_sequence++, &state, changed);
+      udp_stats.delta++;
+    }
+    udp_sent[player] = state;
+  }
+  if (keyframe) {
+    udp_keyframe_due = 0;
+    udp_keyframe_time_ms = now_ms;
+  }
+  if (!len) return;
+
+  // A datagram that did not go out is a gap in the sequence numbers, the
+  // receiver waits for the next keyframe
+  if ((*sink)(udp_datagram, len) != 0) {
+    udp_stats.errors++;
+    return;
+  }
+  udp_stats.datagrams++;
+  udp_stats.bytes += len;
+}
+
+int pg9021_udp_start(pg9021_udp_sink_t sink) {
+  if (atomic_load(&udp_running)) return -1;
+
+  memset(&udp_stats, 0, sizeof(udp_stats));
+  udp_keyframe_due = 1;
+  udp_sink = sink;
+  atomic_store_explicit(&udp_running, 1, memory_order_release);
+  return 0;
+}
+
+void pg9021_udp_stop(void) {
+  atomic_store_explicit(&udp_running, 0, memory_order_release);
+}
+
+int pg9021_udp_set_rate(uint16_t interval_ms, uint16_t keyframe_ms) {
+  if (interval_ms < 1 || interval_ms > 1000) return -1;
+  atomic_store_explicit(&udp_interval_ms, interval_ms, memory_order_relaxed);
+  atomic_store_explicit(&udp_keyframe_ms, keyframe_ms, memory_order_relaxed);
+  return 0;
+}
+
+void pg9021_udp_get_rate(uint16_t *interval_ms, uint16_t *keyframe_ms) {
+  *interval_ms = atomic_load_explicit(&udp_interval_ms, memory_order_relaxed);
+  *keyframe_ms = atomic_load_explicit(&udp_keyframe_ms, memory_order_relaxed);
+}
+
+void pg9021_udp_get_stats(pg9021_udp_stats_t *stats) { *stats = udp_stats; }
+
+static int udp_socket = -1;
+static struct sockaddr_in udp_address;
+
+static int socket_sink(const uint8_t *data, size_t len) {
+  ssize_t sent = sendto(udp_socket, data, len, 0,
+                        (const struct sockaddr *)&udp_address,
+                        sizeof(udp_address));
+  return sent == (ssize_t)len ? 0 : -1;
+}
+
+#ifdef ESP_PLATFORM
+static TaskHandle_t udp_task_handle;
+
+// sendto() may block in lwIP, never on the BTstack run loop
+static void udp_task(void *arg) {
+  TickType_t wake = xTaskGetTickCount();
+  for (;;) {
+    TickType_t ticks = pdMS_TO_TICKS(
+        atomic_load_explicit(&udp_interval_ms, memory_order_relaxed));
+    vTaskDelayUntil(&wake, ticks ? ticks : 1);
+    pg9021_udp_poll((uint32_t)(esp_timer_get_time() / 1000));
+  }
+}
+#endif
+
+int pg9021_udp_start_socket(const char *address, uint16_t port) {
+  memset(&udp_address, 0, sizeof(udp_address));
+  udp_address.sin_family = AF_INET;
+  udp_address.sin_port = htons(port);
+  if (inet_pton(AF_INET, address, &udp_address.sin_addr) != 1) return -1;
+
+  if (udp_socket < 0) {
+    udp_socket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (udp_socket < 0) return -1;
+  }
+  if (pg9021_udp_start(&socket_sink) != 0) return -1;
+
+#ifdef ESP_PLATFORM
+  if (!udp_task_handle) {
+    pg9021_pipeline_create_task(PG9021_STAGE_OUTPUT, udp_task, "udp_task",
+                                3072, &udp_task_handle);
+  }
+#endif
+  return 0;
+}
@@ -0,0 +1,70 @@
+#ifndef PG9021_UDP_H
+#define PG9021_UDP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "pg9021_frame.h"
+#include "pg9021_state.h"
+
+/*
+ * Gamepad state over UDP, for a game server on the Wi-Fi side. The BTstack
+ * run loop only copies the latest state of a player into its slot. The
+ * sender polls the slots at a fixed interval and puts a delta frame
+ * (pg9021_frame.h) for every player that changed since the last poll into
+ * one datagram. Every keyframe interval the datagram carries full frames
+ * of all players instead, so a receiver that lost datagrams catches up.
+ * Datagrams are plain frame streams, pg9021_frame_decode() reads them.
+ */
+
+#ifndef PG9021_UDP_PORT
+#define PG9021_UDP_PORT 9021
+#endif
+
+#ifndef PG9021_UDP_INTERVAL_MS
+#define PG9021_UDP_INTERVAL_MS 10
+#endif
+
+#ifndef PG9021_UDP_KEYFRAME_MS
+#define PG9021_UDP_KEYFRAME_MS 500
+#endif
+
+#define PG9021_UDP_DATAGRAM_SIZE (PG9021_MAX_PLAYERS * PG9021_FRAME_MAX_SIZE)
+
+// Sends one datagram, returns 0 on success
+typedef int (*pg9021_udp_sink_t)(const uint8_t *data, size_t len);
+
+typedef struct {
+  uint32_t datagrams;
+  uint32_t full;
+  uint32_t delta;
+  uint32_t bytes;
+  uint32_t errors;  // datagrams the sink did not take
+  uint32_t torn;    // snapshots read again, the run loop was writing
+} pg9021_udp_stats_t;
+
+// Returns -1 if the sink is running
+int pg9021_udp_start(pg9021_udp_sink_t sink);
+void pg9021_udp_stop(void);
+
+// Interval 1..1000 ms, keyframe 0 for full frames only. Any task. Returns
+// -1 if out of range.
+int pg9021_udp_set_rate(uint16_t interval_ms, uint16_t keyframe_ms);
+void pg9021_udp_get_rate(uint16_t *interval_ms, uint16_t *keyframe_ms);
+
+// From the report callback, BTstack run loop. Never blocks.
+void pg9021_udp_report(uint8_t player, const pg9021_state_t *state);
+
+// One datagram with the changes since the last poll, nothing if there are
+// none. Called every interval by the UDP task on the ESP32, by the
+// application elsewhere.
+void pg9021_udp_poll(uint32_t now_ms);
+
+// Any task, the counters may be a datagram apart
+void pg9021_udp_get_stats(pg9021_udp_stats_t *stats);
+
+// UDP socket to address:port, IPv4. On the ESP32 this also starts the
+// task that polls, the network must be up before datagrams go out.
+int pg9021_udp_start_socket(const char *address, uint16_t port);
+
+#endif  // PG9021_UDP_H